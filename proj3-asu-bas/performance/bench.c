@@ -0,0 +1,399 @@
+#include <getopt.h>
+#include <math.h>
+#include <omp.h>
+#include <time.h>
+#include "matrix.h"
+#include "kernels.h"
+
+/*
+ * Per-operation benchmark: times each kernel on its own over a set of shapes
+ * and thread counts with the monotonic wall clock, and reports latency
+ * percentiles, GFLOP/s and GB/s. GB/s counts the compulsory traffic (every
+ * operand read once, the result written once), so it compares directly with
+ * memory bandwidth. With -o, every sample also goes to a JSON file that
+ * other tools can compare runs with.
+ *
+ *   matrix_bench [-o results.json] [-t 1,4,8] [-f substring] [-s seconds] [-r reps]
+ */
+
+// How each operation uses its operands; a, b and dst shapes follow from m, k, n
+typedef enum operand_kind {
+    PRODUCT,        // a m x k, b k x n, dst m x n
+    ELEMENTWISE,    // a, b, dst all m x n
+    UNARY,          // a, dst m x n
+    TRANSPOSE,      // a m x n, dst n x m
+    OUTER,          // a m x 1, b n x 1, dst m x n
+    DOT,            // a, b m x 1
+    BATCH,          // k products of m x m by m x m, stacked
+} operand_kind;
+
+typedef struct bench_data {
+    matrix *a, *b, *dst;
+    int m, k, n;
+} bench_data;
+
+typedef struct bench_op {
+    const char *name;
+    operand_kind kind;
+    void (*run)(bench_data *d);
+    double flops_per_element;      // per dst element, for the non-product kinds
+} bench_op;
+
+#define BENCH_POW 5
+
+static void run_multiply(bench_data *d) { matrix_multiply(d->a, d->b, d->dst); }
+static void run_power(bench_data *d) { matrix_power(d->a, BENCH_POW, d->dst); }
+static void run_add(bench_data *d) { matrix_add(d->a, d->b, d->dst); }
+static void run_sub(bench_data *d) { matrix_sub(d->a, d->b, d->dst); }
+static void run_mul(bench_data *d) { matrix_multiply_elementwise(d->a, d->b, d->dst); }
+static void run_scale(bench_data *d) { matrix_scale(d->a, 3.0f, d->dst); }
+static void run_exp(bench_data *d) { apply_math(d->a, d->dst, MATH_EXP); }
+static void run_tanh(bench_data *d) { apply_math(d->a, d->dst, MATH_TANH); }
+static void run_copy(bench_data *d) { copy(d->a, d->dst); }
+static void run_fill(bench_data *d) { fill_matrix(d->dst, 1.5f); }
+static void run_transpose(bench_data *d) { matrix_transpose(d->a, d->dst); }
+static void run_outer(bench_data *d) { outer_product(d->a, d->b, d->dst); }
+static void run_batch(bench_data *d) { matrix_batch_multiply(d->a, d->b, d->k, d->dst); }
+
+static void run_dot(bench_data *d) {
+    float result;
+    dot_product(d->a, d->b, &result);
+}
+
+static const bench_op ops[] = {
+    {"multiply", PRODUCT, run_multiply, 0},
+    {"power", PRODUCT, run_power, 0},
+    {"batch_multiply", BATCH, run_batch, 0},
+    {"add", ELEMENTWISE, run_add, 1},
+    {"sub", ELEMENTWISE, run_sub, 1},
+    {"multiply_elementwise", ELEMENTWISE, run_mul, 1},
+    {"scale", UNARY, run_scale, 1},
+    {"exp", UNARY, run_exp, 1},
+    {"tanh", UNARY, run_tanh, 1},
+    {"copy", UNARY, run_copy, 0},
+    {"fill", UNARY, run_fill, 0},
+    {"transpose", TRANSPOSE, run_transpose, 0},
+    {"outer_product", OUTER, run_outer, 1},
+    {"dot_product", DOT, run_dot, 2},
+};
+
+typedef struct bench_case {
+    const char *op;
+    int m, k, n;        // k is unused except by products (and the batch count of batch_multiply)
+} bench_case;
+
+/*
+ * Square sizes, the harness shapes (testing/shared.h), the skinny and vector
+ * products, and odd sizes (631, 3001) that leave ragged edges everywhere.
+ */
+static const bench_case cases[] = {
+    {"multiply", 64, 64, 64},
+    {"multiply", 256, 256, 256},
+    {"multiply", 631, 631, 631},
+    {"multiply", 1000, 1000, 1000},
+    {"multiply", 2048, 2048, 2048},
+    {"multiply", 3000, 1000, 1000},
+    {"multiply", 3001, 3001, 1},
+    {"multiply", 1000, 1000, 3},
+    {"multiply", 3, 1000, 1000},
+    {"multiply", 1, 3001, 3001},
+    {"power", 631, 631, 631},
+    {"power", 1000, 1000, 1000},
+    {"batch_multiply", 8, 10000, 8},
+    {"batch_multiply", 50, 1000, 50},
+    {"add", 631, 0, 631},
+    {"add", 3000, 0, 1000},
+    {"add", 3001, 0, 1},
+    {"add", 4096, 0, 4096},
+    {"sub", 3000, 0, 1000},
+    {"multiply_elementwise", 3000, 0, 1000},
+    {"scale", 3000, 0, 1000},
+    {"scale", 3001, 0, 1},
+    {"exp", 1000, 0, 1000},
+    {"tanh", 1000, 0, 1000},
+    {"copy", 3000, 0, 1000},
+    {"fill", 3000, 0, 1000},
+    {"transpose", 631, 0, 631},
+    {"transpose", 1000, 0, 1000},
+    {"transpose", 3000, 0, 1000},
+    {"transpose", 4096, 0, 4096},
+    {"outer_product", 3001, 0, 3001},
+    {"dot_product", 3001, 0, 1},
+    {"dot_product", 1000000, 0, 1},
+};
+
+#define BENCH_MAX_SAMPLES 1000
+#define BENCH_MAX_THREADS 16
+
+typedef struct bench_options {
+    const char *output;
+    const char *filter;
+    int threads[BENCH_MAX_THREADS];
+    int thread_counts;
+    double seconds;     // per case and thread count, after the warm-up run
+    int min_reps;
+} bench_options;
+
+static double now_seconds(void) {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec + tp.tv_nsec * 1e-9;
+}
+
+static const bench_op *find_op(const char *name) {
+    for (size_t i = 0; i < sizeof ops / sizeof ops[0]; i++) {
+        if (strcmp(ops[i].name, name) == 0) {
+            return &ops[i];
+        }
+    }
+    return NULL;
+}
+
+static matrix *random_matrix(int rows, int cols) {
+    matrix *m;
+    if (allocate_matrix(&m, rows, cols) != 0) {
+        fprintf(stderr, "out of memory for a %d x %d matrix\n", rows, cols);
+        exit(1);
+    }
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            // Small values keep exp, tanh and power in range
+            MAT_ROW(m, i)[j] = (float) drand48() - 0.5f;
+        }
+    }
+    return m;
+}
+
+static void setup(const bench_op *op, const bench_case *c, bench_data *d) {
+    int m = c->m, k = c->k, n = c->n;
+    d->m = m;
+    d->k = k;
+    d->n = n;
+    d->b = NULL;
+    switch (op->kind) {
+    case PRODUCT:
+        d->a = random_matrix(m, k);
+        d->b = random_matrix(k, n);
+        d->dst = random_matrix(m, n);
+        break;
+    case BATCH:
+        d->a = random_matrix(k * m, m);
+        d->b = random_matrix(k * m, n);
+        d->dst = random_matrix(k * m, n);
+        break;
+    case ELEMENTWISE:
+        d->b = random_matrix(m, n);
+        // fall through
+    case UNARY:
+        d->a = random_matrix(m, n);
+        d->dst = random_matrix(m, n);
+        break;
+    case TRANSPOSE:
+        d->a = random_matrix(m, n);
+        d->dst = random_matrix(n, m);
+        break;
+    case OUTER:
+        d->a = random_matrix(m, 1);
+        d->b = random_matrix(n, 1);
+        d->dst = random_matrix(m, n);
+        break;
+    case DOT:
+        d->a = random_matrix(m, 1);
+        d->b = random_matrix(m, 1);
+        d->dst = NULL;
+        break;
+    }
+}
+
+static void teardown(bench_data *d) {
+    free_matrix(d->a);
+    if (d->b != NULL) {
+        free_matrix(d->b);
+    }
+    if (d->dst != NULL) {
+        free_matrix(d->dst);
+    }
+}
+
+// Floating point operations and compulsory bytes moved by one run
+static void work(const bench_op *op, const bench_case *c, double *flops, double *bytes) {
+    double m = c->m, k = c->k, n = c->n;
+    *flops = *bytes = 0;
+    switch (op->kind) {
+    case PRODUCT:
+        if (op->run == run_power) {
+            // Binary exponentiation: 3 products for the 5th power
+            *flops = 3 * 2 * m * m * m;
+            *bytes = 4 * 2 * m * m;
+        } else {
+            *flops = 2 * m * k * n;
+            *bytes = 4 * (m * k + k * n + m * n);
+        }
+        break;
+    case BATCH:
+        *flops = 2 * k * m * m * n;
+        *bytes = 4 * k * (m * m + m * n + m * n);
+        break;
+    case ELEMENTWISE:
+        *flops = op->flops_per_element * m * n;
+        *bytes = 4 * 3 * m * n;
+        break;
+    case UNARY:
+        *flops = op->flops_per_element * m * n;
+        *bytes = 4 * (op->run == run_fill ? 1 : 2) * m * n;
+        break;
+    case TRANSPOSE:
+        *flops = 0;
+        *bytes = 4 * 2 * m * n;
+        break;
+    case OUTER:
+        *flops = m * n;
+        *bytes = 4 * (m + n + m * n);
+        break;
+    case DOT:
+        *flops = 2 * m;
+        *bytes = 4 * 2 * m;
+        break;
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between the closest ranks of sorted samples
+static double percentile(const double *sorted, int count, double p) {
+    double rank = p / 100 * (count - 1);
+    int lo = (int) rank;
+    int hi = lo + 1 < count ? lo + 1 : lo;
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+static int run_case(const bench_op *op, const bench_case *c, int threads, const bench_options *opt,
+                    double *samples) {
+    bench_data d;
+    setup(op, c, &d);
+    omp_set_num_threads(threads);
+    op->run(&d);        // warm-up: faults pages in, fills the buffer pool
+    int count = 0;
+    double start = now_seconds();
+    while (count < BENCH_MAX_SAMPLES && (count < opt->min_reps || now_seconds() - start < opt->seconds)) {
+        double t = now_seconds();
+        op->run(&d);
+        samples[count++] = now_seconds() - t;
+    }
+    teardown(&d);
+    return count;
+}
+
+static int parse_threads(const char *list, bench_options *opt) {
+    opt->thread_counts = 0;
+    for (const char *p = list; *p != '\0' && opt->thread_counts < BENCH_MAX_THREADS;) {
+        char *end;
+        long t = strtol(p, &end, 10);
+        if (end == p || t < 1) {
+            return -1;
+        }
+        opt->threads[opt->thread_counts++] = (int) t;
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+    }
+    return opt->thread_counts > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    bench_options opt = {NULL, NULL, {1}, 1, 0.25, 5};
+    int max_threads = omp_get_max_threads();
+    if (max_threads > 1) {
+        opt.threads[opt.thread_counts++] = max_threads;
+    }
+    int c;
+    while ((c = getopt(argc, argv, "o:t:f:s:r:")) != -1) {
+        switch (c) {
+        case 'o':
+            opt.output = optarg;
+            break;
+        case 't':
+            if (parse_threads(optarg, &opt) != 0) {
+                fprintf(stderr, "-t takes a comma separated list of thread counts\n");
+                return 2;
+            }
+            break;
+        case 'f':
+            opt.filter = optarg;
+            break;
+        case 's':
+            opt.seconds = atof(optarg);
+            break;
+        case 'r':
+            opt.min_reps = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-o results.json] [-t 1,4,8] [-f substring] [-s seconds] [-r reps]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    FILE *json = NULL;
+    if (opt.output != NULL && (json = fopen(opt.output, "w")) == NULL) {
+        perror(opt.output);
+        return 1;
+    }
+    if (json != NULL) {
+        fprintf(json, "{\n  \"kernels\": \"%s\",\n  \"max_threads\": %d,\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"results\": [",
+                kernels->name, max_threads);
+    }
+    printf("kernels: %s\n", kernels->name);
+    printf("%-22s %-18s %3s %5s %10s %10s %10s %9s %8s\n", "op", "shape", "thr", "reps", "median ms", "p10 ms",
+           "p90 ms", "GFLOP/s", "GB/s");
+
+    static double samples[BENCH_MAX_SAMPLES], sorted[BENCH_MAX_SAMPLES];
+    int first = 1;
+    srand48(61);
+    for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+        const bench_case *bc = &cases[i];
+        const bench_op *op = find_op(bc->op);
+        char shape[48];
+        snprintf(shape, sizeof shape, "%dx%dx%d", bc->m, bc->k, bc->n);
+        if (opt.filter != NULL && strstr(bc->op, opt.filter) == NULL && strstr(shape, opt.filter) == NULL) {
+            continue;
+        }
+        double flops, bytes;
+        work(op, bc, &flops, &bytes);
+        for (int t = 0; t < opt.thread_counts; t++) {
+            int count = run_case(op, bc, opt.threads[t], &opt, samples);
+            memcpy(sorted, samples, count * sizeof(double));
+            qsort(sorted, count, sizeof(double), compare_doubles);
+            double median = percentile(sorted, count, 50);
+            double p10 = percentile(sorted, count, 10), p90 = percentile(sorted, count, 90);
+            double gflops = flops / median * 1e-9, gbps = bytes / median * 1e-9;
+            printf("%-22s %-18s %3d %5d %10.4f %10.4f %10.4f %9.2f %8.2f\n", op->name, shape, opt.threads[t], count,
+                   median * 1e3, p10 * 1e3, p90 * 1e3, gflops, gbps);
+            fflush(stdout);
+            if (json == NULL) {
+                continue;
+            }
+            fprintf(json, "%s\n    {\"op\": \"%s\", \"m\": %d, \"k\": %d, \"n\": %d, \"threads\": %d, "
+                    "\"median_ms\": %.6f, \"p10_ms\": %.6f, \"p90_ms\": %.6f, \"min_ms\": %.6f, "
+                    "\"gflops\": %.4f, \"gbps\": %.4f,\n     \"samples_ms\": [",
+                    first ? "" : ",", op->name, bc->m, bc->k, bc->n, opt.threads[t],
+                    median * 1e3, p10 * 1e3, p90 * 1e3, sorted[0] * 1e3, gflops, gbps);
+            for (int s = 0; s < count; s++) {
+                fprintf(json, "%s%.6f", s == 0 ? "" : ", ", samples[s] * 1e3);
+            }
+            fprintf(json, "]}");
+            first = 0;
+        }
+    }
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        if (fclose(json) != 0) {
+            perror(opt.output);
+            return 1;
+        }
+    }
+    return 0;
+}
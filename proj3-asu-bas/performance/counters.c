@@ -0,0 +1,215 @@
+#include "counters.h"
+#include <cpuid.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <omp.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+int counters_on;
+
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static op_counters totals[OP_COUNT];
+static int available;
+
+// Each thread counts itself, on its own file descriptors
+static __thread int thread_fds[CTR_EVENT_COUNT];
+static __thread int thread_opened;
+static __thread int thread_open_errno;     // why the first event that failed did
+// Ops in progress on this thread; only the outermost one is charged
+static __thread int counter_depth;
+
+static const char *event_names[CTR_EVENT_COUNT] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "fp_ops",
+};
+
+static const char *op_names[OP_COUNT] = {
+    "multiply", "power", "batch_multiply", "add", "sub", "multiply_elementwise", "batch_add", "scale",
+    "batch_scale", "pow_elementwise", "math", "func", "fill", "copy", "transpose", "dot", "outer", "fused",
+};
+
+const char *counter_event_name(counter_event e) {
+    return event_names[e];
+}
+
+const char *counter_op_name(counter_op op) {
+    return op_names[op];
+}
+
+static int is_intel(void) {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0, &eax, &ebx, &ecx, &edx) && ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e;
+}
+
+static uint64_t cache_event(uint64_t cache) {
+    return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+}
+
+// Returns 0 and leaves errno set when the event does not exist here
+static int event_attr(counter_event e, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof *attr);
+    attr->size = sizeof *attr;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (e) {
+    case CTR_CYCLES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CPU_CYCLES;
+        return 1;
+    case CTR_INSTRUCTIONS:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+        return 1;
+    case CTR_L1D_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = cache_event(PERF_COUNT_HW_CACHE_L1D);
+        return 1;
+    case CTR_LLC_MISSES:
+        attr->type = PERF_TYPE_HARDWARE;
+        attr->config = PERF_COUNT_HW_CACHE_MISSES;
+        return 1;
+    case CTR_DTLB_MISSES:
+        attr->type = PERF_TYPE_HW_CACHE;
+        attr->config = cache_event(PERF_COUNT_HW_CACHE_DTLB);
+        return 1;
+    case CTR_FP_OPS:
+        // FP_ARITH_INST_RETIRED with every scalar and packed width selected (Skylake and later)
+        if (! is_intel()) {
+            errno = ENOENT;
+            return 0;
+        }
+        attr->type = PERF_TYPE_RAW;
+        attr->config = 0xc7 | 0xff << 8;
+        return 1;
+    default:
+        errno = EINVAL;
+        return 0;
+    }
+}
+
+/*
+ * Opens this thread's counters; returns the mask of those that opened. Each
+ * is a separate event rather than a group so that a missing one does not take
+ * the others down; the kernel multiplexes them if the PMU is short of slots.
+ */
+static int open_thread_events(void) {
+    int mask = 0, saved_errno = 0;
+    for (int e = 0; e < CTR_EVENT_COUNT; e++) {
+        struct perf_event_attr attr;
+        thread_fds[e] = -1;
+        if (event_attr(e, &attr)) {
+            thread_fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+        if (thread_fds[e] >= 0) {
+            mask |= 1 << e;
+        } else if (saved_errno == 0) {
+            saved_errno = errno;
+        }
+    }
+    thread_opened = 1;
+    thread_open_errno = saved_errno;
+    errno = saved_errno;
+    return mask;
+}
+
+static uint64_t read_event(int fd) {
+    uint64_t v[3];      // value, time enabled, time running
+    if (fd < 0 || read(fd, v, sizeof v) != sizeof v || v[2] == 0) {
+        return 0;
+    }
+    return v[2] < v[1] ? (uint64_t) ((double) v[0] * v[1] / v[2]) : v[0];
+}
+
+static void sample_thread(uint64_t *sum) {
+    if (! thread_opened) {
+        open_thread_events();
+    }
+    for (int e = 0; e < CTR_EVENT_COUNT; e++) {
+        __atomic_fetch_add(&sum[e], read_event(thread_fds[e]), __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Sum of the counters of every thread the op can run on. Outside a parallel
+ * region that is the team the next one would start, inside it just this thread.
+ */
+static void sample_threads(uint64_t *sum) {
+    memset(sum, 0, CTR_EVENT_COUNT * sizeof(uint64_t));
+    if (omp_in_parallel()) {
+        sample_thread(sum);
+        return;
+    }
+    #pragma omp parallel
+    sample_thread(sum);
+}
+
+void counters_begin(counter_scope *scope, counter_op op) {
+    if (counter_depth++ > 0) {
+        scope->op = COUNTER_SCOPE_NESTED;
+        return;
+    }
+    scope->op = op;
+    sample_threads(scope->start);
+}
+
+void counters_end(counter_scope *scope) {
+    counter_depth--;
+    if (scope->op < 0) {
+        return;
+    }
+    uint64_t end[CTR_EVENT_COUNT];
+    sample_threads(end);
+    pthread_mutex_lock(&counters_lock);
+    op_counters *t = &totals[scope->op];
+    t->calls++;
+    for (int e = 0; e < CTR_EVENT_COUNT; e++) {
+        t->values[e] += end[e] - scope->start[e];
+    }
+    pthread_mutex_unlock(&counters_lock);
+}
+
+int counters_enable(int on) {
+    if (! on) {
+        __atomic_store_n(&counters_on, 0, __ATOMIC_RELAXED);
+        return available;
+    }
+    int mask = thread_opened ? available : open_thread_events();
+    if (mask == 0) {
+        // Later calls on this thread report the error of the attempt that was made
+        errno = thread_open_errno != 0 ? thread_open_errno : ENOENT;
+        return 0;
+    }
+    available = mask;
+    __atomic_store_n(&counters_on, 1, __ATOMIC_RELAXED);
+    return mask;
+}
+
+int counters_enabled(void) {
+    return __atomic_load_n(&counters_on, __ATOMIC_RELAXED);
+}
+
+void counters_reset(void) {
+    pthread_mutex_lock(&counters_lock);
+    memset(totals, 0, sizeof totals);
+    pthread_mutex_unlock(&counters_lock);
+}
+
+int counters_read(op_counters out[OP_COUNT]) {
+    pthread_mutex_lock(&counters_lock);
+    memcpy(out, totals, sizeof totals);
+    pthread_mutex_unlock(&counters_lock);
+    return available;
+}
+
+// MATRIX_COUNTERS=1 turns counting on at load time
+__attribute__((constructor))
+static void init_counters(void) {
+    const char *env = getenv("MATRIX_COUNTERS");
+    if (env != NULL && atoi(env) != 0) {
+        counters_enable(1);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+
+/*
+ * Hardware performance counters per matrix operation, through Linux
+ * perf_event_open. Off by default; counters_enable(1) (or MATRIX_COUNTERS=1
+ * in the environment) turns on counting. While it is on, every public op in
+ * matrix.c samples the counters of each OpenMP thread before and after it
+ * runs and charges the difference to the op. Ops that other ops call (the
+ * products of matrix_power, say) are charged to the outer op. Counting user
+ * space only lets it run at the default perf_event_paranoid level.
+ */
+typedef enum counter_event {
+    CTR_CYCLES,
+    CTR_INSTRUCTIONS,
+    CTR_L1D_MISSES,         // L1 data cache read misses
+    CTR_LLC_MISSES,         // last level cache misses
+    CTR_DTLB_MISSES,        // data TLB read misses
+    CTR_FP_OPS,             // FP arithmetic instructions retired (any width); Intel only
+    CTR_EVENT_COUNT
+} counter_event;
+
+typedef enum counter_op {
+    OP_MULTIPLY,
+    OP_POWER,
+    OP_BATCH_MULTIPLY,
+    OP_ADD,
+    OP_SUB,
+    OP_MULTIPLY_ELEMENTWISE,
+    OP_BATCH_ADD,
+    OP_SCALE,
+    OP_BATCH_SCALE,
+    OP_POW_ELEMENTWISE,
+    OP_MATH,
+    OP_FUNC,
+    OP_FILL,
+    OP_COPY,
+    OP_TRANSPOSE,
+    OP_DOT,
+    OP_OUTER,
+    OP_FUSED,               // a lazy expression tree (matrix_eval_expr)
+    OP_COUNT
+} counter_op;
+
+typedef struct op_counters {
+    uint64_t calls;                         // while counting was on
+    uint64_t values[CTR_EVENT_COUNT];       // scaled up if the kernel multiplexed them
+} op_counters;
+
+/*
+ * Turns counting on or off. Returns a mask of the events (1 << counter_event)
+ * the calling thread could open, 0 when there are none (no PMU, or
+ * perf_event_open is not allowed), in which case counting stays off.
+ */
+int counters_enable(int on);
+int counters_enabled(void);
+void counters_reset(void);
+// Copies out the totals of every op; returns the mask of available events
+int counters_read(op_counters totals[OP_COUNT]);
+const char *counter_event_name(counter_event e);
+const char *counter_op_name(counter_op op);
+
+/*
+ * Scope of one op: COUNT_OP(OP_ADD); at the top of a function samples the
+ * counters there and again when the function returns, on any path.
+ */
+typedef struct counter_scope {
+    int op;                                 // COUNTER_SCOPE_OFF when not counting
+    uint64_t start[CTR_EVENT_COUNT];
+} counter_scope;
+
+#define COUNTER_SCOPE_OFF (-1)
+#define COUNTER_SCOPE_NESTED (-2)          // inside another op, which is charged instead
+
+extern int counters_on;
+void counters_begin(counter_scope *scope, counter_op op);
+void counters_end(counter_scope *scope);
+
+static inline void counter_scope_exit(counter_scope *scope) {
+    if (scope->op != COUNTER_SCOPE_OFF) {
+        counters_end(scope);
+    }
+}
+
+#define COUNT_OP(op) \
+    counter_scope counter_scope_ __attribute__((cleanup(counter_scope_exit))) = {COUNTER_SCOPE_OFF}; \
+    if (__atomic_load_n(&counters_on, __ATOMIC_RELAXED)) { \
+        counters_begin(&counter_scope_, op); \
+    }
+
+#endif
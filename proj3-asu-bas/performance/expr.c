@@ -0,0 +1,92 @@
+#include "expr.h"
+#include "kernels.h"
+#include "counters.h"
+#include "trace.h"
+#include <omp.h>
+
+/*
+ * dst is cut into tiles of at most EXPR_TILE floats. For each tile the tree
+ * is evaluated bottom-up: leaves are read in place, every interior node
+ * writes into its own L1-sized scratch slot, and the root writes straight
+ * into dst. Each input is read once and dst written once, however many
+ * operations the tree chains. Tiles are independent and split across threads.
+ */
+#define EXPR_TILE 512
+#define EXPR_PARALLEL_MIN (1 << 14)
+
+/* Evaluates node i over one tile; returns where its values are */
+static const float *eval_node(const matrix_expr *nodes, int i, int row, size_t col, int len, int flat,
+                              float *out, float *scratch) {
+    const matrix_expr *e = &nodes[i];
+    if (e->op == EXPR_LEAF) {
+        return flat ? e->leaf->data + col : MAT_ROW(e->leaf, row) + col;
+    }
+    const float *a = eval_node(nodes, e->lhs, row, col, len, flat, scratch + (size_t) e->lhs * EXPR_TILE, scratch);
+    const float *b = NULL;
+    if (e->op == EXPR_ADD || e->op == EXPR_SUB || e->op == EXPR_MUL) {
+        b = eval_node(nodes, e->rhs, row, col, len, flat, scratch + (size_t) e->rhs * EXPR_TILE, scratch);
+    }
+    switch (e->op) {
+        case EXPR_ADD:
+            kernels->add(a, b, out, len);
+            break;
+        case EXPR_SUB:
+            kernels->sub(a, b, out, len);
+            break;
+        case EXPR_MUL:
+            kernels->mul(a, b, out, len);
+            break;
+        case EXPR_SCALE:
+            kernels->scale(a, e->scalar, out, len);
+            break;
+        case EXPR_POW:
+            kernels->pow(a, e->scalar, out, len);
+            break;
+        case EXPR_MATH:
+            kernels->math[e->func](a, out, len);
+            break;
+        case EXPR_LEAF:
+            break;
+    }
+    return out;
+}
+
+void matrix_eval_expr(const matrix_expr *nodes, int count, int root, matrix *dst) {
+    assert(count > 0 && count <= EXPR_MAX_NODES && root >= 0 && root < count);
+    COUNT_OP(OP_FUSED);
+    TRACE_SCOPE("matrix", "fused", dst->dim.rows, dst->dim.cols, count);
+    int rows = dst->dim.rows, cols = dst->dim.cols;
+    size_t total = (size_t) rows * cols;
+
+    // With every operand dense the whole matrix is one long run
+    int flat = dst->stride == cols;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i].op == EXPR_LEAF) {
+            assert(same_size(nodes[i].leaf, dst));
+            flat = flat && nodes[i].leaf->stride == cols;
+        }
+    }
+    size_t run = flat ? total : (size_t) cols;
+    int runs = flat ? 1 : rows;
+    size_t tiles_per_run = (run + EXPR_TILE - 1) / EXPR_TILE;
+    long tiles = (long) (runs * tiles_per_run);
+
+    #pragma omp parallel if (total >= EXPR_PARALLEL_MIN)
+    {
+        float *scratch = malloc((size_t) count * EXPR_TILE * sizeof(float));
+        assert(scratch != NULL);
+        #pragma omp for schedule(static)
+        for (long t = 0; t < tiles; t++) {
+            int row = (int) (t / tiles_per_run);
+            size_t col = (t % tiles_per_run) * EXPR_TILE;
+            int len = (int) (run - col < EXPR_TILE ? run - col : EXPR_TILE);
+            float *out = flat ? dst->data + col : MAT_ROW(dst, row) + col;
+            const float *result = eval_node(nodes, root, row, col, len, flat, out, scratch);
+            if (result != out) {
+                // The root itself is a leaf
+                memcpy(out, result, len * sizeof(float));
+            }
+        }
+        free(scratch);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "matrix.h"
+
+/*
+ * Elementwise expression trees, evaluated in one fused pass.
+ * A tree is a flat array of nodes; interior nodes name their operands by
+ * index. Every leaf must have the shape of the destination.
+ */
+typedef enum expr_op {
+    EXPR_LEAF,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_SCALE,
+    EXPR_POW,
+    EXPR_MATH
+} expr_op;
+
+typedef struct matrix_expr {
+    expr_op op;
+    matrix *leaf;       // EXPR_LEAF
+    int lhs;            // operand of unary nodes, left operand of binary ones
+    int rhs;
+    float scalar;       // EXPR_SCALE factor, EXPR_POW exponent
+    math_func func;     // EXPR_MATH
+} matrix_expr;
+
+// Upper bound on nodes per tree; callers materialize operands to stay under it
+#define EXPR_MAX_NODES 32
+
+void matrix_eval_expr(const matrix_expr *nodes, int count, int root, matrix *dst);
+
+#endif
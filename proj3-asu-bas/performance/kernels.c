@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <immintrin.h>
+#include "kernels.h"
+
+/*
+ * In-register tile transposes. The 8x8 float and 4x4 double ones only need
+ * AVX, so the AVX2 and AVX-512 variants can both inline them.
+ */
+static inline void transpose4x4_sse(const float *src, int lds, float *dst, int ldd) {
+    __m128 r0 = _mm_loadu_ps(src);
+    __m128 r1 = _mm_loadu_ps(src + lds);
+    __m128 r2 = _mm_loadu_ps(src + 2 * (size_t) lds);
+    __m128 r3 = _mm_loadu_ps(src + 3 * (size_t) lds);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(dst, r0);
+    _mm_storeu_ps(dst + ldd, r1);
+    _mm_storeu_ps(dst + 2 * (size_t) ldd, r2);
+    _mm_storeu_ps(dst + 3 * (size_t) ldd, r3);
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx")
+static inline void transpose8x8_avx(const float *src, int lds, float *dst, int ldd) {
+    __m256 r[8], t[8];
+    for (int i = 0; i < 8; i++) {
+        r[i] = _mm256_loadu_ps(src + (size_t) i * lds);
+    }
+    // Interleave pairs of rows, then pairs of pairs, then swap 128-bit halves
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        r[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        r[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        r[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        r[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+    for (int i = 0; i < 4; i++) {
+        _mm256_storeu_ps(dst + (size_t) i * ldd, _mm256_permute2f128_ps(r[i], r[i + 4], 0x20));
+        _mm256_storeu_ps(dst + (size_t) (i + 4) * ldd, _mm256_permute2f128_ps(r[i], r[i + 4], 0x31));
+    }
+}
+
+static inline void transpose4x4_avx_pd(const double *src, int lds, double *dst, int ldd) {
+    __m256d r0 = _mm256_loadu_pd(src), r1 = _mm256_loadu_pd(src + lds);
+    __m256d r2 = _mm256_loadu_pd(src + 2 * lds), r3 = _mm256_loadu_pd(src + 3 * (size_t) lds);
+    __m256d t0 = _mm256_unpacklo_pd(r0, r1), t1 = _mm256_unpackhi_pd(r0, r1);
+    __m256d t2 = _mm256_unpacklo_pd(r2, r3), t3 = _mm256_unpackhi_pd(r2, r3);
+    _mm256_storeu_pd(dst, _mm256_permute2f128_pd(t0, t2, 0x20));
+    _mm256_storeu_pd(dst + ldd, _mm256_permute2f128_pd(t1, t3, 0x20));
+    _mm256_storeu_pd(dst + 2 * (size_t) ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+    _mm256_storeu_pd(dst + 3 * (size_t) ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+#pragma GCC pop_options
+
+static inline void transpose2x2_sse2_pd(const double *src, int lds, double *dst, int ldd) {
+    __m128d r0 = _mm_loadu_pd(src), r1 = _mm_loadu_pd(src + lds);
+    _mm_storeu_pd(dst, _mm_unpacklo_pd(r0, r1));
+    _mm_storeu_pd(dst + ldd, _mm_unpackhi_pd(r0, r1));
+}
+
+/*
+ * 16-bit floats. IEEE binary16 has a 5 bit exponent and 10 bit mantissa, so
+ * without F16C every value is converted by hand; bfloat16 is the top half of
+ * a float and only needs a shift (and rounding on the way down). Narrowing
+ * rounds to nearest even like the F16C and AVX512_BF16 instructions, with
+ * NaNs kept quiet NaNs and overflow going to infinity.
+ */
+static inline float fp16_to_float_scalar(uint16_t h) {
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    uint32_t bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | mant << 13;
+    } else if (exp != 0) {
+        bits = sign | (exp + 112) << 23 | mant << 13;
+    } else {
+        // Subnormal: mant * 2^-24, exact in float
+        float f = mant * 0x1p-24f;
+        return sign ? -f : f;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof f);
+    return f;
+}
+
+static inline uint16_t float_to_fp16_scalar(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof u);
+    uint16_t sign = (u >> 16) & 0x8000;
+    u &= 0x7fffffff;
+    if (u >= 0x7f800000) {
+        // Infinity, or a NaN with the top of its payload and the quiet bit
+        return sign | 0x7c00 | (u > 0x7f800000 ? 0x200 | ((u >> 13) & 0x3ff) : 0);
+    }
+    if (u >= 0x477ff000) {
+        // At least halfway between 65504 and 65536: overflows
+        return sign | 0x7c00;
+    }
+    if (u < 0x38800000) {
+        // Subnormal or zero: adding 0.5 lets the FPU round the mantissa into place
+        uint32_t magic = 126u << 23;
+        float m, sum;
+        memcpy(&m, &magic, sizeof m);
+        memcpy(&sum, &u, sizeof sum);
+        sum += m;
+        memcpy(&u, &sum, sizeof u);
+        return sign | (uint16_t) (u - magic);
+    }
+    // Rebias the exponent and round to nearest even on the 13 dropped bits
+    u += ((uint32_t) (15 - 127) << 23) + 0xfff + ((u >> 13) & 1);
+    return sign | (uint16_t) (u >> 13);
+}
+
+static inline __m128 load4_fp16_sse2(const uint16_t *p) {
+    return _mm_setr_ps(fp16_to_float_scalar(p[0]), fp16_to_float_scalar(p[1]),
+                       fp16_to_float_scalar(p[2]), fp16_to_float_scalar(p[3]));
+}
+
+static inline void store4_fp16_sse2(uint16_t *p, __m128 v) {
+    float f[4];
+    _mm_storeu_ps(f, v);
+    for (int i = 0; i < 4; i++) {
+        p[i] = float_to_fp16_scalar(f[i]);
+    }
+}
+
+static inline __m128 load4_bf16_sse2(const uint16_t *p) {
+    // Interleaving with zeros puts each value in the top half of a float
+    return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i *) p)));
+}
+
+static inline void store4_bf16_sse2(uint16_t *p, __m128 v) {
+    __m128i u = _mm_castps_si128(v);
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(u, 16), _mm_set1_epi32(1));
+    __m128i r = _mm_add_epi32(u, _mm_add_epi32(odd, _mm_set1_epi32(0x7fff)));
+    __m128i nan = _mm_castps_si128(_mm_cmpunord_ps(v, v));
+    r = _mm_or_si128(_mm_and_si128(nan, _mm_or_si128(u, _mm_set1_epi32(0x400000))), _mm_andnot_si128(nan, r));
+    // Arithmetic shift so the signed saturating pack leaves the 16 bits alone
+    r = _mm_srai_epi32(r, 16);
+    _mm_storel_epi64((__m128i *) p, _mm_packs_epi32(r, r));
+}
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+static inline __m256 load8_bf16_avx2(const uint16_t *p) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p)), 16));
+}
+
+static inline void store8_bf16_avx2(uint16_t *p, __m256 v) {
+    __m256i u = _mm256_castps_si256(v);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(u, 16), _mm256_set1_epi32(1));
+    __m256i r = _mm256_add_epi32(u, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff)));
+    __m256i nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    r = _mm256_blendv_epi8(r, _mm256_or_si256(u, _mm256_set1_epi32(0x400000)), nan);
+    r = _mm256_srli_epi32(r, 16);
+    // The pack works within 128 bit lanes; gather the two useful quarters
+    r = _mm256_permute4x64_epi64(_mm256_packus_epi32(r, r), 0x08);
+    _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(r));
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+static inline __m512 load16_bf16_avx512(const uint16_t *p) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p)), 16));
+}
+
+static inline void store16_bf16_avx512(uint16_t *p, __m512 v) {
+    __m512i u = _mm512_castps_si512(v);
+    __m512i odd = _mm512_and_si512(_mm512_srli_epi32(u, 16), _mm512_set1_epi32(1));
+    __m512i r = _mm512_add_epi32(u, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff)));
+    __mmask16 nan = _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q);
+    r = _mm512_mask_blend_epi32(nan, r, _mm512_or_si512(u, _mm512_set1_epi32(0x400000)));
+    _mm256_storeu_si256((__m256i *) p, _mm512_cvtepi32_epi16(_mm512_srli_epi32(r, 16)));
+}
+#pragma GCC pop_options
+
+/*
+ * VCVTNEPS2BF16 does a whole vector in one instruction, but it treats
+ * subnormal inputs as zero. Those are below 1e-38, so the AVX-512 variant
+ * uses it whenever the CPU has it.
+ */
+static int has_avx512bf16;
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bf16")
+static int float_to_bf16_native(const float *src, uint16_t *dst, int n) {
+    if (! has_avx512bf16) {
+        return 0;
+    }
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256bh h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i *) (dst + i), (__m256i) h);
+    }
+    return i;
+}
+#pragma GCC pop_options
+
+/*
+ * One copy of kernels_isa.h per instruction set and element type. Only the
+ * baseline (SSE2 on x86-64) is compiled with the default flags; the others
+ * are compiled under #pragma GCC target, so the build no longer needs -mavx
+ * and the binary runs on any x86-64 host. The double copies keep the
+ * register budget of the float ones: a vector holds half as many elements,
+ * so the GEMM tile is half as wide (6x4 on SSE2, 6x8 on AVX2, 12x16 on
+ * AVX-512).
+ */
+
+#define KERNEL_SUFFIX _sse2
+#define KERNEL_NAME "sse2"
+#define KERNEL_MR 6
+#define KERNEL_TT 4
+#define vtranspose_tile transpose4x4_sse
+#define VLEN 4
+#define vfloat __m128
+#define vload _mm_loadu_ps
+#define vstore _mm_storeu_ps
+#define vzero _mm_setzero_ps
+#define vset1 _mm_set1_ps
+#define vadd _mm_add_ps
+#define vmul _mm_mul_ps
+#define vfmadd(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#define vsub _mm_sub_ps
+#define vdiv _mm_div_ps
+#define vmin _mm_min_ps
+#define vmax _mm_max_ps
+#define vand _mm_and_ps
+#define vor _mm_or_ps
+#define vandnot _mm_andnot_ps
+#define vint __m128i
+#define vint_set1 _mm_set1_epi32
+#define vint_add _mm_add_epi32
+#define vint_sub _mm_sub_epi32
+#define vint_and _mm_and_si128
+#define vint_or _mm_or_si128
+#define vint_slli _mm_slli_epi32
+#define vint_srli _mm_srli_epi32
+#define vint_srai _mm_srai_epi32
+#define vround_int _mm_cvtps_epi32
+#define vint_to_float _mm_cvtepi32_ps
+#define vas_int _mm_castps_si128
+#define vas_float _mm_castsi128_ps
+#define vmask __m128
+#define vcmp_lt _mm_cmplt_ps
+#define vcmp_eq _mm_cmpeq_ps
+#define vcmp_nan(a) _mm_cmpunord_ps(a, a)
+#define vmask_or _mm_or_ps
+#define vblend(m, a, b) _mm_or_ps(_mm_and_ps(m, b), _mm_andnot_ps(m, a))
+#define vload_fp16 load4_fp16_sse2
+#define vstore_fp16 store4_fp16_sse2
+#define vload_bf16 load4_bf16_sse2
+#define vstore_bf16 store4_bf16_sse2
+#include "kernels_isa.h"
+
+#define KERNEL_SUFFIX _sse2_64
+#define KERNEL_NAME "sse2"
+#define KERNEL_REAL double
+#define KERNEL_DOUBLE
+#define KERNEL_MR 6
+#define KERNEL_TT 2
+#define vtranspose_tile transpose2x2_sse2_pd
+#define VLEN 2
+#define vfloat __m128d
+#define vload _mm_loadu_pd
+#define vstore _mm_storeu_pd
+#define vzero _mm_setzero_pd
+#define vset1 _mm_set1_pd
+#define vadd _mm_add_pd
+#define vmul _mm_mul_pd
+#define vfmadd(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#define vsub _mm_sub_pd
+#include "kernels_isa.h"
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#define KERNEL_SUFFIX _avx2
+#define KERNEL_NAME "avx2"
+#define KERNEL_MR 6
+#define KERNEL_TT 8
+#define vtranspose_tile transpose8x8_avx
+#define VLEN 8
+#define vfloat __m256
+#define vload _mm256_loadu_ps
+#define vstore _mm256_storeu_ps
+#define vzero _mm256_setzero_ps
+#define vset1 _mm256_set1_ps
+#define vadd _mm256_add_ps
+#define vmul _mm256_mul_ps
+#define vfmadd _mm256_fmadd_ps
+#define vsub _mm256_sub_ps
+#define vdiv _mm256_div_ps
+#define vmin _mm256_min_ps
+#define vmax _mm256_max_ps
+#define vand _mm256_and_ps
+#define vor _mm256_or_ps
+#define vandnot _mm256_andnot_ps
+#define vint __m256i
+#define vint_set1 _mm256_set1_epi32
+#define vint_add _mm256_add_epi32
+#define vint_sub _mm256_sub_epi32
+#define vint_and _mm256_and_si256
+#define vint_or _mm256_or_si256
+#define vint_slli _mm256_slli_epi32
+#define vint_srli _mm256_srli_epi32
+#define vint_srai _mm256_srai_epi32
+#define vround_int _mm256_cvtps_epi32
+#define vint_to_float _mm256_cvtepi32_ps
+#define vas_int _mm256_castps_si256
+#define vas_float _mm256_castsi256_ps
+#define vmask __m256
+#define vcmp_lt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vcmp_eq(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define vcmp_nan(a) _mm256_cmp_ps(a, a, _CMP_UNORD_Q)
+#define vmask_or _mm256_or_ps
+#define vblend(m, a, b) _mm256_blendv_ps(a, b, m)
+#define vload_fp16(p) _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) (p)))
+#define vstore_fp16(p, v) _mm_storeu_si128((__m128i *) (p), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT))
+#define vload_bf16 load8_bf16_avx2
+#define vstore_bf16 store8_bf16_avx2
+#include "kernels_isa.h"
+
+#define KERNEL_SUFFIX _avx2_64
+#define KERNEL_NAME "avx2"
+#define KERNEL_REAL double
+#define KERNEL_DOUBLE
+#define KERNEL_MR 6
+#define KERNEL_TT 4
+#define vtranspose_tile transpose4x4_avx_pd
+#define VLEN 4
+#define vfloat __m256d
+#define vload _mm256_loadu_pd
+#define vstore _mm256_storeu_pd
+#define vzero _mm256_setzero_pd
+#define vset1 _mm256_set1_pd
+#define vadd _mm256_add_pd
+#define vmul _mm256_mul_pd
+#define vfmadd _mm256_fmadd_pd
+#define vsub _mm256_sub_pd
+#include "kernels_isa.h"
+#pragma GCC pop_options
+
+// 32 zmm registers leave room for a 12 x 32 tile (24 accumulators)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define KERNEL_SUFFIX _avx512
+#define KERNEL_NAME "avx512"
+#define KERNEL_MR 12
+#define KERNEL_TT 8
+#define vtranspose_tile transpose8x8_avx
+#define VLEN 16
+#define vfloat __m512
+#define vload _mm512_loadu_ps
+#define vstore _mm512_storeu_ps
+#define vzero _mm512_setzero_ps
+#define vset1 _mm512_set1_ps
+#define vadd _mm512_add_ps
+#define vmul _mm512_mul_ps
+#define vfmadd _mm512_fmadd_ps
+#define vsub _mm512_sub_ps
+#define vdiv _mm512_div_ps
+#define vmin _mm512_min_ps
+#define vmax _mm512_max_ps
+// Float bitwise ops are AVX512DQ; go through the integer forms instead
+#define vand(a, b) _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)))
+#define vor(a, b) _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)))
+#define vandnot(a, b) _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)))
+#define vint __m512i
+#define vint_set1 _mm512_set1_epi32
+#define vint_add _mm512_add_epi32
+#define vint_sub _mm512_sub_epi32
+#define vint_and _mm512_and_si512
+#define vint_or _mm512_or_si512
+#define vint_slli _mm512_slli_epi32
+#define vint_srli _mm512_srli_epi32
+#define vint_srai _mm512_srai_epi32
+#define vround_int _mm512_cvtps_epi32
+#define vint_to_float _mm512_cvtepi32_ps
+#define vas_int _mm512_castps_si512
+#define vas_float _mm512_castsi512_ps
+#define vmask __mmask16
+#define vcmp_lt(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define vcmp_eq(a, b) _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ)
+#define vcmp_nan(a) _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q)
+#define vmask_or(a, b) ((a) | (b))
+#define vblend(m, a, b) _mm512_mask_blend_ps(m, a, b)
+#define vload_fp16(p) _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) (p)))
+#define vstore_fp16(p, v) _mm256_storeu_si256((__m256i *) (p), _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC))
+#define vload_bf16 load16_bf16_avx512
+#define vstore_bf16 store16_bf16_avx512
+#define KERNEL_FLOAT_TO_BF16_FAST float_to_bf16_native
+#include "kernels_isa.h"
+
+#define KERNEL_SUFFIX _avx512_64
+#define KERNEL_NAME "avx512"
+#define KERNEL_REAL double
+#define KERNEL_DOUBLE
+#define KERNEL_MR 12
+#define KERNEL_TT 4
+#define vtranspose_tile transpose4x4_avx_pd
+#define VLEN 8
+#define vfloat __m512d
+#define vload _mm512_loadu_pd
+#define vstore _mm512_storeu_pd
+#define vzero _mm512_setzero_pd
+#define vset1 _mm512_set1_pd
+#define vadd _mm512_add_pd
+#define vmul _mm512_mul_pd
+#define vfmadd _mm512_fmadd_pd
+#define vsub _mm512_sub_pd
+#include "kernels_isa.h"
+#pragma GCC pop_options
+
+const matrix_kernels *kernels = &kernels_sse2;
+const matrix_kernels64 *kernels64 = &kernels_sse2_64;
+
+// Both tables of the named variant; -1 if the name is unknown or the CPU cannot run it
+static int kernel_variant(const char *name, const matrix_kernels **k, const matrix_kernels64 **k64) {
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f")) {
+        *k = &kernels_avx512;
+        *k64 = &kernels_avx512_64;
+        return 0;
+    }
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+        && __builtin_cpu_supports("f16c")) {
+        *k = &kernels_avx2;
+        *k64 = &kernels_avx2_64;
+        return 0;
+    }
+    if (strcmp(name, "sse2") == 0) {
+        *k = &kernels_sse2;
+        *k64 = &kernels_sse2_64;
+        return 0;
+    }
+    return -1;
+}
+
+int select_kernels(const char *name) {
+    const matrix_kernels *k;
+    const matrix_kernels64 *k64;
+    if (kernel_variant(name, &k, &k64) != 0) {
+        return -1;
+    }
+    kernels = k;
+    kernels64 = k64;
+    return 0;
+}
+
+// Runs when the library is loaded: the best variant the CPU supports, unless overridden
+__attribute__((constructor))
+static void init_kernels(void) {
+    __builtin_cpu_init();
+    has_avx512bf16 = __builtin_cpu_supports("avx512bf16");
+    const char *forced = getenv("MATRIX_KERNELS");
+    if (forced != NULL && select_kernels(forced) == 0) {
+        return;
+    }
+    if (select_kernels("avx512") != 0 && select_kernels("avx2") != 0) {
+        select_kernels("sse2");
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "matrix.h"
+
+/*
+ * Leaf loops behind the matrix operations. kernels.c compiles them once per
+ * instruction set and element type and picks the best ISA the CPU supports
+ * when the library is loaded. They only ever see flat runs of elements (or a
+ * row stride); matrix.c deals with shapes, padding and threading.
+ *
+ * The kernels every element type has; real is float or double.
+ */
+#define MATRIX_KERNELS_GENERIC(real) \
+    const char *name; \
+    /* GEMM register tile: the micro-kernel computes gemm_mr x gemm_nr of C */ \
+    int gemm_mr; \
+    int gemm_nr; \
+    void (*gemm_micro)(int kc, const real *a, const real *b, real *c, int ldc, int accumulate); \
+    void (*add)(const real *a, const real *b, real *dst, int n); \
+    void (*sub)(const real *a, const real *b, real *dst, int n); \
+    void (*mul)(const real *a, const real *b, real *dst, int n); \
+    void (*scale)(const real *a, real scalar, real *dst, int n); \
+    void (*axpy)(real alpha, const real *x, real *y, int n);    /* y += alpha * x */ \
+    real (*dot)(const real *a, const real *b, int n); \
+    void (*transpose)(const real *src, int lds, real *dst, int ldd, int rows, int cols);
+
+typedef struct matrix_kernels {
+    MATRIX_KERNELS_GENERIC(float)
+
+    // Vectorized math library, indexed by math_func
+    void (*math[MATH_FUNC_COUNT])(const float *src, float *dst, int n);
+    void (*pow)(const float *src, float exponent, float *dst, int n);
+
+    // 16-bit storage (matrix16): widening is exact, narrowing rounds to nearest even
+    void (*fp16_to_float)(const uint16_t *src, float *dst, int n);
+    void (*float_to_fp16)(const float *src, uint16_t *dst, int n);
+    void (*bf16_to_float)(const uint16_t *src, float *dst, int n);
+    void (*float_to_bf16)(const float *src, uint16_t *dst, int n);
+} matrix_kernels;
+
+typedef struct matrix_kernels64 {
+    MATRIX_KERNELS_GENERIC(double)
+} matrix_kernels64;
+
+// Largest gemm_mr * gemm_nr over all variants, for scratch tiles
+#define KERNELS_MAX_TILE (12 * 32)
+
+// The variant in use for each element type; set before main() runs
+extern const matrix_kernels *kernels;
+extern const matrix_kernels64 *kernels64;
+
+/*
+ * Switches to the named variant ("sse2", "avx2", "avx512").
+ * Returns -1 if the name is unknown or the CPU cannot run it.
+ * The MATRIX_KERNELS environment variable does the same at load time.
+ */
+int select_kernels(const char *name);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ * Kernel bodies shared by every instruction set and element type. kernels.c
+ * includes this file once per ISA and type after defining:
+ *   KERNEL_SUFFIX  appended to every function name (_sse2, _avx2_64, ...)
+ *   KERNEL_REAL    the element type (float when left undefined); for double also
+ *                  KERNEL_DOUBLE, which leaves out everything below the
+ *                  transpose (the math library and 16-bit conversions are
+ *                  float algorithms) and builds a matrix_kernels64 table
+ *   KERNEL_MR      rows in the GEMM register tile; the tile is 2 vectors wide
+ *   VLEN, vfloat   lanes per vector and the vector type (of KERNEL_REAL)
+ *   vload, vstore, vzero, vset1, vadd, vsub, vmul, vfmadd(a, b, c) = a * b + c
+ *   KERNEL_TT and vtranspose_tile(src, lds, dst, ldd), an in-register
+ *   transpose of a KERNEL_TT x KERNEL_TT tile
+ * and for float also
+ *   vdiv, vmin, vmax, the bitwise vand / vor / vandnot,
+ *   vint and its vint_* ops, vround_int / vint_to_float conversions,
+ *   vas_int / vas_float bit casts, and vmask with vcmp_lt / vcmp_eq /
+ *   vcmp_nan, vmask_or and vblend(m, a, b) = m ? b : a
+ *   vload_fp16 / vstore_fp16 and vload_bf16 / vstore_bf16, converting VLEN
+ *   16-bit values to and from a vector (rounding to nearest even); and
+ *   optionally KERNEL_FLOAT_TO_BF16_FAST(src, dst, n), which converts a
+ *   prefix of the run with a native instruction and returns its length
+ * Everything is #undef'd again at the bottom.
+ */
+
+#define KERNEL_CAT_(name, suffix) name##suffix
+#define KERNEL_CAT(name, suffix) KERNEL_CAT_(name, suffix)
+#define KNAME(name) KERNEL_CAT(name, KERNEL_SUFFIX)
+#define KERNEL_NR (2 * VLEN)
+#ifndef KERNEL_REAL
+#define KERNEL_REAL float
+#endif
+
+/*
+ * c (KERNEL_MR x KERNEL_NR, row stride ldc) = a * b, or c += a * b when
+ * accumulate is set. a and b are packed slivers (see gemm_pack_a/_b in
+ * matrix.c). C is loaded into the accumulators rather than added afterwards
+ * so every element is summed in plain k order.
+ */
+static void KNAME(gemm_micro)(int kc, const KERNEL_REAL *a, const KERNEL_REAL *b, KERNEL_REAL *c, int ldc, int accumulate) {
+    vfloat acc[KERNEL_MR][2];
+    for (int r = 0; r < KERNEL_MR; r++) {
+        if (accumulate) {
+            acc[r][0] = vload(c + r * ldc);
+            acc[r][1] = vload(c + r * ldc + VLEN);
+        } else {
+            acc[r][0] = vzero();
+            acc[r][1] = vzero();
+        }
+    }
+    for (int p = 0; p < kc; p++) {
+        vfloat b0 = vload(b);
+        vfloat b1 = vload(b + VLEN);
+        for (int r = 0; r < KERNEL_MR; r++) {
+            vfloat ar = vset1(a[r]);
+            acc[r][0] = vfmadd(ar, b0, acc[r][0]);
+            acc[r][1] = vfmadd(ar, b1, acc[r][1]);
+        }
+        a += KERNEL_MR;
+        b += KERNEL_NR;
+    }
+    for (int r = 0; r < KERNEL_MR; r++) {
+        vstore(c + r * ldc, acc[r][0]);
+        vstore(c + r * ldc + VLEN, acc[r][1]);
+    }
+}
+
+static void KNAME(add)(const KERNEL_REAL *a, const KERNEL_REAL *b, KERNEL_REAL *dst, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(dst + i, vadd(vload(a + i), vload(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+static void KNAME(sub)(const KERNEL_REAL *a, const KERNEL_REAL *b, KERNEL_REAL *dst, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(dst + i, vsub(vload(a + i), vload(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] - b[i];
+    }
+}
+
+static void KNAME(mul)(const KERNEL_REAL *a, const KERNEL_REAL *b, KERNEL_REAL *dst, int n) {
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(dst + i, vmul(vload(a + i), vload(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] * b[i];
+    }
+}
+
+static void KNAME(scale)(const KERNEL_REAL *a, KERNEL_REAL scalar, KERNEL_REAL *dst, int n) {
+    vfloat s = vset1(scalar);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(dst + i, vmul(s, vload(a + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = scalar * a[i];
+    }
+}
+
+static void KNAME(axpy)(KERNEL_REAL alpha, const KERNEL_REAL *x, KERNEL_REAL *y, int n) {
+    vfloat a = vset1(alpha);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(y + i, vfmadd(a, vload(x + i), vload(y + i)));
+    }
+    for (; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+// Two vector accumulators to hide the add latency, folded lane by lane at the end
+static KERNEL_REAL KNAME(dot)(const KERNEL_REAL *a, const KERNEL_REAL *b, int n) {
+    vfloat acc0 = vzero(), acc1 = vzero();
+    int i = 0;
+    for (; i + 2 * VLEN <= n; i += 2 * VLEN) {
+        acc0 = vfmadd(vload(a + i), vload(b + i), acc0);
+        acc1 = vfmadd(vload(a + i + VLEN), vload(b + i + VLEN), acc1);
+    }
+    KERNEL_REAL lanes[VLEN];
+    vstore(lanes, vadd(acc0, acc1));
+    KERNEL_REAL sum = 0;
+    for (int l = 0; l < VLEN; l++) {
+        sum += lanes[l];
+    }
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+/*
+ * dst (cols x rows) = src (rows x cols) transposed, for blocks small enough to
+ * stay in cache (matrix_transpose does the blocking). Full tiles are
+ * transposed in registers; the ragged right and bottom edges element by
+ * element.
+ */
+static void KNAME(transpose)(const KERNEL_REAL *src, int lds, KERNEL_REAL *dst, int ldd, int rows, int cols) {
+    int i = 0;
+    for (; i + KERNEL_TT <= rows; i += KERNEL_TT) {
+        int j = 0;
+        for (; j + KERNEL_TT <= cols; j += KERNEL_TT) {
+            vtranspose_tile(src + (size_t) i * lds + j, lds, dst + (size_t) j * ldd + i, ldd);
+        }
+        for (; j < cols; j++) {
+            for (int r = i; r < i + KERNEL_TT; r++) {
+                dst[(size_t) j * ldd + r] = src[(size_t) r * lds + j];
+            }
+        }
+    }
+    for (; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            dst[(size_t) j * ldd + i] = src[(size_t) i * lds + j];
+        }
+    }
+}
+
+#ifndef KERNEL_DOUBLE
+/*
+ * Vectorized math library. exp and log are the Cephes single precision
+ * range reductions and polynomials (within 2 ULP over the normal range);
+ * tanh, sigmoid and pow are built on them. Special values follow C99:
+ * overflow gives inf, log of a negative number NaN, NaN propagates.
+ */
+static inline vfloat KNAME(exp_vec)(vfloat x) {
+    vmask overflow = vcmp_lt(vset1(88.7228394f), x);
+    vmask nan = vcmp_nan(x);
+    // Below -104 the result rounds to zero anyway
+    vfloat xc = vmin(vmax(x, vset1(-104.0f)), vset1(88.7228394f));
+    vint n = vround_int(vmul(xc, vset1(1.44269504088896341f)));
+    vfloat fn = vint_to_float(n);
+    // r = x - n ln2, with ln2 split so n * 0.693359375 is exact
+    vfloat r = vfmadd(fn, vset1(-0.693359375f), xc);
+    r = vfmadd(fn, vset1(2.12194440e-4f), r);
+    vfloat y = vset1(1.9875691500E-4f);
+    y = vfmadd(y, r, vset1(1.3981999507E-3f));
+    y = vfmadd(y, r, vset1(8.3334519073E-3f));
+    y = vfmadd(y, r, vset1(4.1665795894E-2f));
+    y = vfmadd(y, r, vset1(1.6666665459E-1f));
+    y = vfmadd(y, r, vset1(5.0000001201E-1f));
+    y = vadd(vfmadd(y, vmul(r, r), r), vset1(1.0f));
+    // y * 2^n applied in two halves, so n in [-150, 128] never leaves the exponent range
+    vint half = vint_srai(n, 1);
+    vfloat scale_lo = vas_float(vint_slli(vint_add(half, vint_set1(127)), 23));
+    vfloat scale_hi = vas_float(vint_slli(vint_add(vint_sub(n, half), vint_set1(127)), 23));
+    y = vmul(vmul(y, scale_lo), scale_hi);
+    y = vblend(overflow, y, vset1(INFINITY));
+    return vblend(nan, y, x);
+}
+
+static inline vfloat KNAME(log_vec)(vfloat x) {
+    // Subnormals are scaled into the normal range first
+    vmask tiny = vcmp_lt(x, vset1(FLT_MIN));
+    vfloat xs = vblend(tiny, x, vmul(x, vset1(8388608.0f)));
+    vint bits = vas_int(xs);
+    vfloat e = vint_to_float(vint_sub(vint_srli(bits, 23), vint_set1(126)));
+    e = vadd(e, vblend(tiny, vzero(), vset1(-23.0f)));
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then m - 1
+    vfloat m = vas_float(vint_or(vint_and(bits, vint_set1(0x007fffff)), vint_set1(0x3f000000)));
+    vmask low = vcmp_lt(m, vset1(0.707106781186547524f));
+    e = vsub(e, vblend(low, vzero(), vset1(1.0f)));
+    m = vsub(vadd(m, vblend(low, vzero(), m)), vset1(1.0f));
+    vfloat z = vmul(m, m);
+    vfloat y = vset1(7.0376836292E-2f);
+    y = vfmadd(y, m, vset1(-1.1514610310E-1f));
+    y = vfmadd(y, m, vset1(1.1676998740E-1f));
+    y = vfmadd(y, m, vset1(-1.2420140846E-1f));
+    y = vfmadd(y, m, vset1(1.4249322787E-1f));
+    y = vfmadd(y, m, vset1(-1.6668057665E-1f));
+    y = vfmadd(y, m, vset1(2.0000714765E-1f));
+    y = vfmadd(y, m, vset1(-2.4999993993E-1f));
+    y = vfmadd(y, m, vset1(3.3333331174E-1f));
+    y = vmul(vmul(y, m), z);
+    y = vfmadd(e, vset1(-2.12194440e-4f), y);
+    y = vfmadd(z, vset1(-0.5f), y);
+    vfloat r = vfmadd(e, vset1(0.693359375f), vadd(m, y));
+    r = vblend(vcmp_eq(x, vzero()), r, vset1(-INFINITY));
+    r = vblend(vmask_or(vcmp_lt(x, vzero()), vcmp_nan(x)), r, vset1(NAN));
+    return vblend(vcmp_eq(x, vset1(INFINITY)), r, x);
+}
+
+static inline vfloat KNAME(tanh_vec)(vfloat x) {
+    vfloat sign = vset1(-0.0f);
+    vfloat ax = vandnot(sign, x);
+    // |x| < 0.625: odd polynomial
+    vfloat z = vmul(x, x);
+    vfloat p = vset1(-5.70498872745E-3f);
+    p = vfmadd(p, z, vset1(2.06390887954E-2f));
+    p = vfmadd(p, z, vset1(-5.37397155531E-2f));
+    p = vfmadd(p, z, vset1(1.33314422036E-1f));
+    p = vfmadd(p, z, vset1(-3.33332819422E-1f));
+    vfloat near_zero = vfmadd(vmul(p, z), x, x);
+    // otherwise 1 - 2 / (e^2|x| + 1) with the sign of x
+    vfloat e = KNAME(exp_vec)(vadd(ax, ax));
+    vfloat far = vsub(vset1(1.0f), vdiv(vset1(2.0f), vadd(e, vset1(1.0f))));
+    far = vor(far, vand(x, sign));
+    return vblend(vcmp_lt(ax, vset1(0.625f)), far, near_zero);
+}
+
+// With e = exp(-|x|): 1 / (1 + e) for x >= 0 and e / (1 + e) below, so e never overflows
+static inline vfloat KNAME(sigmoid_vec)(vfloat x) {
+    vfloat e = KNAME(exp_vec)(vor(x, vset1(-0.0f)));
+    vfloat num = vblend(vcmp_lt(x, vzero()), vset1(1.0f), e);
+    return vdiv(num, vadd(vset1(1.0f), e));
+}
+
+static inline vfloat KNAME(relu_vec)(vfloat x) {
+    return vmax(x, vzero());
+}
+
+static inline vfloat KNAME(abs_vec)(vfloat x) {
+    return vandnot(vset1(-0.0f), x);
+}
+
+/* Full vectors straight through, the ragged tail through a zero padded vector */
+#define KERNEL_MATH_LOOP(name, vec_fn) \
+    static void KNAME(name)(const float *src, float *dst, int n) { \
+        int i = 0; \
+        for (; i + VLEN <= n; i += VLEN) { \
+            vstore(dst + i, vec_fn(vload(src + i))); \
+        } \
+        if (i < n) { \
+            float tail[VLEN] = {0}; \
+            memcpy(tail, src + i, (n - i) * sizeof(float)); \
+            vstore(tail, vec_fn(vload(tail))); \
+            memcpy(dst + i, tail, (n - i) * sizeof(float)); \
+        } \
+    }
+
+KERNEL_MATH_LOOP(math_exp, KNAME(exp_vec))
+KERNEL_MATH_LOOP(math_log, KNAME(log_vec))
+KERNEL_MATH_LOOP(math_tanh, KNAME(tanh_vec))
+KERNEL_MATH_LOOP(math_sigmoid, KNAME(sigmoid_vec))
+KERNEL_MATH_LOOP(math_relu, KNAME(relu_vec))
+KERNEL_MATH_LOOP(math_abs, KNAME(abs_vec))
+
+/*
+ * x^p for one exponent. Small integral exponents use repeated squaring
+ * (error grows by about half an ULP per multiply, so at most ~8 ULP);
+ * anything else is exp(p log|x|), whose error grows with |p log x| by one to
+ * two ULP per unit. Negative x only has a real result for integral p.
+ */
+#define KERNEL_POW_SQUARING_MAX 16
+
+static inline vfloat KNAME(pow_vec)(vfloat x, float p, int squarings, int integral, int odd) {
+    if (squarings) {
+        int e = (int) p;
+        unsigned int bits = e < 0 ? -e : e;
+        vfloat result = vset1(1.0f), base = x;
+        while (bits) {
+            if (bits & 1) {
+                result = vmul(result, base);
+            }
+            bits >>= 1;
+            if (bits) {
+                base = vmul(base, base);
+            }
+        }
+        return e < 0 ? vdiv(vset1(1.0f), result) : result;
+    }
+    vfloat sign = vset1(-0.0f);
+    vfloat r = KNAME(exp_vec)(vmul(vset1(p), KNAME(log_vec)(vandnot(sign, x))));
+    if (!integral) {
+        return vblend(vcmp_lt(x, vzero()), r, vset1(NAN));
+    }
+    return odd ? vor(r, vand(x, sign)) : r;
+}
+
+static void KNAME(math_pow)(const float *src, float p, float *dst, int n) {
+    int integral = p == floorf(p);
+    int squarings = integral && fabsf(p) <= KERNEL_POW_SQUARING_MAX;
+    // Every float of magnitude 2^24 or more is an even integer
+    int odd = integral && fabsf(p) < 16777216.0f && ((int) p & 1);
+    int i = 0;
+    for (; i + VLEN <= n; i += VLEN) {
+        vstore(dst + i, KNAME(pow_vec)(vload(src + i), p, squarings, integral, odd));
+    }
+    if (i < n) {
+        float tail[VLEN] = {0};
+        memcpy(tail, src + i, (n - i) * sizeof(float));
+        vstore(tail, KNAME(pow_vec)(vload(tail), p, squarings, integral, odd));
+        memcpy(dst + i, tail, (n - i) * sizeof(float));
+    }
+}
+
+/*
+ * Runs of 16-bit storage (matrix16 in matrix.h) widened to float or rounded from it;
+ * the ragged tail goes through a zero padded vector like the math kernels.
+ */
+#define KERNEL_CONVERSIONS(fmt) \
+static void KNAME(fmt##_to_float)(const uint16_t *src, float *dst, int n) { \
+    int i = 0; \
+    for (; i + VLEN <= n; i += VLEN) { \
+        vstore(dst + i, vload_##fmt(src + i)); \
+    } \
+    if (i < n) { \
+        uint16_t tail[VLEN] = {0}; \
+        float out[VLEN]; \
+        memcpy(tail, src + i, (n - i) * sizeof(uint16_t)); \
+        vstore(out, vload_##fmt(tail)); \
+        memcpy(dst + i, out, (n - i) * sizeof(float)); \
+    } \
+} \
+\
+static void KNAME(float_to_##fmt)(const float *src, uint16_t *dst, int n) { \
+    int i = KERNEL_CONVERT_FAST_##fmt(src, dst, n); \
+    for (; i + VLEN <= n; i += VLEN) { \
+        vstore_##fmt(dst + i, vload(src + i)); \
+    } \
+    if (i < n) { \
+        float tail[VLEN] = {0}; \
+        uint16_t out[VLEN]; \
+        memcpy(tail, src + i, (n - i) * sizeof(float)); \
+        vstore_##fmt(out, vload(tail)); \
+        memcpy(dst + i, out, (n - i) * sizeof(uint16_t)); \
+    } \
+}
+
+#define KERNEL_CONVERT_FAST_fp16(src, dst, n) 0
+#ifdef KERNEL_FLOAT_TO_BF16_FAST
+#define KERNEL_CONVERT_FAST_bf16 KERNEL_FLOAT_TO_BF16_FAST
+#else
+#define KERNEL_CONVERT_FAST_bf16(src, dst, n) 0
+#endif
+
+KERNEL_CONVERSIONS(fp16)
+KERNEL_CONVERSIONS(bf16)
+
+#endif
+
+#define KERNEL_GENERIC_ENTRIES \
+    .name = KERNEL_NAME, \
+    .gemm_mr = KERNEL_MR, \
+    .gemm_nr = KERNEL_NR, \
+    .gemm_micro = KNAME(gemm_micro), \
+    .add = KNAME(add), \
+    .sub = KNAME(sub), \
+    .mul = KNAME(mul), \
+    .scale = KNAME(scale), \
+    .axpy = KNAME(axpy), \
+    .dot = KNAME(dot), \
+    .transpose = KNAME(transpose)
+
+#ifdef KERNEL_DOUBLE
+static const matrix_kernels64 KNAME(kernels) = {
+    KERNEL_GENERIC_ENTRIES,
+};
+#else
+static const matrix_kernels KNAME(kernels) = {
+    KERNEL_GENERIC_ENTRIES,
+    .math = {
+        [MATH_EXP] = KNAME(math_exp),
+        [MATH_LOG] = KNAME(math_log),
+        [MATH_TANH] = KNAME(math_tanh),
+        [MATH_SIGMOID] = KNAME(math_sigmoid),
+        [MATH_RELU] = KNAME(math_relu),
+        [MATH_ABS] = KNAME(math_abs),
+    },
+    .pow = KNAME(math_pow),
+    .fp16_to_float = KNAME(fp16_to_float),
+    .float_to_fp16 = KNAME(float_to_fp16),
+    .bf16_to_float = KNAME(bf16_to_float),
+    .float_to_bf16 = KNAME(float_to_bf16),
+};
+#endif
+
+#undef KERNEL_GENERIC_ENTRIES
+
+#undef KERNEL_CONVERSIONS
+#undef KERNEL_CONVERT_FAST_fp16
+#undef KERNEL_CONVERT_FAST_bf16
+#undef KERNEL_FLOAT_TO_BF16_FAST
+
+#undef KERNEL_MATH_LOOP
+#undef KERNEL_POW_SQUARING_MAX
+#undef KERNEL_CAT_
+#undef KERNEL_CAT
+#undef KNAME
+#undef KERNEL_NR
+#undef KERNEL_SUFFIX
+#undef KERNEL_REAL
+#undef KERNEL_DOUBLE
+#undef KERNEL_NAME
+#undef KERNEL_MR
+#undef KERNEL_TT
+#undef vtranspose_tile
+#undef VLEN
+#undef vfloat
+#undef vload
+#undef vstore
+#undef vzero
+#undef vset1
+#undef vadd
+#undef vmul
+#undef vfmadd
+#undef vsub
+#undef vdiv
+#undef vmin
+#undef vmax
+#undef vand
+#undef vor
+#undef vandnot
+#undef vint
+#undef vint_set1
+#undef vint_add
+#undef vint_sub
+#undef vint_and
+#undef vint_or
+#undef vint_slli
+#undef vint_srli
+#undef vint_srai
+#undef vround_int
+#undef vint_to_float
+#undef vas_int
+#undef vas_float
+#undef vmask
+#undef vcmp_lt
+#undef vcmp_eq
+#undef vcmp_nan
+#undef vmask_or
+#undef vblend
+#undef vload_fp16
+#undef vstore_fp16
+#undef vload_bf16
+#undef vstore_bf16
@@ -1,5 +1,411 @@
 #include "matrix.h"
+#include "matfile.h"
 #include "../testing/shared.c"
+#include <math.h>
+
+// The fixtures are mapped straight into matrix storage instead of parsed, and read as they are used
+matrix **map_matrices_from_file(const char *filename) {
+	matfile_map *map;
+	int err = matfile_open_map(filename, 0, &map);
+	if (err != MATFILE_OK) {
+		printf("%s: %s\n", filename, matfile_strerror(err));
+		exit(1);
+	}
+	return map->mats;
+}
+
+/*
+ * Checks of the operations the fixtures do not exercise, each against a
+ * naive loop over the same inputs. They run before the timed part.
+ */
+matrix* random_matrix(int r, int c) {
+	matrix *m;
+	allocate_matrix(&m, r, c);
+	for (int i = 0; i < r; i++) {
+		for (int j = 0; j < c; j++) {
+			set_loc(m, i, j, (float)drand48() * 2 - 1);
+		}
+	}
+	return m;
+}
+
+// Stops the run when cond is false; unlike assert it never compiles out
+#define EXPECT(cond) \
+	((cond) ? (void) 0 : (printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond), exit(1)))
+
+// Stops the run when got is further than tol from want, relative to |want| + 1
+void check_close(const char *what, double got, double want, double tol) {
+	if (fabs(got - want) > tol * (fabs(want) + 1)) {
+		printf("%s: got %.9g, expected %.9g\n", what, got, want);
+		exit(1);
+	}
+}
+
+void check_batch_ops() {
+	int count = 5, m = 7, k = 9, n = 6;
+	float scalars[5] = {2, -1, 0, 0.5, 3};
+	matrix *a = random_matrix(count * m, k), *per_block = random_matrix(count * k, n), *shared = random_matrix(k, n);
+	matrix *dst;
+	allocate_matrix(&dst, count * m, n);
+	// b is a block per matrix of the batch, or one block they all share
+	for (int s = 0; s < 2; s++) {
+		matrix *b = s == 0 ? per_block : shared;
+		matrix_batch_multiply(a, b, count, dst);
+		for (int i = 0; i < count * m; i++) {
+			for (int j = 0; j < n; j++) {
+				double want = 0;
+				for (int p = 0; p < k; p++) {
+					want += (double) get_loc(a, i, p) * get_loc(b, (s == 0 ? i / m * k : 0) + p, j);
+				}
+				check_close("batch_multiply", get_loc(dst, i, j), want, 1e-5);
+			}
+		}
+	}
+	free_matrix(dst);
+
+	matrix *whole = random_matrix(count * m, k), *block = random_matrix(m, k);
+	allocate_matrix(&dst, count * m, k);
+	for (int s = 0; s < 2; s++) {
+		matrix *b = s == 0 ? whole : block;
+		matrix_batch_add(a, b, count, dst);
+		for (int i = 0; i < count * m; i++) {
+			for (int j = 0; j < k; j++) {
+				check_close("batch_add", get_loc(dst, i, j), get_loc(a, i, j) + get_loc(b, s == 0 ? i : i % m, j), 0);
+			}
+		}
+	}
+	matrix_batch_scale(a, scalars, count, dst);
+	for (int i = 0; i < count * m; i++) {
+		for (int j = 0; j < k; j++) {
+			check_close("batch_scale", get_loc(dst, i, j), get_loc(a, i, j) * scalars[i / m], 0);
+		}
+	}
+	free_matrix(dst);
+	free_matrix(a);
+	free_matrix(per_block);
+	free_matrix(shared);
+	free_matrix(whole);
+	free_matrix(block);
+}
+
+void check_same(const char *what, matrix *got, matrix *want) {
+	EXPECT(same_size(got, want));
+	for (int i = 0; i < want->dim.rows; i++) {
+		for (int j = 0; j < want->dim.cols; j++) {
+			check_close(what, get_loc(got, i, j), get_loc(want, i, j), 0);
+		}
+	}
+}
+
+// Copies the file at src to dst with the byte at offset flipped, and cut to size bytes
+void write_damaged(const char *src, const char *dst, size_t offset, size_t size) {
+	FILE *f = fopen(src, "rb");
+	char *data = malloc(size);
+	EXPECT(f != NULL && data != NULL && fread(data, 1, size, f) == size);
+	fclose(f);
+	if (offset < size) {
+		data[offset] ^= 1;
+	}
+	f = fopen(dst, "wb");
+	EXPECT(f != NULL && fwrite(data, 1, size, f) == size);
+	fclose(f);
+	free(data);
+}
+
+void check_matfile() {
+	const char *path = "./tmp/check_matfile.m61", *damaged = "./tmp/check_matfile_damaged.m61";
+	// Padded rows (31 of 32 floats), a single element, and every other row of a matrix
+	matrix *big = random_matrix(80, 16), *mats[3];
+	mats[0] = random_matrix(17, 31);
+	mats[1] = random_matrix(1, 1);
+	view_matrix(&mats[2], big, 1, 0, 40, 16, 2);
+	EXPECT(matfile_write(path, mats, 3) == MATFILE_OK);
+
+	matrix **read;
+	int count;
+	EXPECT(matfile_read(path, &read, &count) == MATFILE_OK && count == 3);
+	for (int i = 0; i < 3; i++) {
+		check_same("matfile_read", read[i], mats[i]);
+		free_matrix(read[i]);
+	}
+	free(read);
+	for (int verify = 0; verify < 2; verify++) {
+		matfile_map *map;
+		EXPECT(matfile_open_map(path, verify, &map) == MATFILE_OK && map->count == 3);
+		for (int i = 0; i < 3; i++) {
+			check_same("matfile_open_map", map->mats[i], mats[i]);
+		}
+		matfile_unmap(map);
+	}
+
+	// Where the data and the padding of the first matrix are
+	FILE *f = fopen(path, "rb");
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *image = malloc(size);
+	EXPECT(fread(image, 1, size, f) == size);
+	fclose(f);
+	const matfile_entry *entries;
+	EXPECT(matfile_index(image, size, 1, &entries, &count) == MATFILE_OK);
+	EXPECT(entries[0].stride > entries[0].cols);
+	size_t data = entries[0].offset, padding = data + entries[0].cols * sizeof(float);
+	free(image);
+
+	// Damaged data or padding fails every reader that checks the data; a mapping without verify reads neither
+	matfile_map *map;
+	for (int p = 0; p < 2; p++) {
+		write_damaged(path, damaged, p == 0 ? data : padding, size);
+		EXPECT(matfile_read(damaged, &read, &count) == MATFILE_ECHECKSUM);
+		EXPECT(matfile_open_map(damaged, 1, &map) == MATFILE_ECHECKSUM);
+		EXPECT(matfile_open_map(damaged, 0, &map) == MATFILE_OK);
+		matfile_unmap(map);
+	}
+	// A damaged entry table fails every reader, and so does a truncated file
+	write_damaged(path, damaged, sizeof(matfile_header), size);
+	EXPECT(matfile_read(damaged, &read, &count) == MATFILE_ECHECKSUM);
+	EXPECT(matfile_open_map(damaged, 0, &map) == MATFILE_ECHECKSUM);
+	write_damaged(path, damaged, size, 16);
+	EXPECT(matfile_read(damaged, &read, &count) == MATFILE_EFORMAT);
+	EXPECT(matfile_open_map(damaged, 0, &map) == MATFILE_EFORMAT);
+	write_damaged(path, damaged, size, size - 4);
+	EXPECT(matfile_read(damaged, &read, &count) == MATFILE_EFORMAT);
+	EXPECT(matfile_open_map(damaged, 0, &map) == MATFILE_EFORMAT);
+	remove(path);
+	remove(damaged);
+	for (int i = 0; i < 3; i++) {
+		free_matrix(mats[i]);
+	}
+	free_matrix(big);
+}
+
+void check_half() {
+	// Rounding to nearest even, ties included, and the largest and smallest fp16 values
+	float in[8] = {1, 1 + 0x1p-11f, 1 + 3 * 0x1p-11f, 1 + 0x1p-8f, 1 + 3 * 0x1p-8f, -2.5f, 65504, 0x1p-24f};
+	uint16_t want[HALF_FORMAT_COUNT][8] = {
+		{0x3C00, 0x3C00, 0x3C02, 0x3C04, 0x3C0C, 0xC100, 0x7BFF, 0x0001},
+		{0x3F80, 0x3F80, 0x3F80, 0x3F80, 0x3F82, 0xC020, 0x4780, 0x3380},
+	};
+	matrix *row = arr_to_matrix(in, 1, 8), *back;
+	allocate_matrix(&back, 1, 8);
+	for (int format = 0; format < HALF_FORMAT_COUNT; format++) {
+		matrix16 *h;
+		allocate_matrix16(&h, 1, 8, format);
+		matrix16_from_float(row, h);
+		for (int j = 0; j < 8; j++) {
+			if (h->data[j] != want[format][j]) {
+				printf("%s of %a: got 0x%04x, expected 0x%04x\n", half_format_name(format), in[j], h->data[j], want[format][j]);
+				exit(1);
+			}
+		}
+		// Widening is exact, so narrowing what it gives changes nothing
+		matrix16_to_float(h, back);
+		matrix16 *again;
+		allocate_matrix16(&again, 1, 8, format);
+		matrix16_from_float(back, again);
+		EXPECT(memcmp(h->data, again->data, 8 * sizeof(uint16_t)) == 0);
+		free_matrix16(h);
+		free_matrix16(again);
+	}
+	free_matrix(row);
+	free_matrix(back);
+
+	// Products against float ones of the widened operands, on the small, packed and skinny paths
+	int shapes[4][3] = {{37, 53, 29}, {150, 300, 120}, {300, 300, 1}, {1, 300, 200}};
+	for (int format = 0; format < HALF_FORMAT_COUNT; format++) {
+		for (int s = 0; s < 4; s++) {
+			int m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+			matrix *a = random_matrix(m, k), *b = random_matrix(k, n), *dst;
+			matrix16 *a16, *b16;
+			allocate_matrix16(&a16, m, k, format);
+			allocate_matrix16(&b16, k, n, format);
+			matrix16_from_float(a, a16);
+			matrix16_from_float(b, b16);
+			matrix16_to_float(a16, a);
+			matrix16_to_float(b16, b);
+			allocate_matrix(&dst, m, n);
+			for (int v = 0; v < 3; v++) {
+				if (v == 0) {
+					matrix16_multiply(a16, b16, dst);
+				} else if (v == 1) {
+					matrix16_multiply_float(a16, b, dst);
+				} else {
+					matrix_multiply_half(a, b16, dst);
+				}
+				for (int i = 0; i < m; i++) {
+					for (int j = 0; j < n; j++) {
+						double want = 0;
+						for (int p = 0; p < k; p++) {
+							want += (double) get_loc(a, i, p) * get_loc(b, p, j);
+						}
+						check_close("half precision product", get_loc(dst, i, j), want, 1e-5);
+					}
+				}
+			}
+			// A sum of two 16-bit values is exact in float, so it must be rounded once
+			if (m == k) {
+				matrix *sum;
+				matrix16 *got, *expected;
+				allocate_matrix(&sum, m, k);
+				allocate_matrix16(&got, m, k, format);
+				allocate_matrix16(&expected, m, k, format);
+				matrix_add(a, a, sum);
+				matrix16_from_float(sum, expected);
+				matrix16_add(a16, a16, got);
+				for (int i = 0; i < m; i++) {
+					EXPECT(memcmp(got->data + (size_t) i * got->stride, expected->data + (size_t) i * expected->stride,
+					              k * sizeof(uint16_t)) == 0);
+				}
+				free_matrix(sum);
+				free_matrix16(got);
+				free_matrix16(expected);
+			}
+			free_matrix(a);
+			free_matrix(b);
+			free_matrix(dst);
+			free_matrix16(a16);
+			free_matrix16(b16);
+		}
+	}
+}
+
+matrix64* random_matrix64(int r, int c) {
+	matrix64 *m;
+	allocate_matrix64(&m, r, c);
+	for (int i = 0; i < r; i++) {
+		for (int j = 0; j < c; j++) {
+			set_loc64(m, i, j, drand48() * 2 - 1);
+		}
+	}
+	return m;
+}
+
+void check_product64(matrix64 *a, matrix64 *b) {
+	matrix64 *dst;
+	allocate_matrix64(&dst, a->dim.rows, b->dim.cols);
+	matrix_multiply64(a, b, dst);
+	for (int i = 0; i < a->dim.rows; i++) {
+		for (int j = 0; j < b->dim.cols; j++) {
+			long double want = 0;
+			for (int p = 0; p < a->dim.cols; p++) {
+				want += (long double) get_loc64(a, i, p) * get_loc64(b, p, j);
+			}
+			check_close("matrix_multiply64", get_loc64(dst, i, j), want, 1e-13);
+		}
+	}
+	free_matrix64(dst);
+}
+
+void check_double() {
+	// Tiny, packed, skinny and empty products, then Strassen
+	int shapes[7][3] = {{1, 1, 1}, {13, 17, 19}, {250, 300, 131}, {1, 500, 300}, {500, 300, 1}, {3, 400, 2}, {7, 0, 5}};
+	for (int s = 0; s < 7; s++) {
+		matrix64 *a = random_matrix64(shapes[s][0], shapes[s][1]), *b = random_matrix64(shapes[s][1], shapes[s][2]);
+		check_product64(a, b);
+		free_matrix64(a);
+		free_matrix64(b);
+	}
+	int crossover = set_strassen_crossover(128);
+	matrix64 *sq = random_matrix64(257, 257);
+	check_product64(sq, sq);
+	set_strassen_crossover(crossover);
+
+	// Elementwise ops are exact; transposes too, in place included
+	int r = 37, c = 301;
+	matrix64 *a = random_matrix64(r, c), *b = random_matrix64(r, c), *dst, *t;
+	allocate_matrix64(&dst, r, c);
+	allocate_matrix64(&t, c, r);
+	for (int op = 0; op < 4; op++) {
+		if (op == 0) {
+			matrix_add64(a, b, dst);
+		} else if (op == 1) {
+			matrix_sub64(a, b, dst);
+		} else if (op == 2) {
+			matrix_multiply_elementwise64(a, b, dst);
+		} else {
+			matrix_scale64(a, 0.1, dst);
+		}
+		for (int i = 0; i < r; i++) {
+			for (int j = 0; j < c; j++) {
+				double x = get_loc64(a, i, j), y = get_loc64(b, i, j);
+				check_close("elementwise64", get_loc64(dst, i, j), op == 0 ? x + y : op == 1 ? x - y : op == 2 ? x * y : x * 0.1, 0);
+			}
+		}
+	}
+	matrix_transpose64(a, t);
+	for (int i = 0; i < r; i++) {
+		for (int j = 0; j < c; j++) {
+			check_close("matrix_transpose64", get_loc64(t, j, i), get_loc64(a, i, j), 0);
+		}
+	}
+	matrix64 *before;
+	allocate_matrix64(&before, 257, 257);
+	copy64(sq, before);
+	matrix_transpose64(sq, sq);
+	for (int i = 0; i < 257; i++) {
+		for (int j = 0; j < 257; j++) {
+			check_close("matrix_transpose64 in place", get_loc64(sq, j, i), get_loc64(before, i, j), 0);
+		}
+	}
+
+	// Dot of a strided column and a dense one
+	matrix64 *col, *vec = random_matrix64(c, 1);
+	view_matrix64(&col, t, 0, 5, c, 1, 1);
+	double dot;
+	long double want = 0;
+	dot_product64(col, vec, &dot);
+	for (int i = 0; i < c; i++) {
+		want += (long double) get_loc64(col, i, 0) * get_loc64(vec, i, 0);
+	}
+	check_close("dot_product64", dot, want, 1e-13);
+
+	// Power against repeated products
+	matrix64 *p = random_matrix64(24, 24), *pw, *acc, *tmp;
+	allocate_matrix64(&pw, 24, 24);
+	allocate_matrix64(&acc, 24, 24);
+	allocate_matrix64(&tmp, 24, 24);
+	matrix_scale64(p, 0.3, p);
+	matrix_power64(p, 13, pw);
+	copy64(p, acc);
+	for (int i = 1; i < 13; i++) {
+		matrix_multiply64(acc, p, tmp);
+		copy64(tmp, acc);
+	}
+	for (int i = 0; i < 24; i++) {
+		for (int j = 0; j < 24; j++) {
+			check_close("matrix_power64", get_loc64(pw, i, j), get_loc64(acc, i, j), 1e-12);
+		}
+	}
+
+	// Narrowing rounds to the nearest float, widening is exact
+	matrix *f;
+	matrix64 *wide;
+	allocate_matrix(&f, r, c);
+	allocate_matrix64(&wide, r, c);
+	matrix64_to_float(a, f);
+	matrix_to_double(f, wide);
+	for (int i = 0; i < r; i++) {
+		for (int j = 0; j < c; j++) {
+			check_close("matrix64_to_float", get_loc(f, i, j), (float) get_loc64(a, i, j), 0);
+			check_close("matrix_to_double", get_loc64(wide, i, j), get_loc(f, i, j), 0);
+		}
+	}
+
+	free_matrix(f);
+	free_matrix64(wide);
+	free_matrix64(p);
+	free_matrix64(pw);
+	free_matrix64(acc);
+	free_matrix64(tmp);
+	free_matrix64(col);
+	free_matrix64(vec);
+	free_matrix64(before);
+	free_matrix64(sq);
+	free_matrix64(a);
+	free_matrix64(b);
+	free_matrix64(dst);
+	free_matrix64(t);
+}
 
 
 long read_naive_duration() {
@@ -15,14 +421,20 @@ int main() {
 	double speedup;
 	long start, end, duration, naive_duration;
 	int equal, num_answers;
-	read_matrices = read_matrices_from_file(all_matrices_filename);
+	check_batch_ops();
+	check_matfile();
+	check_half();
+	check_double();
+	printf("%s\n", "BEHAVIOR CHECKS PASSED");
+
+	read_matrices = map_matrices_from_file(all_matrices_bin_filename);
 	start = timer();
 	num_answers = perform_all_ops(read_matrices, DEFAULT_NUM_EACH_SIZE * NUM_SIZES, &ans_matrices);
 	end = timer();
 	printf("Start is: %li, End is: %li\n", start, end);
 	duration = end-start;
 	printf("Duration is %li\n\n", duration);
-	naive_ans_matrices = read_matrices_from_file(all_matrices_ops_filename);
+	naive_ans_matrices = map_matrices_from_file(all_matrices_ops_bin_filename);
 	equal = check_equality(naive_ans_matrices, ans_matrices, num_answers);
 	assert(equal);
 	printf("%s\n", "NAIVE AND PERFORMANCE VERSION PRODUCE SAME RESULTS");
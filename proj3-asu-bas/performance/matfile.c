@@ -0,0 +1,329 @@
+#include "matfile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The format is little-endian and every field is written as it is in memory
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "matfile assumes a little-endian host");
+_Static_assert(sizeof(matfile_header) == 32 && sizeof(matfile_entry) == 32, "matfile records must be packed");
+
+const char *matfile_strerror(int err) {
+    switch (err) {
+    case MATFILE_OK:
+        return "success";
+    case MATFILE_EIO:
+        return strerror(errno);
+    case MATFILE_EFORMAT:
+        return "not a matrix file, or truncated";
+    case MATFILE_EVERSION:
+        return "unsupported matrix file version or dtype";
+    case MATFILE_ECHECKSUM:
+        return "matrix file checksum mismatch";
+    case MATFILE_ENOMEM:
+        return "out of memory";
+    }
+    return "unknown error";
+}
+
+/*
+ * Fletcher-style checksum over 32-bit words: a running sum and a sum of the
+ * running sums, so both changed values and reordered ones are caught. Two
+ * adds per word keep it far faster than the disk.
+ */
+typedef struct checksum {
+    uint64_t a, b;
+} checksum;
+
+// The words are read from floats and header structs alike
+typedef uint32_t __attribute__((may_alias)) checksum_word;
+
+static void checksum_update(checksum *c, const void *data, size_t bytes) {
+    const checksum_word *w = data;
+    uint64_t a = c->a, b = c->b;
+    for (size_t i = 0; i < bytes / 4; i++) {
+        a += w[i];
+        b += a;
+    }
+    c->a = a;
+    c->b = b;
+}
+
+static uint64_t checksum_value(checksum *c) {
+    return c->a ^ (c->b << 32 | c->b >> 32);
+}
+
+static uint64_t header_checksum(const matfile_header *h, const matfile_entry *entries) {
+    matfile_header copy = *h;
+    copy.header_checksum = 0;
+    checksum c = {0, 0};
+    checksum_update(&c, &copy, sizeof copy);
+    checksum_update(&c, entries, (size_t) h->count * sizeof(matfile_entry));
+    return checksum_value(&c);
+}
+
+static size_t align_up(size_t n) {
+    return (n + MATFILE_ALIGN - 1) / MATFILE_ALIGN * MATFILE_ALIGN;
+}
+
+static size_t entry_bytes(const matfile_entry *e) {
+    return (size_t) e->rows * e->stride * sizeof(float);
+}
+
+/* Header, entries and checksums for mats, in a malloc'd buffer padded out to where the data starts */
+static void *build_index(matrix **mats, int count, size_t *index_bytes) {
+    size_t head = align_up(sizeof(matfile_header) + (size_t) count * sizeof(matfile_entry));
+    char *index = calloc(head, 1);
+    if (index == NULL) {
+        return NULL;
+    }
+    matfile_header *h = (matfile_header *) index;
+    matfile_entry *entries = (matfile_entry *) (h + 1);
+    memcpy(h->magic, MATFILE_MAGIC, sizeof h->magic);
+    h->version = MATFILE_VERSION;
+    h->dtype = MATFILE_FLOAT32;
+    h->alignment = MATFILE_ALIGN;
+    h->count = count;
+
+    size_t offset = head;
+    for (int i = 0; i < count; i++) {
+        matrix *m = mats[i];
+        matfile_entry *e = &entries[i];
+        e->rows = m->dim.rows;
+        e->cols = m->dim.cols;
+        e->stride = row_stride(m->dim.cols);
+        e->offset = offset;
+        checksum c = {0, 0};
+        for (int r = 0; r < m->dim.rows; r++) {
+            checksum_update(&c, MAT_ROW(m, r), m->dim.cols * sizeof(float));
+            // Padding is zeros, which add nothing to a but still advance b
+            c.b += c.a * (e->stride - e->cols);
+        }
+        e->checksum = checksum_value(&c);
+        offset = align_up(offset + entry_bytes(e));
+    }
+    h->header_checksum = header_checksum(h, entries);
+    *index_bytes = head;
+    return index;
+}
+
+int matfile_write(const char *path, matrix **mats, int count) {
+    size_t head;
+    char *index = build_index(mats, count, &head);
+    if (index == NULL) {
+        return MATFILE_ENOMEM;
+    }
+    const matfile_entry *entries = (const matfile_entry *) (index + sizeof(matfile_header));
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        free(index);
+        return MATFILE_EIO;
+    }
+    static const char zeros[MATFILE_ALIGN * 4];
+    int ok = fwrite(index, 1, head, f) == head;
+    size_t written = head;
+    for (int i = 0; i < count && ok; i++) {
+        matrix *m = mats[i];
+        const matfile_entry *e = &entries[i];
+        size_t row_bytes = m->dim.cols * sizeof(float), pad = (e->stride - e->cols) * sizeof(float);
+        for (int r = 0; r < m->dim.rows && ok; r++) {
+            ok = fwrite(MAT_ROW(m, r), 1, row_bytes, f) == row_bytes && fwrite(zeros, 1, pad, f) == pad;
+        }
+        written += entry_bytes(e);
+        size_t gap = align_up(written) - written;
+        ok = ok && fwrite(zeros, 1, gap, f) == gap;
+        written += gap;
+    }
+    free(index);
+    if (fclose(f) != 0 || ! ok) {
+        return MATFILE_EIO;
+    }
+    return MATFILE_OK;
+}
+
+int matfile_index(const void *data, size_t size, int verify, const matfile_entry **entries, int *count) {
+    const matfile_header *h = data;
+    if (size < sizeof *h || memcmp(h->magic, MATFILE_MAGIC, sizeof h->magic) != 0) {
+        return MATFILE_EFORMAT;
+    }
+    if (h->version != MATFILE_VERSION || h->dtype != MATFILE_FLOAT32 || h->alignment != MATFILE_ALIGN) {
+        return MATFILE_EVERSION;
+    }
+    if (h->count > INT32_MAX || (size - sizeof *h) / sizeof(matfile_entry) < h->count) {
+        return MATFILE_EFORMAT;
+    }
+    const matfile_entry *e = (const matfile_entry *) (h + 1);
+    if (header_checksum(h, e) != h->header_checksum) {
+        return MATFILE_ECHECKSUM;
+    }
+    for (uint32_t i = 0; i < h->count; i++) {
+        if (e[i].rows > INT32_MAX || e[i].cols > INT32_MAX || e[i].stride < e[i].cols || e[i].offset % MATFILE_ALIGN != 0
+            || e[i].offset > size || entry_bytes(&e[i]) > size - e[i].offset) {
+            return MATFILE_EFORMAT;
+        }
+        if (verify) {
+            checksum c = {0, 0};
+            checksum_update(&c, (const char *) data + e[i].offset, entry_bytes(&e[i]));
+            if (checksum_value(&c) != e[i].checksum) {
+                return MATFILE_ECHECKSUM;
+            }
+        }
+    }
+    *entries = e;
+    *count = h->count;
+    return MATFILE_OK;
+}
+
+int matfile_read(const char *path, matrix ***mats, int *count) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return MATFILE_EIO;
+    }
+    matfile_header h;
+    matfile_entry *entries = NULL;
+    matrix **out = NULL;
+    int err = MATFILE_EFORMAT, loaded = 0;
+    if (fread(&h, sizeof h, 1, f) != 1 || memcmp(h.magic, MATFILE_MAGIC, sizeof h.magic) != 0) {
+        goto done;
+    }
+    if (h.version != MATFILE_VERSION || h.dtype != MATFILE_FLOAT32 || h.alignment != MATFILE_ALIGN) {
+        err = MATFILE_EVERSION;
+        goto done;
+    }
+    if (h.count > INT32_MAX) {
+        goto done;
+    }
+    entries = malloc((size_t) h.count * sizeof(matfile_entry) + 1);
+    out = malloc((size_t) h.count * sizeof(matrix *) + 1);
+    if (entries == NULL || out == NULL) {
+        err = MATFILE_ENOMEM;
+        goto done;
+    }
+    if (fread(entries, sizeof(matfile_entry), h.count, f) != h.count) {
+        goto done;
+    }
+    if (header_checksum(&h, entries) != h.header_checksum) {
+        err = MATFILE_ECHECKSUM;
+        goto done;
+    }
+    for (; loaded < (int) h.count; loaded++) {
+        const matfile_entry *e = &entries[loaded];
+        if (e->rows > INT32_MAX || e->cols > INT32_MAX || e->stride < e->cols || fseeko(f, e->offset, SEEK_SET) != 0) {
+            goto done;
+        }
+        if (allocate_matrix_uninit(&out[loaded], e->rows, e->cols) != 0) {
+            err = MATFILE_ENOMEM;
+            goto done;
+        }
+        /*
+         * Rows go straight into the matrix. The file's padding is dropped, but
+         * checksummed as it is, like matfile_index does, so both readers
+         * accept the same files.
+         */
+        matrix *m = out[loaded];
+        checksum c = {0, 0};
+        for (uint32_t r = 0; r < e->rows; r++) {
+            if (fread(MAT_ROW(m, r), sizeof(float), e->cols, f) != e->cols) {
+                free_matrix(m);
+                goto done;
+            }
+            checksum_update(&c, MAT_ROW(m, r), e->cols * sizeof(float));
+            for (uint32_t left = e->stride - e->cols; left > 0; ) {
+                float pad[MATFILE_ALIGN];
+                uint32_t n = left < MATFILE_ALIGN ? left : MATFILE_ALIGN;
+                if (fread(pad, sizeof(float), n, f) != n) {
+                    free_matrix(m);
+                    goto done;
+                }
+                checksum_update(&c, pad, n * sizeof(float));
+                left -= n;
+            }
+        }
+        if (checksum_value(&c) != e->checksum) {
+            free_matrix(m);
+            err = MATFILE_ECHECKSUM;
+            goto done;
+        }
+    }
+    err = MATFILE_OK;
+done:
+    if (ferror(f)) {
+        err = MATFILE_EIO;
+    }
+    fclose(f);
+    free(entries);
+    if (err != MATFILE_OK) {
+        for (int i = 0; i < loaded; i++) {
+            free_matrix(out[i]);
+        }
+        free(out);
+        return err;
+    }
+    *mats = out;
+    *count = h.count;
+    return MATFILE_OK;
+}
+
+int matfile_open_map(const char *path, int verify, matfile_map **map) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MATFILE_EIO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MATFILE_EIO;
+    }
+    size_t size = st.st_size;
+    void *base = size > 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    int mmap_errno = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+        errno = size > 0 ? mmap_errno : 0;
+        return size > 0 ? MATFILE_EIO : MATFILE_EFORMAT;
+    }
+
+    const matfile_entry *entries;
+    int count;
+    int err = matfile_index(base, size, verify, &entries, &count);
+    matfile_map *m = err == MATFILE_OK ? calloc(1, sizeof *m) : NULL;
+    if (m != NULL) {
+        m->mats = calloc(count + 1, sizeof(matrix *));
+    }
+    if (err == MATFILE_OK && (m == NULL || m->mats == NULL)) {
+        err = MATFILE_ENOMEM;
+    }
+    for (int i = 0; err == MATFILE_OK && i < count; i++) {
+        const matfile_entry *e = &entries[i];
+        if (wrap_matrix(&m->mats[i], (float *) ((char *) base + e->offset), e->rows, e->cols, e->stride) != 0) {
+            err = MATFILE_ENOMEM;
+        }
+        m->count = i + 1;
+    }
+    if (err != MATFILE_OK) {
+        if (m != NULL) {
+            m->base = base;
+            m->size = size;
+            matfile_unmap(m);
+        } else {
+            munmap(base, size);
+        }
+        return err;
+    }
+    m->base = base;
+    m->size = size;
+    *map = m;
+    return MATFILE_OK;
+}
+
+void matfile_unmap(matfile_map *map) {
+    for (int i = 0; i < map->count; i++) {
+        if (map->mats[i] != NULL) {
+            free_matrix(map->mats[i]);
+        }
+    }
+    free(map->mats);
+    munmap(map->base, map->size);
+    free(map);
+}
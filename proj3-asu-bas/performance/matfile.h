@@ -0,0 +1,81 @@
+#ifndef MATFILE_H
+#define MATFILE_H
+
+#include "matrix.h"
+
+/*
+ * Binary container for a list of matrices, laid out so the file can be
+ * mmapped and used as matrix storage in place:
+ *
+ *   matfile_header, count matfile_entry records, then each matrix's rows,
+ *   stride floats apart, starting on a multiple of the header's alignment
+ *
+ * All fields are little-endian. The header checksum covers the header (with
+ * that field zeroed) and the entries; each entry has its own checksum of
+ * rows * stride floats of data, padding included (written as zeros).
+ */
+#define MATFILE_MAGIC "M61CMAT"     // 8 bytes with the NUL
+#define MATFILE_VERSION 1
+#define MATFILE_ALIGN MATRIX_ALIGN
+
+typedef enum matfile_dtype {
+    MATFILE_FLOAT32 = 1,
+} matfile_dtype;
+
+typedef struct matfile_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t alignment;
+    uint32_t count;
+    uint64_t header_checksum;
+} matfile_header;
+
+typedef struct matfile_entry {
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t stride;
+    uint32_t reserved;
+    uint64_t offset;            // from the start of the file
+    uint64_t checksum;
+} matfile_entry;
+
+// Return codes; matfile_strerror describes them
+#define MATFILE_OK 0
+#define MATFILE_EIO (-1)            // see errno
+#define MATFILE_EFORMAT (-2)
+#define MATFILE_EVERSION (-3)
+#define MATFILE_ECHECKSUM (-4)
+#define MATFILE_ENOMEM (-5)
+
+const char *matfile_strerror(int err);
+
+int matfile_write(const char *path, matrix **mats, int count);
+
+// Reads every matrix into newly allocated ones; *mats is malloc'd
+int matfile_read(const char *path, matrix ***mats, int *count);
+
+/*
+ * Checks a whole file image already in memory and points *entries at its
+ * entry table. verify also checks every matrix checksum.
+ */
+int matfile_index(const void *data, size_t size, int verify, const matfile_entry **entries, int *count);
+
+/*
+ * mmaps the file copy-on-write and wraps each matrix around the mapping, so
+ * without verify nothing but the header and entries is read until it is
+ * touched. verify checks every matrix checksum up front, which reads the
+ * whole file. Writes to the matrices never reach the file. Everything goes
+ * away with matfile_unmap.
+ */
+typedef struct matfile_map {
+    void *base;
+    size_t size;
+    int count;
+    matrix **mats;
+} matfile_map;
+
+int matfile_open_map(const char *path, int verify, matfile_map **map);
+void matfile_unmap(matfile_map *map);
+
+#endif
@@ -0,0 +1,49 @@
+#include "matfile.h"
+
+/*
+ * Converts the harness's text fixtures (a count, then "rows cols" and rows *
+ * cols %a floats per matrix, as written by naive/mat_test.c) into a matfile:
+ *   matfile_convert <text file> <matfile>
+ */
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <text file> <matfile>\n", argv[0]);
+        return 2;
+    }
+    FILE *f = fopen(argv[1], "r");
+    if (f == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    int count;
+    if (fscanf(f, "%i", &count) != 1 || count < 0) {
+        fprintf(stderr, "%s: no matrix count\n", argv[1]);
+        return 1;
+    }
+    matrix **mats = malloc((count + 1) * sizeof(matrix *));
+    assert(mats != NULL);
+    for (int i = 0; i < count; i++) {
+        int rows, cols;
+        if (fscanf(f, "%i %i", &rows, &cols) != 2 || rows < 0 || cols < 0 || allocate_matrix_uninit(&mats[i], rows, cols) != 0) {
+            fprintf(stderr, "%s: bad shape for matrix %d\n", argv[1], i);
+            return 1;
+        }
+        for (int r = 0; r < rows; r++) {
+            float *row = MAT_ROW(mats[i], r);
+            for (int c = 0; c < cols; c++) {
+                if (fscanf(f, "%a", &row[c]) != 1) {
+                    fprintf(stderr, "%s: matrix %d ends early\n", argv[1], i);
+                    return 1;
+                }
+            }
+        }
+    }
+    fclose(f);
+    int err = matfile_write(argv[2], mats, count);
+    if (err != MATFILE_OK) {
+        fprintf(stderr, "%s: %s\n", argv[2], matfile_strerror(err));
+        remove(argv[2]);
+        return 1;
+    }
+    return 0;
+}
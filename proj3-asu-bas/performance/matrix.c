@@ -1,201 +1,862 @@
 #include "matrix.h"
+#include "kernels.h"
+#include "counters.h"
+#include "trace.h"
 #include <omp.h>
-// Include SSE intrinsics
-#if defined(_MSC_VER)
-#include <intrin.h>
-#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
-#include <immintrin.h>
-#include <x86intrin.h>
-#endif
+#include <pthread.h>
 
 /*
-    called like:
-    ```c
-    matrix mat;
-    allocate_matrix(&mat, 1, 2);
-    ```
-*/
-int allocate_matrix(matrix **mat, int rows, int cols) {
-    *mat = malloc(sizeof(matrix));
-    (*mat)->dim.rows = rows;
-    (*mat)->dim.cols = cols;
-    (*mat)->data = malloc(sizeof(float *) * rows);
-
-//    for (int i = 0; i < rows/8*8; i+=8) {
-//        (*mat)->data[i] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+1] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+2] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+3] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+4] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+5] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+6] = calloc(cols, sizeof(float));
-//        (*mat)->data[i+7] = calloc(cols, sizeof(float));
-//    }
-//
-//    for (int i = rows/8*8; i < rows; i++) {
-//        (*mat)->data[i] = calloc(cols, sizeof(float));
-//    }
-
-
-    for (int i = 0; i < rows; ++i) {
-        (*mat)->data[i] = calloc(cols, sizeof(float));
+ * Number of floats between the starts of consecutive rows.
+ * Narrow matrices (vectors) stay dense, everything else is padded to a SIMD
+ * width. A stride that is a multiple of the 4KB page would map every row onto
+ * the same cache sets, so those get one extra vector of padding.
+ */
+static int padded_stride(int cols, int element_size) {
+    int simd = MATRIX_ALIGN / element_size;
+    if (cols < simd) {
+        return cols;
     }
-    return 0;
+    int stride = (cols + simd - 1) / simd * simd;
+    if (((size_t) stride * element_size) % 4096 == 0) {
+        stride += simd;
+    }
+    return stride;
+}
+
+int row_stride(int cols) {
+    return padded_stride(cols, sizeof(float));
+}
+
+// Elementwise work below this many elements stays on the calling thread
+#define ELEMENTWISE_PARALLEL_MIN (1 << 16)
+
+/*
+ * Buffer pool. Matrix buffers and GEMM scratch are recycled through free
+ * lists by size class instead of going back to the allocator: large blocks
+ * would otherwise be mmapped, page faulted in and munmapped again on every
+ * operation of a steady-state loop. Classes split each power of two into 4
+ * steps, so a block is at most 25% larger than asked for.
+ *
+ * Every block starts with a MATRIX_ALIGN byte header holding its class, the
+ * pointer to free and the free list link; the caller gets the memory right
+ * after it. Up to
+ * pool_limit bytes are kept around (MATRIX_POOL_LIMIT or set_pool_limit);
+ * anything beyond that is freed straight away.
+ */
+#define POOL_MIN_BYTES 256
+#define POOL_CLASSES (4 * 48)
+#define POOL_DEFAULT_LIMIT ((size_t) 256 << 20)
+
+typedef struct pool_block {
+    int size_class;
+    void *raw;
+    struct pool_block *next;
+} pool_block;
+
+static pool_block *pool_free_lists[POOL_CLASSES];
+static size_t pool_cached, pool_limit = POOL_DEFAULT_LIMIT;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Class index of a block of bytes, rounding bytes up to the class size
+static int pool_class(size_t *bytes) {
+    if (*bytes <= POOL_MIN_BYTES) {
+        *bytes = POOL_MIN_BYTES;
+        return 0;
+    }
+    int octave = 63 - __builtin_clzll(*bytes - 1);     // 2^octave < bytes <= 2^(octave + 1)
+    size_t step = (size_t) 1 << (octave - 2);
+    size_t steps = (*bytes + step - 1) / step;          // 5 to 8
+    *bytes = steps * step;
+    return 1 + (octave - 8) * 4 + (int) (steps - 5);
+}
+
+static size_t pool_class_bytes(int size_class) {
+    if (size_class == 0) {
+        return POOL_MIN_BYTES;
+    }
+    int octave = (size_class - 1) / 4 + 8;
+    return ((size_t) 5 + (size_class - 1) % 4) << (octave - 2);
+}
+
+/*
+ * want bytes of MATRIX_ALIGN aligned memory, zeroed if zero is set. Reused blocks
+ * have to be cleared by hand; fresh ones come from calloc, which gets large
+ * blocks already zeroed from the kernel.
+ */
+static void *pool_alloc(size_t want, int zero) {
+    size_t bytes = want;
+    int size_class = pool_class(&bytes);
+    pool_block *block = NULL;
+    if (size_class < POOL_CLASSES) {
+        pthread_mutex_lock(&pool_lock);
+        block = pool_free_lists[size_class];
+        if (block != NULL) {
+            pool_free_lists[size_class] = block->next;
+            pool_cached -= bytes;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    if (block != NULL) {
+        if (zero) {
+            memset((char *) block + MATRIX_ALIGN, 0, want);
+        }
+        return (char *) block + MATRIX_ALIGN;
+    }
+    // Aligned by hand rather than with posix_memalign, which has no zeroing variant
+    void *raw = zero ? calloc(bytes + 2 * MATRIX_ALIGN, 1) : malloc(bytes + 2 * MATRIX_ALIGN);
+    if (raw == NULL) {
+        return NULL;
+    }
+    char *data = (char *) (((uintptr_t) raw + 2 * MATRIX_ALIGN - 1) & ~(uintptr_t) (MATRIX_ALIGN - 1));
+    block = (pool_block *) (data - MATRIX_ALIGN);
+    block->size_class = size_class;
+    block->raw = raw;
+    return data;
+}
+
+static void pool_free(void *data) {
+    if (data == NULL) {
+        return;
+    }
+    pool_block *block = (pool_block *) ((char *) data - MATRIX_ALIGN);
+    size_t bytes = pool_class_bytes(block->size_class);
+    if (block->size_class < POOL_CLASSES) {
+        pthread_mutex_lock(&pool_lock);
+        if (pool_cached + bytes <= pool_limit) {
+            block->next = pool_free_lists[block->size_class];
+            pool_free_lists[block->size_class] = block;
+            pool_cached += bytes;
+            block = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    if (block != NULL) {
+        free(block->raw);
+    }
+}
+
+// Frees every cached block and returns how many bytes that released
+size_t trim_pool(void) {
+    pool_block *lists[POOL_CLASSES];
+    pthread_mutex_lock(&pool_lock);
+    memcpy(lists, pool_free_lists, sizeof lists);
+    memset(pool_free_lists, 0, sizeof pool_free_lists);
+    size_t released = pool_cached;
+    pool_cached = 0;
+    pthread_mutex_unlock(&pool_lock);
+    for (int c = 0; c < POOL_CLASSES; c++) {
+        while (lists[c] != NULL) {
+            pool_block *next = lists[c]->next;
+            free(lists[c]->raw);
+            lists[c] = next;
+        }
+    }
+    return released;
+}
+
+size_t set_pool_limit(size_t bytes) {
+    pthread_mutex_lock(&pool_lock);
+    size_t previous = pool_limit;
+    pool_limit = bytes;
+    int over = pool_cached > bytes;
+    pthread_mutex_unlock(&pool_lock);
+    if (over) {
+        trim_pool();
+    }
+    return previous;
+}
+
+__attribute__((constructor))
+static void init_pool(void) {
+    const char *env = getenv("MATRIX_POOL_LIMIT");
+    if (env != NULL) {
+        pool_limit = strtoull(env, NULL, 10);
+    }
+}
+
+static inline int min_int(int a, int b) {
+    return a < b ? a : b;
 }
 
-int allocate_matrix_s(matrix **mat, shape s) {
-    return allocate_matrix(mat, s.rows, s.cols);
+/*
+ * Strassen-Winograd: 7 half size products and 15 additions instead of 8
+ * products, applied recursively while the matrices are square and at least
+ * strassen_crossover on a side. It saves 1/8 of the flops per level but its
+ * error bound grows with the depth, so set_strassen_crossover(0) turns it off
+ * for callers that need the classic GEMM bound (the ACCEPTABLE_ULPS check in
+ * testing/shared.h only covers sizes below the default crossover).
+ */
+// The packed GEMM runs near peak, so halves below ~2048 lose more to the extra additions than they save
+#define STRASSEN_DEFAULT_CROSSOVER 4096
+#define STRASSEN_MIN_CROSSOVER 128
+
+static int strassen_crossover = STRASSEN_DEFAULT_CROSSOVER;
+
+int set_strassen_crossover(int n) {
+    int previous = strassen_crossover;
+    strassen_crossover = (n <= 0) ? 0 : (n < STRASSEN_MIN_CROSSOVER ? STRASSEN_MIN_CROSSOVER : n);
+    return previous;
+}
+
+// MATRIX_STRASSEN=<crossover> (0 to disable) overrides the default at load time
+__attribute__((constructor))
+static void init_strassen(void) {
+    const char *env = getenv("MATRIX_STRASSEN");
+    if (env != NULL) {
+        set_strassen_crossover(atoi(env));
+    }
+}
+
+/*
+ * Elementwise ops walk their operands in runs of contiguous elements: one run
+ * per row, or, when every operand is dense (stride == cols, e.g. vectors),
+ * the whole buffer cut into ELEMENTWISE_CHUNK sized runs so a 3001x1 vector
+ * is not processed one call per element. Runs are split across threads once
+ * the job is large enough.
+ */
+#define ELEMENTWISE_CHUNK 4096
+
+typedef struct run_plan {
+    int dense;
+    int count;
+    int len;
+    size_t total;
+} run_plan;
+
+static inline int run_length(run_plan *p, int r) {
+    if (p->dense && r == p->count - 1) {
+        return (int) (p->total - (size_t) r * p->len);
+    }
+    return p->len;
+}
+
+/*
+ * An operand of the packed GEMM: a float matrix, or a 16-bit one (exactly one
+ * of the two is set). Packing already copies every block into float scratch,
+ * so 16-bit operands are widened right there and the micro-kernel never
+ * knows; nothing the size of the operand is ever materialized as float.
+ */
+typedef struct gemm_operand {
+    matrix *f32;
+    matrix16 *half;
+} gemm_operand;
+
+static shape operand_dim(gemm_operand op);
+static void gemm_pack_b_operand(const matrix_kernels *k, int kc, int nc, gemm_operand b, int row, int col, float *packed);
+static void gemm_pack_a_operand(const matrix_kernels *k, int mc, int kc, gemm_operand a, int row, int col, float *packed);
+
+#define REAL float
+#define MATRIX matrix
+#define MATRIX_SUFFIX
+#define MATRIX_KERNELS_T matrix_kernels
+#define MATRIX_KERNELS kernels
+#define MATRIX_TRACE_CAT "matrix"
+#define MATRIX_OPERAND gemm_operand
+#define MATRIX_OPERAND_OF(mat) ((gemm_operand) {mat, NULL})
+#define MATRIX_OPERAND_COLS(op) operand_dim(op).cols
+#define MATRIX_PACK_A gemm_pack_a_operand
+#define MATRIX_PACK_B gemm_pack_b_operand
+#include "matrix_ops.h"
+
+#define REAL double
+#define MATRIX matrix64
+#define MATRIX_SUFFIX 64
+#define MATRIX_KERNELS_T matrix_kernels64
+#define MATRIX_KERNELS kernels64
+#define MATRIX_TRACE_CAT "matrix64"
+#define MATRIX_OPERAND matrix64 *
+#define MATRIX_OPERAND_OF(mat) (mat)
+#define MATRIX_OPERAND_COLS(op) (op)->dim.cols
+#define MATRIX_PACK_A(k, mc, kc, a, row, col, packed) \
+    gemm_pack_a64(mc, kc, (k)->gemm_mr, MAT_ROW(a, row) + (col), (a)->stride, packed)
+#define MATRIX_PACK_B(k, kc, nc, b, row, col, packed) \
+    gemm_pack_b64(kc, nc, (k)->gemm_nr, MAT_ROW(b, row) + (col), (b)->stride, packed)
+#include "matrix_ops.h"
+
+/*
+ * Conversions between the element types. Widening to double is exact;
+ * narrowing rounds to nearest.
+ */
+void matrix_to_double(matrix *src, matrix64 *dst) {
+    assert(src->dim.rows == dst->dim.rows && src->dim.cols == dst->dim.cols);
+    COUNT_OP(OP_COPY);
+    TRACE_SCOPE("matrix", "to_double", dst->dim.rows, dst->dim.cols, 0);
+    #pragma omp parallel for if ((double) src->dim.rows * src->dim.cols >= ELEMENTWISE_PARALLEL_MIN)
+    for (int i = 0; i < src->dim.rows; i++) {
+        const float *s = MAT_ROW(src, i);
+        double *d = MAT_ROW(dst, i);
+        for (int j = 0; j < src->dim.cols; j++) {
+            d[j] = s[j];
+        }
+    }
+}
+
+void matrix64_to_float(matrix64 *src, matrix *dst) {
+    assert(src->dim.rows == dst->dim.rows && src->dim.cols == dst->dim.cols);
+    COUNT_OP(OP_COPY);
+    TRACE_SCOPE("matrix64", "to_float", dst->dim.rows, dst->dim.cols, 0);
+    #pragma omp parallel for if ((double) src->dim.rows * src->dim.cols >= ELEMENTWISE_PARALLEL_MIN)
+    for (int i = 0; i < src->dim.rows; i++) {
+        const double *s = MAT_ROW(src, i);
+        float *d = MAT_ROW(dst, i);
+        for (int j = 0; j < src->dim.cols; j++) {
+            d[j] = (float) s[j];
+        }
+    }
 }
 
 int eye(matrix **mat, shape s) {
-    assert(allocate_matrix_s(mat, s) == 0);
+    // Not inside the assert: extension builds compile with -DNDEBUG
+    if (allocate_matrix_s(mat, s) != 0) {
+        return -1;
+    }
     // Make the result an identity matrix
-
     for (int i = 0; i < s.rows; i++) {
-        (*mat)->data[i][i] = 1;
+        MAT_ROW(*mat, i)[i] = 1;
     }
-
-//    for (int i = 0; i < s.rows; i++) {
-//        _mm_storeu_si128((*mat)->data[i] + i, 1);
-//    }
     return 0;
 }
 
-void free_matrix(matrix *mat) {
-    for (int i = 0; i < mat->dim.rows; i++) {
-        free(mat->data[i]);
+static void widen(const matrix_kernels *k, half_format format, const uint16_t *src, float *dst, int n) {
+    (format == HALF_BF16 ? k->bf16_to_float : k->fp16_to_float)(src, dst, n);
+}
+
+static void narrow(const matrix_kernels *k, half_format format, const float *src, uint16_t *dst, int n) {
+    (format == HALF_BF16 ? k->float_to_bf16 : k->float_to_fp16)(src, dst, n);
+}
+
+static shape operand_dim(gemm_operand op) {
+    return op.f32 != NULL ? op.f32->dim : op.half->dim;
+}
+
+/* Elements [col, col + n) of a row as floats: in place for float operands, else widened into scratch */
+static const float *operand_row(const matrix_kernels *k, gemm_operand op, int row, int col, int n, float *scratch) {
+    if (op.f32 != NULL) {
+        return MAT_ROW(op.f32, row) + col;
     }
-    free(mat->data);
-    free(mat);
+    widen(k, op.half->format, MAT_ROW(op.half, row) + col, scratch, n);
+    return scratch;
 }
 
-void dot_product(matrix *vec1, matrix *vec2, float *result) {
-    assert(same_size(vec1, vec2) && vec1->dim.cols == 1);
-    *result = 0;
-    for (int i = 0; i < vec1->dim.rows; ++i) {
-        *result += vec1->data[i][0] * vec2->data[i][0];
+static void gemm_pack_b_operand(const matrix_kernels *k, int kc, int nc, gemm_operand b, int row, int col, float *packed) {
+    if (b.f32 != NULL) {
+        gemm_pack_b(kc, nc, k->gemm_nr, MAT_ROW(b.f32, row) + col, b.f32->stride, packed);
+        return;
+    }
+    int nr = k->gemm_nr;
+    for (int j = 0; j < nc; j += nr) {
+        int width = min_int(nr, nc - j);
+        for (int p = 0; p < kc; p++) {
+            widen(k, b.half->format, MAT_ROW(b.half, row + p) + col + j, packed, width);
+            for (int q = width; q < nr; q++) {
+                packed[q] = 0;
+            }
+            packed += nr;
+        }
     }
 }
 
-void outer_product(matrix *vec1, matrix *vec2, matrix *dst) {
-    assert(vec1->dim.cols == 1 && vec2->dim.cols == 1 && vec1->dim.rows == dst->dim.rows && vec2->dim.rows == dst->dim.cols);
-    for (int i = 0; i < vec1->dim.rows; i++) {
-        for (int j = 0; j < vec2->dim.rows; j++) {
-            dst->data[i][j] = vec1->data[i][0] * vec2->data[j][0];
+static void gemm_pack_a_operand(const matrix_kernels *k, int mc, int kc, gemm_operand a, int row, int col, float *packed) {
+    int mr = k->gemm_mr;
+    if (a.f32 != NULL) {
+        gemm_pack_a(mc, kc, mr, MAT_ROW(a.f32, row) + col, a.f32->stride, packed);
+        return;
+    }
+    // 16-bit rows are widened whole (contiguous) and then dealt out column by column
+    float line[GEMM_KC];
+    for (int i = 0; i < mc; i += mr) {
+        int height = min_int(mr, mc - i);
+        for (int r = 0; r < mr; r++) {
+            if (r < height) {
+                widen(k, a.half->format, MAT_ROW(a.half, row + i + r) + col, line, kc);
+            }
+            for (int p = 0; p < kc; p++) {
+                packed[(size_t) p * mr + r] = r < height ? line[p] : 0;
+            }
         }
+        packed += (size_t) mr * kc;
     }
 }
 
-void matrix_power(matrix *mat, int pow, matrix *dst) {
-    assert(mat != dst && same_size(mat, dst) && mat->dim.rows == mat->dim.cols);
-    if (pow == 1) {
-        copy(mat, dst);
+// Products this small skip packing: padding them out to a register tile costs more than it saves
+#define GEMM_DIRECT_MAX_FLOPS (16.0 * 16 * 16)
+
+/* c = a b on the calling thread, packing into caller-provided buffers */
+static void gemm_serial(const matrix_kernels *kern, int m, int n, int k, const float *a, int lda, const float *b, int ldb,
+                        float *c, int ldc, float *packed_a, float *packed_b) {
+    if ((double) m * n * k <= GEMM_DIRECT_MAX_FLOPS) {
+        for (int i = 0; i < m; i++) {
+            float *c_i = c + (size_t) i * ldc;
+            memset(c_i, 0, n * sizeof(float));
+            for (int p = 0; p < k; p++) {
+                float a_ip = a[(size_t) i * lda + p];
+                const float *b_p = b + (size_t) p * ldb;
+                for (int j = 0; j < n; j++) {
+                    c_i[j] += a_ip * b_p[j];
+                }
+            }
+        }
         return;
     }
-    if (pow == 2) {
-        matrix_multiply(mat, mat, dst);
+    for (int jc = 0; jc < n; jc += GEMM_NC) {
+        int nc = min_int(GEMM_NC, n - jc);
+        for (int pc = 0; pc < k; pc += GEMM_KC) {
+            int kc = min_int(GEMM_KC, k - pc);
+            gemm_pack_b(kc, nc, kern->gemm_nr, b + (size_t) pc * ldb + jc, ldb, packed_b);
+            for (int ic = 0; ic < m; ic += GEMM_MC) {
+                int mc = min_int(GEMM_MC, m - ic);
+                gemm_pack_a(mc, kc, kern->gemm_mr, a + (size_t) ic * lda + pc, lda, packed_a);
+                gemm_macro_kernel(kern, mc, nc, kc, packed_a, packed_b, c + (size_t) ic * ldc + jc, ldc, pc > 0);
+            }
+        }
+    }
+}
+
+/*
+ * count products of small matrices stacked along the rows: block i of mat1
+ * (rows / count x k) times block i of mat2, or all of mat2 when it is a single
+ * k x n matrix, goes to block i of dst. The threads split the batch and each
+ * reuses one set of packing buffers, so a product costs no allocation and no
+ * thread team of its own. Products big enough to be split are left to
+ * matrix_multiply one at a time.
+ */
+void matrix_batch_multiply(matrix *mat1, matrix *mat2, int count, matrix *dst) {
+    assert(count > 0 && mat1->dim.rows % count == 0 && dst->dim.rows == mat1->dim.rows);
+    COUNT_OP(OP_BATCH_MULTIPLY);
+    TRACE_SCOPE("matrix", "batch_multiply", dst->dim.rows, dst->dim.cols, mat1->dim.cols);
+    int m = mat1->dim.rows / count, k = mat1->dim.cols, n = dst->dim.cols;
+    int shared_b = mat2->dim.rows == k;
+    assert(mat2->dim.cols == n && (shared_b || mat2->dim.rows == k * count));
+    assert(dst != mat1 && dst != mat2);
+    if (k == 0 || (double) m * n * k >= GEMM_PARALLEL_MIN_FLOPS) {
+        for (int i = 0; i < count; i++) {
+            matrix *a_i, *b_i, *c_i;
+            view_matrix(&a_i, mat1, i * m, 0, m, k, 1);
+            view_matrix(&b_i, mat2, shared_b ? 0 : i * k, 0, k, n, 1);
+            view_matrix(&c_i, dst, i * m, 0, m, n, 1);
+            matrix_multiply(a_i, b_i, c_i);
+            free_matrix(a_i);
+            free_matrix(b_i);
+            free_matrix(c_i);
+        }
         return;
     }
 
-    matrix* intermediate;
-    eye(&intermediate, dst->dim);
-    copy(intermediate, dst);
-    for (int i = 0; i < pow; i++) {
-        matrix_multiply(intermediate, mat, dst);
-        copy(dst, intermediate);
-    }
-    free_matrix(intermediate);
-}
-
-void matrix_multiply(matrix *mat1, matrix *mat2, matrix *dst) {
-    assert (mat1->dim.cols == mat2->dim.rows && dst->dim.rows == mat1->dim.rows && dst->dim.cols == mat2->dim.cols);
-    
-    // matrix *transpose;
-    // allocate_matrix(&transpose, mat2->dim.cols, mat2->dim.rows);
-    // matrix_transpose(mat2, transpose);
-    // int n = mat1->dim.rows;
-    // for (int i = 0; i<n; i++) {
-    //     matrix *dot1 = arr_to_matrix(mat1->data[i], mat1->dim.cols, 1);
-    //     for (int j=0; j<mat2->dim.cols; j++) {
-    //         float ij;
-    //         matrix *dot2 = arr_to_matrix(transpose->data[j], mat2->dim.cols, 1);
-    //         dot_product(dot1, dot2, &ij);
-    //         printf(ij);
-    //         dst->data[i][j] = ij;
-    //         free_matrix(dot2);
-    //     }
-    //     free_matrix(dot1);
-    // }
-    // free_matrix(transpose);
-}
-    matrix *transpose;
-    allocate_matrix(&transpose, mat2->dim.cols, mat2->dim.rows);
-    matrix_transpose(mat2, transpose);
-    int n = mat1->dim.rows;
-    for (int i = 0; i < n; i++)
-       for (int j = 0; j < mat2->dim.cols; j++) {
-           dst->data[i][j] = 0;
-           for (int k = 0; k < mat1->dim.cols; k++)
-               dst->data[i][j] += mat1->data[i][k] * transpose->data[j][k];
-       }
-
-
-//    __m128i_mm_loadu_si128(dst->data[i] + j*n)
-
-
-void matrix_scale(matrix *mat, float scalar, matrix *dst) {
-    assert(same_size(mat, dst));
-    for (int i = 0; i < mat->dim.rows; i++) {
-        for (int j = 0; j < mat->dim.cols; j++) {
-            dst->data[i][j] = scalar * mat->data[i][j];
+    const matrix_kernels *kern = kernels;
+    int mr = kern->gemm_mr, nr = kern->gemm_nr;
+    size_t a_size = (size_t) GEMM_KC * min_int(GEMM_MC, (m + mr - 1) / mr * mr);
+    size_t b_size = (size_t) GEMM_KC * min_int(GEMM_NC, (n + nr - 1) / nr * nr);
+    #pragma omp parallel if ((double) m * n * k * count >= GEMM_PARALLEL_MIN_FLOPS)
+    {
+        float *packed_a = alloc_aligned(a_size);
+        float *packed_b = alloc_aligned(b_size);
+        assert(packed_a != NULL && packed_b != NULL);
+        TRACE_SCOPE("thread", "batch_multiply", m, n, k);
+        #pragma omp for schedule(static) nowait
+        for (int i = 0; i < count; i++) {
+            gemm_serial(kern, m, n, k, MAT_ROW(mat1, i * m), mat1->stride, MAT_ROW(mat2, shared_b ? 0 : i * k), mat2->stride,
+                        MAT_ROW(dst, i * m), dst->stride, packed_a, packed_b);
         }
+        pool_free(packed_a);
+        pool_free(packed_b);
     }
 }
+
 void apply_func(matrix* mat, matrix* dst, float (*f)(float)) {
     assert(same_size(mat, dst));
-    for (int i = 0; i < mat->dim.rows; i++) {
-        for (int j = 0; j < mat->dim.cols; j++) {
-            dst->data[i][j] = f(mat->data[i][j]);
+    COUNT_OP(OP_FUNC);
+    TRACE_SCOPE("matrix", "func", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = plan_runs(dst, mat, NULL);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        float *s = run_start(mat, &p, r), *d = run_start(dst, &p, r);
+        int len = run_length(&p, r);
+        for (int j = 0; j < len; j++) {
+            d[j] = f(s[j]);
         }
     }
 }
 
-void matrix_multiply_elementwise(matrix *mat1, matrix *mat2, matrix *dst) {
-    assert(same_size(mat1, mat2) && same_size(mat1, dst));
-    for (int i = 0; i < dst->dim.rows; i++) {
-        for (int j = 0; j < dst->dim.cols; j++) {
-            dst->data[i][j] = mat1->data[i][j] * mat2->data[i][j];
-        }
+// Transcendentals cost tens of cycles per element, so they go parallel sooner
+#define MATH_PARALLEL_MIN (1 << 13)
+
+/* dst = f(mat) elementwise through the vectorized math library (see math_func) */
+void apply_math(matrix* mat, matrix* dst, math_func f) {
+    assert(same_size(mat, dst) && f >= 0 && f < MATH_FUNC_COUNT);
+    static const char *names[MATH_FUNC_COUNT] = {"exp", "log", "tanh", "sigmoid", "relu", "abs"};
+    COUNT_OP(OP_MATH);
+    TRACE_SCOPE("matrix", "math", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(names[f]);
+    void (*kernel)(const float *, float *, int) = kernels->math[f];
+    run_plan p = plan_runs(dst, mat, NULL);
+    #pragma omp parallel for if (p.total >= MATH_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        kernel(run_start(mat, &p, r), run_start(dst, &p, r), run_length(&p, r));
+    }
+}
+
+/* dst = mat ^ exponent elementwise */
+void matrix_pow_elementwise(matrix *mat, float exponent, matrix *dst) {
+    assert(same_size(mat, dst));
+    COUNT_OP(OP_POW_ELEMENTWISE);
+    TRACE_SCOPE("matrix", "pow_elementwise", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = plan_runs(dst, mat, NULL);
+    #pragma omp parallel for if (p.total >= MATH_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        kernels->pow(run_start(mat, &p, r), exponent, run_start(dst, &p, r), run_length(&p, r));
+    }
+}
+
+/*
+ * Batched forms over count matrices stacked along the rows. matrix_batch_add
+ * adds mat2 to each block of mat1 when mat2 is a single block (and is a
+ * plain add otherwise); matrix_batch_scale scales block i by scalars[i].
+ */
+void matrix_batch_add(matrix *mat1, matrix *mat2, int count, matrix *dst) {
+    assert(count > 0 && mat1->dim.rows % count == 0 && same_size(mat1, dst));
+    COUNT_OP(OP_BATCH_ADD);
+    TRACE_SCOPE("matrix", "batch_add", dst->dim.rows, dst->dim.cols, 0);
+    int m = mat1->dim.rows / count, cols = mat1->dim.cols;
+    if (mat2->dim.rows == mat1->dim.rows) {
+        matrix_add(mat1, mat2, dst);
+        return;
+    }
+    assert(mat2->dim.rows == m && mat2->dim.cols == cols);
+    #pragma omp parallel for if ((double) mat1->dim.rows * cols >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < mat1->dim.rows; r++) {
+        kernels->add(MAT_ROW(mat1, r), MAT_ROW(mat2, r % m), MAT_ROW(dst, r), cols);
+    }
+}
+
+void matrix_batch_scale(matrix *mat, const float *scalars, int count, matrix *dst) {
+    assert(count > 0 && mat->dim.rows % count == 0 && same_size(mat, dst));
+    COUNT_OP(OP_BATCH_SCALE);
+    TRACE_SCOPE("matrix", "batch_scale", dst->dim.rows, dst->dim.cols, 0);
+    int m = mat->dim.rows / count, cols = mat->dim.cols;
+    #pragma omp parallel for if ((double) mat->dim.rows * cols >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < mat->dim.rows; r++) {
+        kernels->scale(MAT_ROW(mat, r), scalars[r / m], MAT_ROW(dst, r), cols);
+    }
+}
+
+/*
+ * 16-bit matrices. Elementwise ops and conversions walk the same runs as the
+ * float ones, widening HALF_CHUNK elements at a time into stack buffers that
+ * stay in L1, running the float kernel on them and narrowing the result back.
+ */
+#define HALF_CHUNK 1024
+
+static const char *half_format_names[HALF_FORMAT_COUNT] = {"fp16", "bf16"};
+
+const char *half_format_name(half_format format) {
+    return half_format_names[format];
+}
+
+int allocate_matrix16(matrix16 **mat, int rows, int cols, half_format format) {
+    matrix16 *m = malloc(sizeof(matrix16));
+    if (m == NULL) {
+        return -1;
+    }
+    m->dim.rows = rows;
+    m->dim.cols = cols;
+    m->stride = padded_stride(cols, sizeof(uint16_t));
+    m->format = format;
+    m->buf = pool_alloc((size_t) rows * m->stride * sizeof(uint16_t), 1);
+    if (m->buf == NULL) {
+        free(m);
+        return -1;
+    }
+    m->data = m->buf;
+    *mat = m;
+    return 0;
+}
+
+int wrap_matrix16(matrix16 **mat, uint16_t *data, int rows, int cols, int stride, half_format format) {
+    assert(stride >= cols);
+    matrix16 *m = malloc(sizeof(matrix16));
+    if (m == NULL) {
+        return -1;
+    }
+    m->dim.rows = rows;
+    m->dim.cols = cols;
+    m->stride = stride;
+    m->format = format;
+    m->data = data;
+    m->buf = NULL;
+    *mat = m;
+    return 0;
+}
+
+void free_matrix16(matrix16 *mat) {
+    pool_free(mat->buf);
+    free(mat);
+}
+
+static int is_dense16(matrix16 *mat) {
+    return mat == NULL || mat->stride == mat->dim.cols;
+}
+
+// Runs over rows x cols elements: one per row, or fixed length ones if every operand is dense
+static run_plan plan_runs16(int rows, int cols, int dense) {
+    run_plan p;
+    p.total = (size_t) rows * cols;
+    p.dense = dense;
+    if (dense) {
+        p.len = ELEMENTWISE_CHUNK;
+        p.count = (int) ((p.total + ELEMENTWISE_CHUNK - 1) / ELEMENTWISE_CHUNK);
+    } else {
+        p.len = cols;
+        p.count = rows;
+    }
+    return p;
+}
+
+static inline size_t run_offset(run_plan *p, int r, int stride) {
+    return p->dense ? (size_t) r * p->len : (size_t) r * stride;
+}
+
+void matrix16_from_float(matrix *src, matrix16 *dst) {
+    assert(src->dim.rows == dst->dim.rows && src->dim.cols == dst->dim.cols);
+    COUNT_OP(OP_COPY);
+    TRACE_SCOPE("matrix", "to_half", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(dst->format));
+    const matrix_kernels *k = kernels;
+    run_plan p = plan_runs16(dst->dim.rows, dst->dim.cols, is_dense(src) && is_dense16(dst));
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        narrow(k, dst->format, src->data + run_offset(&p, r, src->stride), dst->data + run_offset(&p, r, dst->stride),
+               run_length(&p, r));
     }
 }
 
-void matrix_add(matrix *mat1, matrix *mat2, matrix *dst) {
-    assert(same_size(mat1, mat2) && same_size(mat1, dst));
-    for (int i = 0; i < dst->dim.rows; i++) {
-        for (int j = 0; j < dst->dim.cols; j++) {
-            dst->data[i][j] = mat1->data[i][j] + mat2->data[i][j];
+void matrix16_to_float(matrix16 *src, matrix *dst) {
+    assert(src->dim.rows == dst->dim.rows && src->dim.cols == dst->dim.cols);
+    COUNT_OP(OP_COPY);
+    TRACE_SCOPE("matrix", "from_half", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(src->format));
+    const matrix_kernels *k = kernels;
+    run_plan p = plan_runs16(dst->dim.rows, dst->dim.cols, is_dense16(src) && is_dense(dst));
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        widen(k, src->format, src->data + run_offset(&p, r, src->stride), dst->data + run_offset(&p, r, dst->stride),
+              run_length(&p, r));
+    }
+}
+
+typedef enum half_op {
+    HALF_ADD,
+    HALF_SUB,
+    HALF_MUL,
+    HALF_SCALE,
+} half_op;
+
+static void half_elementwise(half_op op, matrix16 *mat1, matrix16 *mat2, float scalar, matrix16 *dst) {
+    const matrix_kernels *k = kernels;
+    run_plan p = plan_runs16(dst->dim.rows, dst->dim.cols, is_dense16(dst) && is_dense16(mat1) && is_dense16(mat2));
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        float a[HALF_CHUNK] __attribute__((aligned(MATRIX_ALIGN)));
+        float b[HALF_CHUNK] __attribute__((aligned(MATRIX_ALIGN)));
+        int len = run_length(&p, r);
+        const uint16_t *src1 = mat1->data + run_offset(&p, r, mat1->stride);
+        const uint16_t *src2 = op == HALF_SCALE ? NULL : mat2->data + run_offset(&p, r, mat2->stride);
+        uint16_t *out = dst->data + run_offset(&p, r, dst->stride);
+        for (int j = 0; j < len; j += HALF_CHUNK) {
+            int n = min_int(HALF_CHUNK, len - j);
+            widen(k, mat1->format, src1 + j, a, n);
+            if (op != HALF_SCALE) {
+                widen(k, mat2->format, src2 + j, b, n);
+            }
+            switch (op) {
+            case HALF_ADD:
+                k->add(a, b, a, n);
+                break;
+            case HALF_SUB:
+                k->sub(a, b, a, n);
+                break;
+            case HALF_MUL:
+                k->mul(a, b, a, n);
+                break;
+            case HALF_SCALE:
+                k->scale(a, scalar, a, n);
+                break;
+            }
+            narrow(k, dst->format, a, out + j, n);
         }
     }
 }
 
-void matrix_transpose(matrix *m, matrix *dst) {
-    assert(m->dim.rows == dst->dim.cols && m->dim.cols == dst->dim.rows);
-    for (int i = 0; i < dst->dim.rows; i++) {
-        for (int j = 0; j < dst->dim.cols; j++) {
-            dst->data[i][j] = m->data[j][i];
+static inline int same_size16(matrix16 *mat1, matrix16 *mat2) {
+    return mat1->dim.rows == mat2->dim.rows && mat1->dim.cols == mat2->dim.cols;
+}
+
+void matrix16_add(matrix16 *mat1, matrix16 *mat2, matrix16 *dst) {
+    assert(same_size16(mat1, mat2) && same_size16(mat1, dst));
+    COUNT_OP(OP_ADD);
+    TRACE_SCOPE("matrix", "add", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(dst->format));
+    half_elementwise(HALF_ADD, mat1, mat2, 0, dst);
+}
+
+void matrix16_sub(matrix16 *mat1, matrix16 *mat2, matrix16 *dst) {
+    assert(same_size16(mat1, mat2) && same_size16(mat1, dst));
+    COUNT_OP(OP_SUB);
+    TRACE_SCOPE("matrix", "sub", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(dst->format));
+    half_elementwise(HALF_SUB, mat1, mat2, 0, dst);
+}
+
+void matrix16_multiply_elementwise(matrix16 *mat1, matrix16 *mat2, matrix16 *dst) {
+    assert(same_size16(mat1, mat2) && same_size16(mat1, dst));
+    COUNT_OP(OP_MULTIPLY_ELEMENTWISE);
+    TRACE_SCOPE("matrix", "multiply_elementwise", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(dst->format));
+    half_elementwise(HALF_MUL, mat1, mat2, 0, dst);
+}
+
+void matrix16_scale(matrix16 *mat, float scalar, matrix16 *dst) {
+    assert(same_size16(mat, dst));
+    COUNT_OP(OP_SCALE);
+    TRACE_SCOPE("matrix", "scale", dst->dim.rows, dst->dim.cols, 0);
+    TRACE_DETAIL(half_format_name(dst->format));
+    half_elementwise(HALF_SCALE, mat, NULL, scalar, dst);
+}
+
+/* Elements [i, i + n) of a 16-bit vector as floats */
+static void widen_vector(const matrix_kernels *k, matrix16 *vec, int i, int n, float *dst) {
+    if (vec->stride == 1) {
+        widen(k, vec->format, vec->data + i, dst, n);
+        return;
+    }
+    for (int r = 0; r < n; r++) {
+        widen(k, vec->format, MAT_ROW(vec, i + r), dst + r, 1);
+    }
+}
+
+void matrix16_dot_product(matrix16 *vec1, matrix16 *vec2, float *result) {
+    assert(same_size16(vec1, vec2) && vec1->dim.cols == 1);
+    COUNT_OP(OP_DOT);
+    TRACE_SCOPE("matrix", "dot", vec1->dim.rows, 1, 0);
+    TRACE_DETAIL(half_format_name(vec1->format));
+    const matrix_kernels *k = kernels;
+    float a[HALF_CHUNK] __attribute__((aligned(MATRIX_ALIGN)));
+    float b[HALF_CHUNK] __attribute__((aligned(MATRIX_ALIGN)));
+    float sum = 0;
+    for (int i = 0; i < vec1->dim.rows; i += HALF_CHUNK) {
+        int n = min_int(HALF_CHUNK, vec1->dim.rows - i);
+        widen_vector(k, vec1, i, n, a);
+        widen_vector(k, vec2, i, n, b);
+        sum += k->dot(a, b, n);
+    }
+    *result = sum;
+}
+
+/*
+ * Products with a 16-bit operand. Large ones are the packed GEMM, which
+ * widens while packing. Skinny ones stream the big operand like
+ * gemm_skinny_cols / gemm_skinny_rows do, widening GEMM_SKINNY_CHUNK elements
+ * of a row at a time, so a matrix-vector product with 16-bit weights moves
+ * half the bytes of the float one.
+ */
+static void half_skinny_cols(gemm_operand mat1, gemm_operand mat2, matrix *dst) {
+    int m = dst->dim.rows, n = dst->dim.cols, k = operand_dim(mat1).cols;
+    const matrix_kernels *kern = kernels;
+    float *cols = alloc_aligned((size_t) n * k);
+    assert(cols != NULL);
+    for (int p = 0; p < k; p++) {
+        float scratch[GEMM_SKINNY_MAX];
+        const float *row = operand_row(kern, mat2, p, 0, n, scratch);
+        for (int j = 0; j < n; j++) {
+            cols[(size_t) j * k + p] = row[j];
         }
     }
+    #pragma omp parallel if ((double) m * k >= ELEMENTWISE_PARALLEL_MIN)
+    {
+        TRACE_SCOPE("thread", "skinny_cols", m, n, k);
+        float *scratch = alloc_aligned(GEMM_SKINNY_CHUNK);
+        assert(scratch != NULL);
+        #pragma omp for schedule(static) nowait
+        for (int i = 0; i < m; i++) {
+            float sums[GEMM_SKINNY_MAX] = {0};
+            for (int pc = 0; pc < k; pc += GEMM_SKINNY_CHUNK) {
+                int kc = min_int(GEMM_SKINNY_CHUNK, k - pc);
+                const float *a = operand_row(kern, mat1, i, pc, kc, scratch);
+                for (int j = 0; j < n; j++) {
+                    sums[j] += kern->dot(a, cols + (size_t) j * k + pc, kc);
+                }
+            }
+            memcpy(MAT_ROW(dst, i), sums, n * sizeof(float));
+        }
+        pool_free(scratch);
+    }
+    pool_free(cols);
 }
 
-void copy(matrix *src, matrix *dst) {
-    assert(same_size(src, dst));
-    for (int i = 0; i < src->dim.rows; i++) {
-        for (int j = 0; j < src->dim.cols; j++) {
-            dst->data[i][j] = src->data[i][j];
+static void half_skinny_rows(gemm_operand mat1, gemm_operand mat2, matrix *dst) {
+    int m = dst->dim.rows, n = dst->dim.cols, k = operand_dim(mat1).cols;
+    const matrix_kernels *kern = kernels;
+    // The few rows of mat1 as floats, so its elements can be read one by one
+    float *rows = alloc_aligned((size_t) m * k);
+    assert(rows != NULL);
+    for (int i = 0; i < m; i++) {
+        const float *row = operand_row(kern, mat1, i, 0, k, rows + (size_t) i * k);
+        if (row != rows + (size_t) i * k) {
+            memcpy(rows + (size_t) i * k, row, k * sizeof(float));
         }
     }
+    #pragma omp parallel if ((double) n * k >= ELEMENTWISE_PARALLEL_MIN)
+    {
+        TRACE_SCOPE("thread", "skinny_rows", m, n, k);
+        float *scratch = alloc_aligned(GEMM_SKINNY_CHUNK);
+        assert(scratch != NULL);
+        #pragma omp for schedule(static) nowait
+        for (int jc = 0; jc < n; jc += GEMM_SKINNY_CHUNK) {
+            int nc = min_int(GEMM_SKINNY_CHUNK, n - jc);
+            for (int i = 0; i < m; i++) {
+                memset(MAT_ROW(dst, i) + jc, 0, nc * sizeof(float));
+            }
+            for (int p = 0; p < k; p++) {
+                const float *b = operand_row(kern, mat2, p, jc, nc, scratch);
+                for (int i = 0; i < m; i++) {
+                    kern->axpy(rows[(size_t) i * k + p], b, MAT_ROW(dst, i) + jc, nc);
+                }
+            }
+        }
+        pool_free(scratch);
+    }
+    pool_free(rows);
+}
+
+static void multiply_operands(gemm_operand mat1, gemm_operand mat2, matrix *dst) {
+    shape a = operand_dim(mat1);
+    assert(a.cols == operand_dim(mat2).rows && dst->dim.rows == a.rows && dst->dim.cols == operand_dim(mat2).cols);
+    COUNT_OP(OP_MULTIPLY);
+    TRACE_SCOPE("matrix", "multiply", dst->dim.rows, dst->dim.cols, a.cols);
+    if (a.cols > 0 && dst->dim.cols <= GEMM_SKINNY_MAX) {
+        TRACE_DETAIL("half_skinny_cols");
+        half_skinny_cols(mat1, mat2, dst);
+    } else if (a.cols > 0 && dst->dim.rows <= GEMM_SKINNY_MAX) {
+        TRACE_DETAIL("half_skinny_rows");
+        half_skinny_rows(mat1, mat2, dst);
+    } else {
+        TRACE_DETAIL("half_gemm");
+        gemm_operands(mat1, mat2, dst);
+    }
+}
+
+void matrix16_multiply(matrix16 *mat1, matrix16 *mat2, matrix *dst) {
+    multiply_operands((gemm_operand) {NULL, mat1}, (gemm_operand) {NULL, mat2}, dst);
 }
 
+void matrix16_multiply_float(matrix16 *mat1, matrix *mat2, matrix *dst) {
+    assert(dst != mat2);
+    multiply_operands((gemm_operand) {NULL, mat1}, (gemm_operand) {mat2, NULL}, dst);
+}
+
+void matrix_multiply_half(matrix *mat1, matrix16 *mat2, matrix *dst) {
+    assert(dst != mat1);
+    multiply_operands((gemm_operand) {mat1, NULL}, (gemm_operand) {NULL, mat2}, dst);
+}
 
 int get_rows(matrix *mat) {
     return mat->dim.rows;
@@ -206,36 +867,22 @@ int get_cols(matrix *mat) {
 }
 
 void get_matrix_as_array(float *arr, matrix *mat) {
-    int i, j, k = 0;
-    for (i = 0; i < mat->dim.rows; i++) {
-        for (j = 0; j < mat->dim.cols; j++) {
-            arr[k] = mat->data[i][j];
-            k++;
-        }
+    int cols = mat->dim.cols;
+    if (mat->stride == cols) {
+        memcpy(arr, mat->data, (size_t) mat->dim.rows * cols * sizeof(float));
+        return;
+    }
+    for (int i = 0; i < mat->dim.rows; i++) {
+        memcpy(arr + (size_t) i * cols, MAT_ROW(mat, i), cols * sizeof(float));
     }
 }
 
 matrix* arr_to_matrix(float *arr, int rows, int cols) {
     matrix *m;
-    allocate_matrix(&m, rows, cols);
+    allocate_matrix_uninit(&m, rows, cols);
     #pragma omp parallel for 
     for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            set_loc(m, i, j, arr[i*cols + j]);
-        }
+        memcpy(MAT_ROW(m, i), arr + (size_t) i * cols, cols * sizeof(float));
     }
     return m;
 }
-
-void set_loc(matrix *mat, int row, int col, float val) {
-    assert (row < mat->dim.rows && col < mat->dim.cols && row >= 0 && col >= 0);
-    mat->data[row][col] = val;
-}
-
-int same_size(matrix *mat1, matrix *mat2) {
-    return mat1 && mat2 && mat1->dim.rows == mat2->dim.rows && mat1->dim.cols == mat2->dim.cols;
-}
-
-float get_loc(matrix *mat, int row, int col) {
-    return mat->data[row][col];
-}
\ No newline at end of file
@@ -1,30 +1,125 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 
+// Every matrix buffer starts on a 64 byte boundary and rows are padded to a
+// multiple of MATRIX_SIMD_FLOATS so each row starts on one as well
+#define MATRIX_ALIGN 64
+#define MATRIX_SIMD_FLOATS (MATRIX_ALIGN / (int) sizeof(float))
+
 typedef struct shape {
     int rows;
     int cols;
 } shape;
 
+/*
+ * Row-major storage in a single allocation.
+ * Element (i, j) lives at data[i * stride + j]; the stride >= cols padding
+ * at the end of each row is never read by the kernels.
+ * Views (view_matrix) point into another matrix's storage with its stride,
+ * or a multiple of it; their buf is NULL and their padding is not theirs.
+ */
 typedef struct matrix {
     shape dim;
-    float** data;
+    int stride;
+    float* data;
+    void* buf;
 } matrix;
 
+/*
+ * The same layout with double elements (rows padded to 64 bytes as well).
+ * Its operations are the float ones instantiated for double from one source
+ * (matrix_ops.h), on the double kernels of the selected ISA: the products
+ * accumulate in double, which long matrix_power chains and large dot
+ * products need.
+ */
+typedef struct matrix64 {
+    shape dim;
+    int stride;
+    double* data;
+    void* buf;
+} matrix64;
+
+// Elementwise functions of the vectorized math library, see apply_math()
+typedef enum math_func {
+    MATH_EXP,
+    MATH_LOG,
+    MATH_TANH,
+    MATH_SIGMOID,
+    MATH_RELU,
+    MATH_ABS,
+    MATH_FUNC_COUNT
+} math_func;
+
+// Pointer to the first element of row i
+#define MAT_ROW(mat, i) ((mat)->data + (size_t) (i) * (mat)->stride)
+
+// 16-bit storage formats: IEEE binary16, and bfloat16 (the top half of a float)
+typedef enum half_format {
+    HALF_FP16,
+    HALF_BF16,
+    HALF_FORMAT_COUNT
+} half_format;
+
+/*
+ * A matrix of 16-bit floats, laid out like matrix with rows padded to 64
+ * bytes. Half the memory traffic of float: the operations on it widen values
+ * to float as they load them, a cache sized chunk at a time, accumulate in
+ * float and round results to nearest even as they store them.
+ */
+typedef struct matrix16 {
+    shape dim;
+    int stride;
+    half_format format;
+    uint16_t* data;
+    void* buf;
+} matrix16;
+
+// Stride allocate_matrix uses for a row of cols floats
+int row_stride(int cols);
 int allocate_matrix(matrix **mat, int rows, int cols);
 int allocate_matrix_s(matrix **mat, shape s);
+int allocate_matrix_uninit(matrix **mat, int rows, int cols);
+/*
+ * Freed buffers are cached for reuse, up to a limit in bytes (set_pool_limit
+ * returns the previous one). trim_pool frees the cache and returns its size.
+ */
+size_t set_pool_limit(size_t bytes);
+size_t trim_pool(void);
+int wrap_matrix(matrix **mat, float *data, int rows, int cols, int stride);
+int view_matrix(matrix **view, matrix *parent, int row, int col, int rows, int cols, int row_step);
 int eye(matrix **mat, shape s);
 void free_matrix(matrix *mat);
 void dot_product(matrix *vec1, matrix *vec2, float *result);
 void outer_product(matrix *vec1, matrix *vec2, matrix *dst);
 void matrix_power(matrix *mat, int pow, matrix *dst);
 void matrix_multiply(matrix *mat1, matrix *mat2, matrix *dst);
+/*
+ * Square products at least this size use Strassen-Winograd (0 disables it,
+ * small values are raised to a minimum). Returns the previous crossover.
+ */
+int set_strassen_crossover(int n);
+/*
+ * Batches of count matrices stacked along the rows (block i is rows
+ * [i * rows / count, (i + 1) * rows / count)). mat2 of the multiply and add
+ * may also be a single block shared by the whole batch.
+ */
+void matrix_batch_multiply(matrix *mat1, matrix *mat2, int count, matrix *dst);
+void matrix_batch_add(matrix *mat1, matrix *mat2, int count, matrix *dst);
+void matrix_batch_scale(matrix *mat, const float *scalars, int count, matrix *dst);
 void matrix_scale(matrix *mat, float scalar, matrix *dst);
+void fill_matrix(matrix *mat, float val);
 void apply_func(matrix* mat, matrix* dst, float (*f)(float));
+void apply_math(matrix* mat, matrix* dst, math_func f);
+void matrix_pow_elementwise(matrix *mat, float exponent, matrix *dst);
 void matrix_add(matrix *mat1, matrix *mat2, matrix *dst);
+void matrix_sub(matrix *mat1, matrix *mat2, matrix *dst);
 void matrix_multiply_elementwise(matrix *mat1, matrix *mat2, matrix *dst);
 void matrix_transpose(matrix *m, matrix *dst);
 void copy(matrix *src, matrix *dst);
@@ -37,3 +132,49 @@ matrix* arr_to_matrix(float *arr, int rows, int cols);
 float get_loc(matrix *mat, int row, int col);
 void matrix_transpose(matrix* m, matrix* dst);
 
+int allocate_matrix16(matrix16 **mat, int rows, int cols, half_format format);
+// Like wrap_matrix: free_matrix16 frees only the header
+int wrap_matrix16(matrix16 **mat, uint16_t *data, int rows, int cols, int stride, half_format format);
+void free_matrix16(matrix16 *mat);
+const char *half_format_name(half_format format);
+void matrix16_from_float(matrix *src, matrix16 *dst);
+void matrix16_to_float(matrix16 *src, matrix *dst);
+// dst may be in either format and may be one of the operands
+void matrix16_add(matrix16 *mat1, matrix16 *mat2, matrix16 *dst);
+void matrix16_sub(matrix16 *mat1, matrix16 *mat2, matrix16 *dst);
+void matrix16_multiply_elementwise(matrix16 *mat1, matrix16 *mat2, matrix16 *dst);
+void matrix16_scale(matrix16 *mat, float scalar, matrix16 *dst);
+void matrix16_dot_product(matrix16 *vec1, matrix16 *vec2, float *result);
+/*
+ * Products with 16-bit operands and a float result: 16-bit by 16-bit, 16-bit
+ * weights times float activations (W x), and float times 16-bit (x W).
+ */
+void matrix16_multiply(matrix16 *mat1, matrix16 *mat2, matrix *dst);
+void matrix16_multiply_float(matrix16 *mat1, matrix *mat2, matrix *dst);
+void matrix_multiply_half(matrix *mat1, matrix16 *mat2, matrix *dst);
+
+// The float32 operations of the same name for matrix64
+int allocate_matrix64(matrix64 **mat, int rows, int cols);
+int allocate_matrix_s64(matrix64 **mat, shape s);
+int allocate_matrix_uninit64(matrix64 **mat, int rows, int cols);
+int wrap_matrix64(matrix64 **mat, double *data, int rows, int cols, int stride);
+int view_matrix64(matrix64 **view, matrix64 *parent, int row, int col, int rows, int cols, int row_step);
+void free_matrix64(matrix64 *mat);
+void dot_product64(matrix64 *vec1, matrix64 *vec2, double *result);
+void outer_product64(matrix64 *vec1, matrix64 *vec2, matrix64 *dst);
+void matrix_power64(matrix64 *mat, int pow, matrix64 *dst);
+void matrix_multiply64(matrix64 *mat1, matrix64 *mat2, matrix64 *dst);
+void matrix_scale64(matrix64 *mat, double scalar, matrix64 *dst);
+void fill_matrix64(matrix64 *mat, double val);
+void matrix_add64(matrix64 *mat1, matrix64 *mat2, matrix64 *dst);
+void matrix_sub64(matrix64 *mat1, matrix64 *mat2, matrix64 *dst);
+void matrix_multiply_elementwise64(matrix64 *mat1, matrix64 *mat2, matrix64 *dst);
+void matrix_transpose64(matrix64 *m, matrix64 *dst);
+void copy64(matrix64 *src, matrix64 *dst);
+int same_size64(matrix64 *mat1, matrix64 *mat2);
+void set_loc64(matrix64 *mat, int row, int col, double val);
+double get_loc64(matrix64 *mat, int row, int col);
+void matrix_to_double(matrix *src, matrix64 *dst);
+void matrix64_to_float(matrix64 *src, matrix *dst);
+
+#endif
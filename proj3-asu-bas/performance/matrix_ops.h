@@ -0,0 +1,722 @@
+/*
+ * Matrix operations shared by every element type. matrix.c includes this
+ * file once per type after defining:
+ *   REAL                the element type
+ *   MATRIX              its matrix struct (matrix, matrix64)
+ *   MATRIX_SUFFIX       appended to every function name (nothing for float, 64)
+ *   MATRIX_KERNELS_T    its kernel table type and MATRIX_KERNELS, the
+ *                       pointer to the selected table
+ *   MATRIX_TRACE_CAT    trace category of the public ops
+ *   MATRIX_OPERAND      an operand of the packed GEMM, with
+ *                       MATRIX_OPERAND_OF(mat) making one of a MATRIX,
+ *                       MATRIX_OPERAND_COLS(op) its column count and
+ *                       MATRIX_PACK_A(k, mc, kc, op, row, col, packed) /
+ *                       MATRIX_PACK_B(k, kc, nc, op, row, col, packed)
+ *                       packing the block at (row, col) like gemm_pack_a/_b
+ * along with the shared pieces before the first include (pool_alloc,
+ * padded_stride, min_int, run_plan, strassen_crossover). The float operand
+ * can also be a 16-bit matrix, widened while packing; the double one is a
+ * plain matrix64. Everything is #undef'd again at the bottom; the blocking
+ * constants stay defined for the float-only code after it.
+ */
+
+#define MATRIX_CAT_(name, suffix) name##suffix
+#define MATRIX_CAT(name, suffix) MATRIX_CAT_(name, suffix)
+#define MNAME(name) MATRIX_CAT(name, MATRIX_SUFFIX)
+
+static int MNAME(new_matrix)(MATRIX **mat, int rows, int cols, int zero) {
+    MATRIX *m = malloc(sizeof(MATRIX));
+    if (m == NULL) {
+        return -1;
+    }
+    m->dim.rows = rows;
+    m->dim.cols = cols;
+    m->stride = padded_stride(cols, sizeof(REAL));
+    // One block holds every row
+    m->buf = pool_alloc((size_t) rows * m->stride * sizeof(REAL), zero);
+    if (m->buf == NULL) {
+        free(m);
+        return -1;
+    }
+    m->data = m->buf;
+    *mat = m;
+    return 0;
+}
+
+/*
+    called like:
+    ```c
+    matrix mat;
+    allocate_matrix(&mat, 1, 2);
+    ```
+*/
+int MNAME(allocate_matrix)(MATRIX **mat, int rows, int cols) {
+    return MNAME(new_matrix)(mat, rows, cols, 1);
+}
+
+int MNAME(allocate_matrix_s)(MATRIX **mat, shape s) {
+    return MNAME(allocate_matrix)(mat, s.rows, s.cols);
+}
+
+// For results that overwrite every element: the contents (and padding) are garbage
+int MNAME(allocate_matrix_uninit)(MATRIX **mat, int rows, int cols) {
+    return MNAME(new_matrix)(mat, rows, cols, 0);
+}
+
+/*
+ * Wraps memory owned by someone else: element (i, j) is data[i * stride + j].
+ * free_matrix frees only the header, never data.
+ */
+int MNAME(wrap_matrix)(MATRIX **mat, REAL *data, int rows, int cols, int stride) {
+    assert(stride >= cols);
+    MATRIX *m = malloc(sizeof(MATRIX));
+    if (m == NULL) {
+        return -1;
+    }
+    m->dim.rows = rows;
+    m->dim.cols = cols;
+    m->stride = stride;
+    m->data = data;
+    m->buf = NULL;
+    *mat = m;
+    return 0;
+}
+
+/*
+ * A rows x cols window of parent starting at (row, col), taking every
+ * row_step-th row. It shares parent's storage, so parent must outlive it.
+ */
+int MNAME(view_matrix)(MATRIX **view, MATRIX *parent, int row, int col, int rows, int cols, int row_step) {
+    assert(row >= 0 && col >= 0 && row_step >= 1 && col + cols <= parent->dim.cols);
+    assert(rows == 0 || row + (rows - 1) * row_step < parent->dim.rows);
+    return MNAME(wrap_matrix)(view, parent->data + (size_t) row * parent->stride + col, rows, cols, parent->stride * row_step);
+}
+
+void MNAME(free_matrix)(MATRIX *mat) {
+    pool_free(mat->buf);
+    free(mat);
+}
+
+/*
+ * A view of a column of a wider matrix is a vector whose elements are a whole
+ * row stride apart; the dense kernels need them packed.
+ */
+static REAL *MNAME(packed_vector)(MATRIX *vec, REAL **scratch) {
+    *scratch = NULL;
+    if (vec->stride == 1 || vec->dim.rows <= 1) {
+        return vec->data;
+    }
+    *scratch = malloc((size_t) vec->dim.rows * sizeof(REAL));
+    assert(*scratch != NULL);
+    for (int i = 0; i < vec->dim.rows; i++) {
+        (*scratch)[i] = MAT_ROW(vec, i)[0];
+    }
+    return *scratch;
+}
+
+void MNAME(dot_product)(MATRIX *vec1, MATRIX *vec2, REAL *result) {
+    assert(MNAME(same_size)(vec1, vec2) && vec1->dim.cols == 1);
+    COUNT_OP(OP_DOT);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "dot", vec1->dim.rows, 1, 0);
+    REAL *s1, *s2;
+    REAL *a = MNAME(packed_vector)(vec1, &s1), *b = MNAME(packed_vector)(vec2, &s2);
+    *result = MATRIX_KERNELS->dot(a, b, vec1->dim.rows);
+    free(s1);
+    free(s2);
+}
+
+void MNAME(outer_product)(MATRIX *vec1, MATRIX *vec2, MATRIX *dst) {
+    assert(vec1->dim.cols == 1 && vec2->dim.cols == 1 && vec1->dim.rows == dst->dim.rows && vec2->dim.rows == dst->dim.cols);
+    COUNT_OP(OP_OUTER);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "outer", dst->dim.rows, dst->dim.cols, 0);
+    REAL *scratch;
+    REAL *b = MNAME(packed_vector)(vec2, &scratch);
+    #pragma omp parallel for if ((double) dst->dim.rows * dst->dim.cols >= ELEMENTWISE_PARALLEL_MIN)
+    for (int i = 0; i < vec1->dim.rows; i++) {
+        REAL a = MAT_ROW(vec1, i)[0];
+        REAL *d = MAT_ROW(dst, i);
+        for (int j = 0; j < vec2->dim.rows; j++) {
+            d[j] = a * b[j];
+        }
+    }
+    free(scratch);
+}
+
+/*
+ * Left-to-right binary exponentiation: starting from mat itself, every
+ * remaining bit of pow squares the running product and set bits multiply it
+ * by mat once more, so pow = 2^b costs b products instead of pow. Products
+ * ping-pong between dst and one scratch matrix; the parity of the product
+ * count picks which one goes first, so the last product lands in dst without
+ * a copy.
+ */
+void MNAME(matrix_power)(MATRIX *mat, int pow, MATRIX *dst) {
+    assert(mat != dst && MNAME(same_size)(mat, dst) && mat->dim.rows == mat->dim.cols && pow >= 0);
+    COUNT_OP(OP_POWER);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "power", dst->dim.rows, dst->dim.cols, pow);
+    if (pow == 0) {
+        for (int i = 0; i < dst->dim.rows; i++) {
+            REAL *d = MAT_ROW(dst, i);
+            memset(d, 0, dst->dim.cols * sizeof(REAL));
+            d[i] = 1;
+        }
+        return;
+    }
+    if (pow == 1) {
+        MNAME(copy)(mat, dst);
+        return;
+    }
+
+    int top = 31 - __builtin_clz(pow);
+    int products = top + __builtin_popcount(pow) - 1;
+    MATRIX *scratch = NULL;
+    if (products > 1 && MNAME(allocate_matrix_uninit)(&scratch, dst->dim.rows, dst->dim.cols) != 0) {
+        return;
+    }
+
+    MATRIX *cur = mat;
+    MATRIX *next = (products % 2) ? dst : scratch;
+    for (int bit = top - 1; bit >= 0; bit--) {
+        MNAME(matrix_multiply)(cur, cur, next);
+        cur = next;
+        next = (cur == dst) ? scratch : dst;
+        if (pow & (1 << bit)) {
+            MNAME(matrix_multiply)(cur, mat, next);
+            cur = next;
+            next = (cur == dst) ? scratch : dst;
+        }
+    }
+    if (scratch != NULL) {
+        MNAME(free_matrix)(scratch);
+    }
+}
+
+/*
+ * Blocked GEMM in the Goto/BLIS layout. dst is walked in GEMM_NC wide column
+ * panels; for each one a GEMM_KC x GEMM_NC slab of mat2 is packed into nr wide
+ * slivers, then GEMM_MC x GEMM_KC blocks of mat1 are packed into mr tall
+ * slivers and fed to the register-tiled micro-kernel of the selected ISA
+ * (mr x nr is 6x8 on SSE2, 6x16 on AVX2, 12x32 on AVX-512 for float, half as
+ * wide for double). The blocks are sized so an A sliver stays in L1, the
+ * packed A block in L2 and the packed B slab in L3 for float; double slivers
+ * and blocks take twice the bytes and spill one level sooner. Packing zero-fills ragged edges, so the micro-kernel always runs
+ * on a full tile. GEMM_MC, GEMM_NC and GEMM_TILE_N are multiples of every
+ * variant's mr / nr.
+ */
+#define GEMM_KC 256
+#define GEMM_MC 120
+#define GEMM_NC 3072
+// Width of the dst tiles the threads are scheduled over
+#define GEMM_TILE_N 256
+// Below this many multiply-adds a product is not worth waking the thread team
+#define GEMM_PARALLEL_MIN_FLOPS (64.0 * 64 * 64)
+
+static REAL *MNAME(alloc_aligned)(size_t count) {
+    return pool_alloc(count * sizeof(REAL), 0);
+}
+
+/* Packs rows [0, kc) x cols [0, nc) of b into kc x nr slivers */
+static void MNAME(gemm_pack_b)(int kc, int nc, int nr, const REAL *b, int ldb, REAL *packed) {
+    for (int j = 0; j < nc; j += nr) {
+        int width = min_int(nr, nc - j);
+        for (int p = 0; p < kc; p++) {
+            const REAL *src = b + (size_t) p * ldb + j;
+            memcpy(packed, src, width * sizeof(REAL));
+            for (int q = width; q < nr; q++) {
+                packed[q] = 0;
+            }
+            packed += nr;
+        }
+    }
+}
+
+/* Packs rows [0, mc) x cols [0, kc) of a into mr x kc slivers, column by column */
+static void MNAME(gemm_pack_a)(int mc, int kc, int mr, const REAL *a, int lda, REAL *packed) {
+    for (int i = 0; i < mc; i += mr) {
+        int height = min_int(mr, mc - i);
+        const REAL *src = a + (size_t) i * lda;
+        for (int p = 0; p < kc; p++) {
+            int r = 0;
+            for (; r < height; r++) {
+                packed[r] = src[(size_t) r * lda + p];
+            }
+            for (; r < mr; r++) {
+                packed[r] = 0;
+            }
+            packed += mr;
+        }
+    }
+}
+
+/* One packed mc x kc block of A against a packed kc x nc slab of B */
+static void MNAME(gemm_macro_kernel)(const MATRIX_KERNELS_T *k, int mc, int nc, int kc, const REAL *packed_a,
+                                     const REAL *packed_b, REAL *c, int ldc, int accumulate) {
+    int mr = k->gemm_mr, nr = k->gemm_nr;
+    for (int j = 0; j < nc; j += nr) {
+        int width = min_int(nr, nc - j);
+        const REAL *b = packed_b + (size_t) j * kc;
+        for (int i = 0; i < mc; i += mr) {
+            int height = min_int(mr, mc - i);
+            const REAL *a = packed_a + (size_t) i * kc;
+            REAL *tile = c + (size_t) i * ldc + j;
+            if (height == mr && width == nr) {
+                k->gemm_micro(kc, a, b, tile, ldc, accumulate);
+                continue;
+            }
+            // Corner tiles go through a full size scratch tile
+            REAL scratch[KERNELS_MAX_TILE] __attribute__((aligned(MATRIX_ALIGN)));
+            if (accumulate) {
+                for (int r = 0; r < height; r++) {
+                    memcpy(scratch + r * nr, tile + (size_t) r * ldc, width * sizeof(REAL));
+                }
+            }
+            k->gemm_micro(kc, a, b, scratch, nr, accumulate);
+            for (int r = 0; r < height; r++) {
+                memcpy(tile + (size_t) r * ldc, scratch + r * nr, width * sizeof(REAL));
+            }
+        }
+    }
+}
+
+static void MNAME(gemm_operands)(MATRIX_OPERAND mat1, MATRIX_OPERAND mat2, MATRIX *dst) {
+    int m = dst->dim.rows, n = dst->dim.cols, k = MATRIX_OPERAND_COLS(mat1);
+    if (k == 0) {
+        for (int i = 0; i < m; i++) {
+            memset(MAT_ROW(dst, i), 0, n * sizeof(REAL));
+        }
+        return;
+    }
+
+    const MATRIX_KERNELS_T *kern = MATRIX_KERNELS;
+    int mr = kern->gemm_mr, nr = kern->gemm_nr;
+    int panel_cols = min_int(GEMM_NC, (n + nr - 1) / nr * nr);
+    int block_rows = min_int(GEMM_MC, (m + mr - 1) / mr * mr);
+    REAL *packed_b = MNAME(alloc_aligned)((size_t) GEMM_KC * panel_cols);
+    assert(packed_b != NULL);
+
+    /*
+     * All threads share one packed B slab per (jc, pc) step and pack it
+     * together. dst is then cut into GEMM_MC x GEMM_TILE_N tiles handed out
+     * dynamically; each thread packs the A block of the tile it picked up.
+     * K blocks are still applied in order, so the summation order (and the
+     * result) does not depend on the thread count.
+     */
+    #pragma omp parallel if ((double) m * n * k >= GEMM_PARALLEL_MIN_FLOPS)
+    {
+        REAL *packed_a = MNAME(alloc_aligned)((size_t) GEMM_KC * block_rows);
+        assert(packed_a != NULL);
+        for (int jc = 0; jc < n; jc += GEMM_NC) {
+            int nc = min_int(GEMM_NC, n - jc);
+            for (int pc = 0; pc < k; pc += GEMM_KC) {
+                int kc = min_int(GEMM_KC, k - pc);
+                #pragma omp for schedule(static)
+                for (int j = 0; j < nc; j += nr) {
+                    MATRIX_PACK_B(kern, kc, min_int(nr, nc - j), mat2, pc, jc + j, packed_b + (size_t) j * kc);
+                }
+                #pragma omp for collapse(2) schedule(dynamic)
+                for (int ic = 0; ic < m; ic += GEMM_MC) {
+                    for (int jt = 0; jt < nc; jt += GEMM_TILE_N) {
+                        int mc = min_int(GEMM_MC, m - ic);
+                        TRACE_SCOPE("thread", "gemm_tile", mc, min_int(GEMM_TILE_N, nc - jt), kc);
+                        MATRIX_PACK_A(kern, mc, kc, mat1, ic, pc, packed_a);
+                        MNAME(gemm_macro_kernel)(kern, mc, min_int(GEMM_TILE_N, nc - jt), kc, packed_a,
+                                                 packed_b + (size_t) jt * kc, MAT_ROW(dst, ic) + jc + jt, dst->stride, pc > 0);
+                    }
+                }
+            }
+        }
+        pool_free(packed_a);
+    }
+    pool_free(packed_b);
+}
+
+static void MNAME(gemm)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    MNAME(gemm_operands)(MATRIX_OPERAND_OF(mat1), MATRIX_OPERAND_OF(mat2), dst);
+}
+
+/*
+ * Products where dst has only a handful of columns or rows. The packed GEMM
+ * would pad those out to a whole register tile; these instead stream the
+ * large operand once, at memory bandwidth:
+ * - few columns (matrix-vector and tall-skinny products): every dst element
+ *   is a dot product of a row of mat1 with a column of mat2, the columns
+ *   copied out contiguously first;
+ * - few rows (vector-matrix and short-fat products): every row of mat2 is
+ *   added into each dst row, scaled by the matching element of mat1, one
+ *   column chunk at a time so the dst chunks stay in L1.
+ */
+#define GEMM_SKINNY_MAX 4
+#define GEMM_SKINNY_CHUNK 2048
+
+static void MNAME(gemm_skinny_cols)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    int m = dst->dim.rows, n = dst->dim.cols, k = mat1->dim.cols;
+    REAL *scratch = NULL, *packed = NULL, *cols;
+    if (n == 1) {
+        cols = MNAME(packed_vector)(mat2, &scratch);
+    } else {
+        packed = cols = MNAME(alloc_aligned)((size_t) n * k);
+        assert(cols != NULL);
+        for (int p = 0; p < k; p++) {
+            for (int j = 0; j < n; j++) {
+                cols[(size_t) j * k + p] = MAT_ROW(mat2, p)[j];
+            }
+        }
+    }
+    const MATRIX_KERNELS_T *kern = MATRIX_KERNELS;
+    #pragma omp parallel if ((double) m * k >= ELEMENTWISE_PARALLEL_MIN)
+    {
+        TRACE_SCOPE("thread", "skinny_cols", m, n, k);
+        #pragma omp for schedule(static) nowait
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+                MAT_ROW(dst, i)[j] = kern->dot(MAT_ROW(mat1, i), cols + (size_t) j * k, k);
+            }
+        }
+    }
+    free(scratch);
+    pool_free(packed);
+}
+
+static void MNAME(gemm_skinny_rows)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    int m = dst->dim.rows, n = dst->dim.cols, k = mat1->dim.cols;
+    const MATRIX_KERNELS_T *kern = MATRIX_KERNELS;
+    #pragma omp parallel if ((double) n * k >= ELEMENTWISE_PARALLEL_MIN)
+    {
+        TRACE_SCOPE("thread", "skinny_rows", m, n, k);
+        #pragma omp for schedule(static) nowait
+        for (int jc = 0; jc < n; jc += GEMM_SKINNY_CHUNK) {
+            int nc = min_int(GEMM_SKINNY_CHUNK, n - jc);
+            for (int i = 0; i < m; i++) {
+                memset(MAT_ROW(dst, i) + jc, 0, nc * sizeof(REAL));
+            }
+            for (int p = 0; p < k; p++) {
+                const REAL *b = MAT_ROW(mat2, p) + jc;
+                for (int i = 0; i < m; i++) {
+                    kern->axpy(MAT_ROW(mat1, i)[p], b, MAT_ROW(dst, i) + jc, nc);
+                }
+            }
+        }
+    }
+}
+
+static int MNAME(strassen_applies)(MATRIX *mat1, MATRIX *mat2) {
+    int n = mat1->dim.rows;
+    return strassen_crossover > 0 && n >= strassen_crossover && mat1->dim.cols == n && mat2->dim.cols == n;
+}
+
+static MATRIX *MNAME(quadrant)(MATRIX *m, int r, int c, int h) {
+    MATRIX *q;
+    MNAME(view_matrix)(&q, m, r, c, h, h, 1);
+    return q;
+}
+
+/*
+ * Odd sizes peel off the last row and column (dynamic peeling): the even
+ * leading block goes through Strassen and the border is fixed up with thin
+ * products and a rank-1 update, which is cheaper than padding every level.
+ */
+static void MNAME(strassen_peel)(MATRIX *a, MATRIX *b, MATRIX *c) {
+    int n = a->dim.rows, m = n - 1;
+    MATRIX *a0, *b0, *c0, *a_rows, *b_col, *c_col, *a_row, *c_row;
+    MNAME(view_matrix)(&a0, a, 0, 0, m, m, 1);
+    MNAME(view_matrix)(&b0, b, 0, 0, m, m, 1);
+    MNAME(view_matrix)(&c0, c, 0, 0, m, m, 1);
+    MNAME(matrix_multiply)(a0, b0, c0);
+
+    // C[0:m, m] = A[0:m, :] B[:, m] and C[m, :] = A[m, :] B
+    MNAME(view_matrix)(&a_rows, a, 0, 0, m, n, 1);
+    MNAME(view_matrix)(&b_col, b, 0, m, n, 1, 1);
+    MNAME(view_matrix)(&c_col, c, 0, m, m, 1, 1);
+    MNAME(gemm)(a_rows, b_col, c_col);
+    MNAME(view_matrix)(&a_row, a, m, 0, 1, n, 1);
+    MNAME(view_matrix)(&c_row, c, m, 0, 1, n, 1);
+    MNAME(gemm)(a_row, b, c_row);
+
+    // C[0:m, 0:m] += A[0:m, m] B[m, 0:m]
+    const REAL *b_last = MAT_ROW(b, m);
+    #pragma omp parallel for if ((double) m * m >= ELEMENTWISE_PARALLEL_MIN)
+    for (int i = 0; i < m; i++) {
+        REAL a_im = MAT_ROW(a, i)[m];
+        REAL *c_i = MAT_ROW(c, i);
+        for (int j = 0; j < m; j++) {
+            c_i[j] += a_im * b_last[j];
+        }
+    }
+    MATRIX *views[] = {a0, b0, c0, a_rows, b_col, c_col, a_row, c_row};
+    for (unsigned i = 0; i < sizeof views / sizeof views[0]; i++) {
+        MNAME(free_matrix)(views[i]);
+    }
+}
+
+static void MNAME(strassen)(MATRIX *a, MATRIX *b, MATRIX *c) {
+    int n = a->dim.rows, h = n / 2;
+    if (n % 2 != 0) {
+        MNAME(strassen_peel)(a, b, c);
+        return;
+    }
+    MATRIX *a11 = MNAME(quadrant)(a, 0, 0, h), *a12 = MNAME(quadrant)(a, 0, h, h);
+    MATRIX *a21 = MNAME(quadrant)(a, h, 0, h), *a22 = MNAME(quadrant)(a, h, h, h);
+    MATRIX *b11 = MNAME(quadrant)(b, 0, 0, h), *b12 = MNAME(quadrant)(b, 0, h, h);
+    MATRIX *b21 = MNAME(quadrant)(b, h, 0, h), *b22 = MNAME(quadrant)(b, h, h, h);
+    MATRIX *c11 = MNAME(quadrant)(c, 0, 0, h), *c12 = MNAME(quadrant)(c, 0, h, h);
+    MATRIX *c21 = MNAME(quadrant)(c, h, 0, h), *c22 = MNAME(quadrant)(c, h, h, h);
+    MATRIX *s, *t, *p[7];
+    int ok = MNAME(allocate_matrix_uninit)(&s, h, h) == 0 && MNAME(allocate_matrix_uninit)(&t, h, h) == 0;
+    for (int i = 0; i < 7; i++) {
+        ok = ok && MNAME(allocate_matrix_uninit)(&p[i], h, h) == 0;
+    }
+    assert(ok);
+
+    // P1 = A11 B11, P2 = A12 B21
+    MNAME(matrix_multiply)(a11, b11, p[0]);
+    MNAME(matrix_multiply)(a12, b21, p[1]);
+    // S1 = A21 + A22, T1 = B12 - B11: P5 = S1 T1
+    MNAME(matrix_add)(a21, a22, s);
+    MNAME(matrix_sub)(b12, b11, t);
+    MNAME(matrix_multiply)(s, t, p[4]);
+    // S2 = S1 - A11, T2 = B22 - T1: P6 = S2 T2
+    MNAME(matrix_sub)(s, a11, s);
+    MNAME(matrix_sub)(b22, t, t);
+    MNAME(matrix_multiply)(s, t, p[5]);
+    // S4 = A12 - S2: P3 = S4 B22;  T4 = T2 - B21: P4 = A22 T4
+    MNAME(matrix_sub)(a12, s, s);
+    MNAME(matrix_multiply)(s, b22, p[2]);
+    MNAME(matrix_sub)(t, b21, t);
+    MNAME(matrix_multiply)(a22, t, p[3]);
+    // S3 = A11 - A21, T3 = B22 - B12: P7 = S3 T3
+    MNAME(matrix_sub)(a11, a21, s);
+    MNAME(matrix_sub)(b22, b12, t);
+    MNAME(matrix_multiply)(s, t, p[6]);
+
+    // U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5
+    MNAME(matrix_add)(p[0], p[5], p[5]);
+    MNAME(matrix_add)(p[5], p[6], p[6]);
+    MNAME(matrix_add)(p[5], p[4], p[5]);
+    MNAME(matrix_add)(p[0], p[1], c11);
+    MNAME(matrix_add)(p[5], p[2], c12);
+    MNAME(matrix_sub)(p[6], p[3], c21);
+    MNAME(matrix_add)(p[6], p[4], c22);
+
+    MATRIX *inputs[] = {a11, a12, a21, a22, b11, b12, b21, b22, c11, c12, c21, c22, s, t, p[0], p[1], p[2], p[3], p[4], p[5], p[6]};
+    for (unsigned i = 0; i < sizeof inputs / sizeof inputs[0]; i++) {
+        MNAME(free_matrix)(inputs[i]);
+    }
+}
+
+void MNAME(matrix_multiply)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    assert (mat1->dim.cols == mat2->dim.rows && dst->dim.rows == mat1->dim.rows && dst->dim.cols == mat2->dim.cols);
+    assert (dst != mat1 && dst != mat2);
+    COUNT_OP(OP_MULTIPLY);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "multiply", dst->dim.rows, dst->dim.cols, mat1->dim.cols);
+    if (MNAME(strassen_applies)(mat1, mat2)) {
+        TRACE_DETAIL("strassen");
+        MNAME(strassen)(mat1, mat2, dst);
+        return;
+    }
+    if (mat1->dim.cols > 0 && dst->dim.cols <= GEMM_SKINNY_MAX) {
+        TRACE_DETAIL("skinny_cols");
+        MNAME(gemm_skinny_cols)(mat1, mat2, dst);
+    } else if (mat1->dim.cols > 0 && dst->dim.rows <= GEMM_SKINNY_MAX) {
+        TRACE_DETAIL("skinny_rows");
+        MNAME(gemm_skinny_rows)(mat1, mat2, dst);
+    } else {
+        TRACE_DETAIL("gemm");
+        MNAME(gemm)(mat1, mat2, dst);
+    }
+}
+
+static int MNAME(is_dense)(MATRIX *mat) {
+    return mat == NULL || mat->stride == mat->dim.cols;
+}
+
+static run_plan MNAME(plan_runs)(MATRIX *dst, MATRIX *a, MATRIX *b) {
+    run_plan p;
+    p.total = (size_t) dst->dim.rows * dst->dim.cols;
+    p.dense = MNAME(is_dense)(dst) && MNAME(is_dense)(a) && MNAME(is_dense)(b);
+    if (p.dense) {
+        p.len = ELEMENTWISE_CHUNK;
+        p.count = (int) ((p.total + ELEMENTWISE_CHUNK - 1) / ELEMENTWISE_CHUNK);
+    } else {
+        p.len = dst->dim.cols;
+        p.count = dst->dim.rows;
+    }
+    return p;
+}
+
+static inline REAL *MNAME(run_start)(MATRIX *mat, run_plan *p, int r) {
+    return p->dense ? mat->data + (size_t) r * p->len : MAT_ROW(mat, r);
+}
+
+void MNAME(matrix_scale)(MATRIX *mat, REAL scalar, MATRIX *dst) {
+    assert(MNAME(same_size)(mat, dst));
+    COUNT_OP(OP_SCALE);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "scale", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = MNAME(plan_runs)(dst, mat, NULL);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        MATRIX_KERNELS->scale(MNAME(run_start)(mat, &p, r), scalar, MNAME(run_start)(dst, &p, r), run_length(&p, r));
+    }
+}
+
+void MNAME(fill_matrix)(MATRIX *mat, REAL val) {
+    COUNT_OP(OP_FILL);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "fill", mat->dim.rows, mat->dim.cols, 0);
+    run_plan p = MNAME(plan_runs)(mat, NULL, NULL);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        REAL *d = MNAME(run_start)(mat, &p, r);
+        int n = run_length(&p, r);
+        for (int j = 0; j < n; j++) {
+            d[j] = val;
+        }
+    }
+}
+
+void MNAME(matrix_multiply_elementwise)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    assert(MNAME(same_size)(mat1, mat2) && MNAME(same_size)(mat1, dst));
+    COUNT_OP(OP_MULTIPLY_ELEMENTWISE);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "multiply_elementwise", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = MNAME(plan_runs)(dst, mat1, mat2);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        MATRIX_KERNELS->mul(MNAME(run_start)(mat1, &p, r), MNAME(run_start)(mat2, &p, r), MNAME(run_start)(dst, &p, r), run_length(&p, r));
+    }
+}
+
+void MNAME(matrix_add)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    assert(MNAME(same_size)(mat1, mat2) && MNAME(same_size)(mat1, dst));
+    COUNT_OP(OP_ADD);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "add", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = MNAME(plan_runs)(dst, mat1, mat2);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        MATRIX_KERNELS->add(MNAME(run_start)(mat1, &p, r), MNAME(run_start)(mat2, &p, r), MNAME(run_start)(dst, &p, r), run_length(&p, r));
+    }
+}
+
+void MNAME(matrix_sub)(MATRIX *mat1, MATRIX *mat2, MATRIX *dst) {
+    assert(MNAME(same_size)(mat1, mat2) && MNAME(same_size)(mat1, dst));
+    COUNT_OP(OP_SUB);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "sub", dst->dim.rows, dst->dim.cols, 0);
+    run_plan p = MNAME(plan_runs)(dst, mat1, mat2);
+    #pragma omp parallel for if (p.total >= ELEMENTWISE_PARALLEL_MIN)
+    for (int r = 0; r < p.count; r++) {
+        MATRIX_KERNELS->sub(MNAME(run_start)(mat1, &p, r), MNAME(run_start)(mat2, &p, r), MNAME(run_start)(dst, &p, r), run_length(&p, r));
+    }
+}
+
+/*
+ * Cache-oblivious transpose: the longer side is halved (on a multiple of 8,
+ * so the kernel's register tiles stay whole) until a block is at most
+ * TRANSPOSE_LEAF on each side, at which point source and destination both fit
+ * in L1. Halves big enough to be worth it become OpenMP tasks.
+ */
+#define TRANSPOSE_LEAF 64
+#define TRANSPOSE_TASK_MIN (256 * 256)
+
+static void MNAME(transpose_block)(const MATRIX_KERNELS_T *k, const REAL *src, int lds, REAL *dst, int ldd, int rows, int cols) {
+    if (rows <= TRANSPOSE_LEAF && cols <= TRANSPOSE_LEAF) {
+        k->transpose(src, lds, dst, ldd, rows, cols);
+        return;
+    }
+    if (rows >= cols) {
+        int half = (rows / 2 + 7) & ~7;
+        #pragma omp task if ((double) half * cols >= TRANSPOSE_TASK_MIN)
+        MNAME(transpose_block)(k, src, lds, dst, ldd, half, cols);
+        MNAME(transpose_block)(k, src + (size_t) half * lds, lds, dst + half, ldd, rows - half, cols);
+    } else {
+        int half = (cols / 2 + 7) & ~7;
+        #pragma omp task if ((double) rows * half >= TRANSPOSE_TASK_MIN)
+        MNAME(transpose_block)(k, src, lds, dst, ldd, rows, half);
+        MNAME(transpose_block)(k, src + half, lds, dst + (size_t) half * ldd, ldd, rows, cols - half);
+    }
+}
+
+/*
+ * Square matrices can be transposed over themselves: tile (i, j) and tile
+ * (j, i) are swapped through a scratch tile, each pair by one thread.
+ */
+static void MNAME(transpose_in_place)(MATRIX *m) {
+    const MATRIX_KERNELS_T *k = MATRIX_KERNELS;
+    int n = m->dim.rows;
+    int tiles = (n + TRANSPOSE_LEAF - 1) / TRANSPOSE_LEAF;
+    #pragma omp parallel for collapse(2) schedule(dynamic) if ((double) n * n >= ELEMENTWISE_PARALLEL_MIN)
+    for (int bi = 0; bi < tiles; bi++) {
+        for (int bj = 0; bj < tiles; bj++) {
+            if (bj < bi) {
+                continue;
+            }
+            REAL scratch[TRANSPOSE_LEAF * TRANSPOSE_LEAF] __attribute__((aligned(MATRIX_ALIGN)));
+            int i = bi * TRANSPOSE_LEAF, j = bj * TRANSPOSE_LEAF;
+            int h = min_int(TRANSPOSE_LEAF, n - i), w = min_int(TRANSPOSE_LEAF, n - j);
+            REAL *upper = MAT_ROW(m, i) + j;
+            REAL *lower = MAT_ROW(m, j) + i;
+            // scratch = upper^T (w x h), upper = lower^T, lower = scratch
+            k->transpose(upper, m->stride, scratch, TRANSPOSE_LEAF, h, w);
+            if (bi != bj) {
+                k->transpose(lower, m->stride, upper, m->stride, w, h);
+            }
+            for (int r = 0; r < w; r++) {
+                memcpy(lower + (size_t) r * m->stride, scratch + r * TRANSPOSE_LEAF, h * sizeof(REAL));
+            }
+        }
+    }
+}
+
+void MNAME(matrix_transpose)(MATRIX *m, MATRIX *dst) {
+    assert(m->dim.rows == dst->dim.cols && m->dim.cols == dst->dim.rows);
+    COUNT_OP(OP_TRANSPOSE);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "transpose", dst->dim.rows, dst->dim.cols, 0);
+    if (m->data == dst->data) {
+        assert(m->dim.rows == m->dim.cols && m->stride == dst->stride);
+        MNAME(transpose_in_place)(m);
+        return;
+    }
+    const MATRIX_KERNELS_T *k = MATRIX_KERNELS;
+    #pragma omp parallel if ((double) m->dim.rows * m->dim.cols >= ELEMENTWISE_PARALLEL_MIN)
+    #pragma omp single
+    MNAME(transpose_block)(k, m->data, m->stride, dst->data, dst->stride, m->dim.rows, m->dim.cols);
+}
+
+void MNAME(copy)(MATRIX *src, MATRIX *dst) {
+    assert(MNAME(same_size)(src, dst));
+    COUNT_OP(OP_COPY);
+    TRACE_SCOPE(MATRIX_TRACE_CAT, "copy", dst->dim.rows, dst->dim.cols, 0);
+    // Views skip over memory that belongs to their parent, so only dense
+    // matrices are copied as one block
+    if (src->stride == src->dim.cols && dst->stride == dst->dim.cols) {
+        memcpy(dst->data, src->data, (size_t) src->dim.rows * src->dim.cols * sizeof(REAL));
+        return;
+    }
+    for (int i = 0; i < src->dim.rows; i++) {
+        memcpy(MAT_ROW(dst, i), MAT_ROW(src, i), src->dim.cols * sizeof(REAL));
+    }
+}
+
+void MNAME(set_loc)(MATRIX *mat, int row, int col, REAL val) {
+    assert (row < mat->dim.rows && col < mat->dim.cols && row >= 0 && col >= 0);
+    MAT_ROW(mat, row)[col] = val;
+}
+
+int MNAME(same_size)(MATRIX *mat1, MATRIX *mat2) {
+    return mat1 && mat2 && mat1->dim.rows == mat2->dim.rows && mat1->dim.cols == mat2->dim.cols;
+}
+
+REAL MNAME(get_loc)(MATRIX *mat, int row, int col) {
+    return MAT_ROW(mat, row)[col];
+}
+
+#undef MATRIX_CAT_
+#undef MATRIX_CAT
+#undef MNAME
+#undef REAL
+#undef MATRIX
+#undef MATRIX_SUFFIX
+#undef MATRIX_KERNELS_T
+#undef MATRIX_KERNELS
+#undef MATRIX_TRACE_CAT
+#undef MATRIX_OPERAND
+#undef MATRIX_OPERAND_OF
+#undef MATRIX_OPERAND_COLS
+#undef MATRIX_PACK_A
+#undef MATRIX_PACK_B
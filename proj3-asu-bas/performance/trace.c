@@ -0,0 +1,143 @@
+#include "trace.h"
+#include "kernels.h"
+#include <errno.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+int trace_on;
+
+/*
+ * A ring and its capacity are published together through one pointer, so a
+ * recorder always indexes the events array it read the capacity of.
+ */
+typedef struct trace_ring {
+    size_t capacity;
+    trace_event events[];
+} trace_ring;
+
+static trace_ring *ring;
+static uint64_t ring_head;      // events ever recorded; slot is head % capacity
+
+static __thread int thread_tid;
+
+uint64_t trace_now(void) {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return (uint64_t) tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
+
+/*
+ * The ring only changes size while recording is stopped. A span that read
+ * trace_on just before a stop can still land afterwards, so an old ring is
+ * never freed, only replaced by a larger one.
+ */
+int trace_start(size_t capacity) {
+    if (capacity == 0) {
+        capacity = TRACE_DEFAULT_EVENTS;
+    }
+    trace_ring *current = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    if (! trace_enabled() && (current == NULL || capacity > current->capacity)) {
+        trace_ring *larger = calloc(1, sizeof(trace_ring) + capacity * sizeof(trace_event));
+        if (larger == NULL) {
+            return -1;
+        }
+        larger->capacity = capacity;
+        __atomic_store_n(&ring, larger, __ATOMIC_RELEASE);
+        __atomic_store_n(&ring_head, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void trace_stop(void) {
+    __atomic_store_n(&trace_on, 0, __ATOMIC_RELAXED);
+}
+
+int trace_enabled(void) {
+    return __atomic_load_n(&trace_on, __ATOMIC_RELAXED);
+}
+
+void trace_clear(void) {
+    __atomic_store_n(&ring_head, 0, __ATOMIC_RELAXED);
+}
+
+void trace_record(const char *cat, const char *name, const char *detail, uint64_t start_ns, int rows, int cols, int inner) {
+    uint64_t end = trace_now();
+    if (thread_tid == 0) {
+        thread_tid = syscall(SYS_gettid);
+    }
+    trace_ring *r = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    uint64_t i = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    trace_event *e = &r->events[i % r->capacity];
+    e->start_ns = start_ns;
+    e->dur_ns = end - start_ns;
+    e->cat = cat;
+    e->name = name;
+    e->detail = detail;
+    e->tid = thread_tid;
+    e->thread = omp_get_thread_num();
+    e->threads = omp_in_parallel() ? omp_get_num_threads() : omp_get_max_threads();
+    e->rows = rows;
+    e->cols = cols;
+    e->inner = inner;
+}
+
+int trace_dump(const char *path) {
+    int was_on = trace_enabled();
+    trace_stop();
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        __atomic_store_n(&trace_on, was_on, __ATOMIC_RELAXED);
+        return -1;
+    }
+    trace_ring *r = __atomic_load_n(&ring, __ATOMIC_ACQUIRE);
+    uint64_t head = 0, first = 0;
+    if (r != NULL) {
+        head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+        first = head > r->capacity ? head - r->capacity : 0;
+    }
+    int pid = getpid();
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"otherData\": {\"kernels\": \"%s\", \"dropped\": %llu},\n"
+            "\"traceEvents\": [", kernels->name, (unsigned long long) first);
+    for (uint64_t i = first; i < head; i++) {
+        const trace_event *e = &r->events[i % r->capacity];
+        fprintf(f, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                "\"pid\": %d, \"tid\": %d, \"args\": {\"rows\": %d, \"cols\": %d, \"inner\": %d, "
+                "\"thread\": %d, \"threads\": %d",
+                i == first ? "" : ",", e->name, e->cat, e->start_ns / 1e3, e->dur_ns / 1e3, pid, e->tid,
+                e->rows, e->cols, e->inner, e->thread, e->threads);
+        if (e->detail != NULL) {
+            fprintf(f, ", \"detail\": \"%s\"", e->detail);
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    int failed = ferror(f);
+    failed |= fclose(f) != 0;
+    __atomic_store_n(&trace_on, was_on, __ATOMIC_RELAXED);
+    if (failed && errno == 0) {
+        errno = EIO;
+    }
+    return failed ? -1 : 0;
+}
+
+static const char *exit_trace_path;
+
+static void dump_at_exit(void) {
+    if (trace_dump(exit_trace_path) != 0) {
+        perror(exit_trace_path);
+    }
+}
+
+// MATRIX_TRACE=<path> records from load time and writes the trace there at exit
+__attribute__((constructor))
+static void init_trace(void) {
+    exit_trace_path = getenv("MATRIX_TRACE");
+    if (exit_trace_path != NULL && *exit_trace_path != '\0' && trace_start(0) == 0) {
+        atexit(dump_at_exit);
+    }
+}
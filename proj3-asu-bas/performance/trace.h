@@ -0,0 +1,74 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Opt-in timeline of operations, written out in the Chrome trace event
+ * format (chrome://tracing, ui.perfetto.dev). Every event is a complete span
+ * on the OS thread that ran it: numc methods, the matrix ops under them, and
+ * inside the parallel kernels one span per OpenMP thread's share of the work,
+ * so load imbalance shows up as ragged ends and Python overhead as the gaps
+ * between numc spans. Events go into a fixed size ring buffer; once it wraps,
+ * the oldest are overwritten. Recording takes one atomic increment and two
+ * clock reads; with tracing off a scope costs one relaxed load.
+ */
+typedef struct trace_event {
+    uint64_t start_ns;          // CLOCK_MONOTONIC
+    uint64_t dur_ns;
+    const char *cat;            // static strings only
+    const char *name;
+    const char *detail;         // kernel path taken, or NULL
+    int tid;
+    int thread;                 // OpenMP thread number
+    int threads;                // OpenMP team size (or the size a new team would get)
+    int rows, cols, inner;      // inner is the k of products, 0 otherwise
+} trace_event;
+
+#define TRACE_DEFAULT_EVENTS (1 << 20)
+
+// Starts recording into a ring of capacity events (0 for the default); -1 when out of memory
+int trace_start(size_t capacity);
+void trace_stop(void);
+int trace_enabled(void);
+void trace_clear(void);
+/*
+ * Writes the buffered events as Chrome trace JSON; -1 with errno set when the
+ * file cannot be written. Recording is paused meanwhile.
+ */
+int trace_dump(const char *path);
+
+uint64_t trace_now(void);
+void trace_record(const char *cat, const char *name, const char *detail, uint64_t start_ns, int rows, int cols, int inner);
+
+typedef struct trace_scope {
+    int on;
+    uint64_t start_ns;
+    const char *cat;
+    const char *name;
+    const char *detail;
+    int rows, cols, inner;
+} trace_scope;
+
+extern int trace_on;
+
+static inline void trace_scope_exit(trace_scope *scope) {
+    if (scope->on) {
+        trace_record(scope->cat, scope->name, scope->detail, scope->start_ns, scope->rows, scope->cols, scope->inner);
+    }
+}
+
+/*
+ * TRACE_SCOPE("matrix", "add", rows, cols, 0); records a span from there to
+ * the end of the enclosing block. TRACE_DETAIL(s) in the same block labels it.
+ */
+#define TRACE_SCOPE(category, op_name, r, c, k) \
+    trace_scope trace_scope_ __attribute__((cleanup(trace_scope_exit))) = {0}; \
+    if (__atomic_load_n(&trace_on, __ATOMIC_RELAXED)) { \
+        trace_scope_ = (trace_scope) {1, trace_now(), category, op_name, NULL, r, c, k}; \
+    }
+
+#define TRACE_DETAIL(s) (trace_scope_.detail = (s))
+
+#endif
@@ -2,31 +2,389 @@
 #include <structmember.h>
 #include <math.h>
 #include "../performance/matrix.h"
+#include "../performance/expr.h"
+#include "../performance/matfile.h"
+#include "../performance/counters.h"
+#include "../performance/trace.h"
+#include <fcntl.h>
+#include <time.h>
+#include <x86intrin.h>
+#include <unistd.h>
 
 /*
  * Defines the struct that represents the object
  * Has the default PyObject_HEAD so it can be a python object
  * It also has the matrix that is being wrapped
+ *
+ * In lazy mode (numc.set_lazy) elementwise operations leave mat NULL and
+ * record the operation and its operands instead. The first method that needs
+ * the data calls Matrix61c_force, which evaluates the whole pending tree in
+ * one fused pass (matrix_eval_expr).
+ *
+ * A float64 matrix keeps its data in mat64 instead and leaves mat NULL. It is
+ * never pending, never a view and never exported, and only the core
+ * arithmetic dispatches on it; everything else forces, which fails for it.
  */
-typedef struct {
+typedef enum numc_dtype {
+    DTYPE_FLOAT32,
+    DTYPE_FLOAT64,
+    DTYPE_COUNT
+} numc_dtype;
+
+static const char *dtype_names[DTYPE_COUNT] = {"float32", "float64"};
+
+typedef struct Matrix61c {
     PyObject_HEAD
     matrix* mat;
+    numc_dtype dtype;
+    matrix64* mat64;            // the data of a float64 matrix
+
+    shape dim;                  // shape of a pending result
+    expr_op op;
+    struct Matrix61c *lhs;      // operands of a pending result, owned references
+    struct Matrix61c *rhs;
+    float scalar;
+    math_func func;
+    int expr_size;              // nodes in the pending tree, 1 once evaluated
+    int lazy_dependents;        // pending results holding this one as an operand
+    struct Matrix61c *pending_prev, *pending_next;
+
+    int exports;                    // live buffer protocol views of mat
+    Py_ssize_t buf_shape[2];        // shape and strides handed out to them
+    Py_ssize_t buf_strides[2];
+
+    Py_buffer base;                 // memory mat wraps (frombuffer), if has_base
+    int has_base;
+
+    struct Matrix61c *parent;       // owner of the storage mat views, owned reference
+    int views;                      // live views of this matrix's storage
 } Matrix61c;
 
 static PyTypeObject Matrix61cType;
 
-// This is a helper function to be passed into apply func
-float sigmoid(float x) {
-    return 1 / (1 + expf(-1 * x));
+/*
+ * Kernels that only touch matrix memory run without the GIL once there is
+ * enough work to pay for the handoff, so other Python threads keep running
+ * meanwhile. The calling thread holds references to every operand for the
+ * whole call, so nothing is freed underneath a kernel. As with numpy, writing
+ * to a matrix while another thread reads it gives unspecified values.
+ */
+#define GIL_RELEASE_MIN 4096
+
+#define WITHOUT_GIL(work, call) \
+    do { \
+        if ((double) (work) >= GIL_RELEASE_MIN) { \
+            PyThreadState *_save = PyEval_SaveThread(); \
+            call; \
+            PyEval_RestoreThread(_save); \
+        } else { \
+            call; \
+        } \
+    } while (0)
+
+/*
+ * Always-on statistics per op: calls, elements produced, compulsory bytes
+ * moved (each operand read once, the result written once), time in the
+ * kernel and a histogram of that time in power of two buckets. Timing reads
+ * the TSC, which is converted to seconds only in numc.stats(), against the
+ * monotonic clock since the module loaded. Every update happens with the GIL
+ * held, so relaxed loads and stores are enough and no lock or locked
+ * instruction is needed; they are atomic so a reader never sees a torn value.
+ */
+typedef enum numc_stat {
+    STAT_ADD,
+    STAT_SUB,
+    STAT_ELEMENT_MULT,
+    STAT_SCALE,
+    STAT_MULTIPLY,
+    STAT_POWER,
+    STAT_DOT,
+    STAT_OUTER,
+    STAT_TRANSPOSE,
+    STAT_ELEMENT_POW,
+    STAT_MATH,                                  // one per math_func
+    STAT_FUSED = STAT_MATH + MATH_FUNC_COUNT,   // a lazy expression tree
+    STAT_COUNT
+} numc_stat;
+
+static const char *stat_names[STAT_COUNT] = {
+    "add", "sub", "element_mult", "scale", "multiply", "power", "dot", "outer", "transpose", "element_pow",
+    "exp", "log", "tanh", "sigmoid", "relu", "abs", "fused",
+};
+
+// Bucket b counts calls of [2^b, 2^(b+1)) TSC ticks
+#define STAT_BUCKETS 48
+
+typedef struct op_stats {
+    uint64_t calls;
+    uint64_t elements;
+    uint64_t bytes;
+    uint64_t ticks;
+    uint64_t histogram[STAT_BUCKETS];
+} __attribute__((aligned(64))) op_stats;
+
+static op_stats op_stats_table[STAT_COUNT];
+static uint64_t stats_tsc_origin;
+static struct timespec stats_clock_origin;
+
+static inline void stat_add(uint64_t *field, uint64_t v) {
+    __atomic_store_n(field, __atomic_load_n(field, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+static inline void record_stat(numc_stat stat, double elements, double bytes, uint64_t ticks) {
+    op_stats *s = &op_stats_table[stat];
+    int bucket = 63 - __builtin_clzll(ticks | 1);
+    stat_add(&s->calls, 1);
+    stat_add(&s->elements, (uint64_t) elements);
+    stat_add(&s->bytes, (uint64_t) bytes);
+    stat_add(&s->ticks, ticks);
+    stat_add(&s->histogram[bucket < STAT_BUCKETS ? bucket : STAT_BUCKETS - 1], 1);
+}
+
+// A trace span (numc.trace_start) over the rest of a method on self
+#define TRACE_METHOD(stat, self) \
+    TRACE_SCOPE("numc", stat_names[stat], Matrix61c_shape(self).rows, Matrix61c_shape(self).cols, 0)
+
+// WITHOUT_GIL, with the call timed and recorded under stat
+#define TIMED_WITHOUT_GIL(stat, elements, bytes, work, call) \
+    do { \
+        uint64_t _start = __rdtsc(); \
+        WITHOUT_GIL(work, call); \
+        record_stat(stat, elements, bytes, __rdtsc() - _start); \
+    } while (0)
+
+static int lazy_mode = 0;
+// Every pending (unevaluated) result, so they can all be forced before a mutation
+static Matrix61c *pending_head = NULL;
+
+static shape
+Matrix61c_shape(Matrix61c *self) {
+    if (self->mat64 != NULL) {
+        return self->mat64->dim;
+    }
+    return self->mat != NULL ? self->mat->dim : self->dim;
+}
+
+static void
+Matrix61c_unlink_pending(Matrix61c *self) {
+    if (self->pending_prev != NULL) {
+        self->pending_prev->pending_next = self->pending_next;
+    } else if (pending_head == self) {
+        pending_head = self->pending_next;
+    }
+    if (self->pending_next != NULL) {
+        self->pending_next->pending_prev = self->pending_prev;
+    }
+    self->pending_prev = self->pending_next = NULL;
+}
+
+static void
+Matrix61c_release_operands(Matrix61c *self) {
+    if (self->lhs != NULL) {
+        self->lhs->lazy_dependents--;
+        Py_CLEAR(self->lhs);
+    }
+    if (self->rhs != NULL) {
+        self->rhs->lazy_dependents--;
+        Py_CLEAR(self->rhs);
+    }
+}
+
+/*
+ * Appends the pending tree rooted at node to nodes and the objects whose data
+ * it reads to leaves; returns its index
+ */
+static int
+Matrix61c_build_expr(Matrix61c *node, matrix_expr *nodes, int *count, Matrix61c **leaves, int *leaf_count) {
+    int i = (*count)++;
+    assert(i < EXPR_MAX_NODES);
+    if (node->mat != NULL) {
+        nodes[i].op = EXPR_LEAF;
+        nodes[i].leaf = node->mat;
+        leaves[(*leaf_count)++] = node;
+        return i;
+    }
+    assert(node->lhs != NULL);
+    nodes[i].op = node->op;
+    nodes[i].leaf = NULL;
+    nodes[i].scalar = node->scalar;
+    nodes[i].func = node->func;
+    nodes[i].lhs = Matrix61c_build_expr(node->lhs, nodes, count, leaves, leaf_count);
+    nodes[i].rhs = node->rhs != NULL ? Matrix61c_build_expr(node->rhs, nodes, count, leaves, leaf_count) : -1;
+    return i;
+}
+
+/*
+ * Methods without a float64 version raise instead of converting silently
+ */
+static int
+Matrix61c_require_float32(Matrix61c *self) {
+    if (self->dtype != DTYPE_FLOAT32) {
+        PyErr_SetString(PyExc_TypeError, "Only float32 matrices support this operation (see astype)");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Makes sure self->mat holds the data, evaluating a pending result.
+ * Returns -1 with an exception set on failure, which is always the case for
+ * a float64 matrix: methods that force only work on float32 data.
+ *
+ * The evaluation runs without the GIL, so another thread may force the same
+ * result meanwhile; self->mat is only set once the data is complete, and the
+ * later of two evaluations is dropped. The leaves are kept alive by hand
+ * because the first thread to finish releases self's operands.
+ */
+static int
+Matrix61c_force(Matrix61c *self) {
+    if (self->mat != NULL) {
+        return 0;
+    }
+    if (Matrix61c_require_float32(self) < 0) {
+        return -1;
+    }
+    TRACE_METHOD(STAT_FUSED, self);
+    matrix_expr nodes[EXPR_MAX_NODES];
+    Matrix61c *leaves[EXPR_MAX_NODES];
+    int count = 0, leaf_count = 0;
+    int root = Matrix61c_build_expr(self, nodes, &count, leaves, &leaf_count);
+    matrix *result;
+    if (allocate_matrix_uninit(&result, self->dim.rows, self->dim.cols) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    Py_INCREF(self);
+    for (int i = 0; i < leaf_count; i++) {
+        Py_INCREF(leaves[i]);
+    }
+    double elements = (double) self->dim.rows * self->dim.cols;
+    TIMED_WITHOUT_GIL(STAT_FUSED, elements, 4 * elements * (leaf_count + 1), elements,
+                      matrix_eval_expr(nodes, count, root, result));
+    for (int i = 0; i < leaf_count; i++) {
+        Py_DECREF(leaves[i]);
+    }
+    if (self->mat != NULL) {
+        free_matrix(result);
+        Py_DECREF(self);
+        return 0;
+    }
+    self->mat = result;
+    Matrix61c_unlink_pending(self);
+    Matrix61c_release_operands(self);
+    self->expr_size = 1;
+    Py_DECREF(self);
+    return 0;
+}
+
+/*
+ * Pending results read their operands when they are evaluated, so before an
+ * operand is written to, everything still pending is evaluated.
+ */
+static int
+Matrix61c_prepare_write(Matrix61c *self) {
+    if (Matrix61c_force(self) < 0) {
+        return -1;
+    }
+    while (self->lazy_dependents > 0 && pending_head != NULL) {
+        if (Matrix61c_force(pending_head) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+Matrix61c_shared(Matrix61c *self) {
+    return self->exports > 0 || self->has_base || self->parent != NULL || self->views > 0;
+}
+
+/*
+ * Records op(lhs, rhs) as a pending result; only float32 operands can be
+ * pending. Trees are capped at EXPR_MAX_NODES by evaluating the operands
+ * first when they would overflow.
+ */
+static PyObject *
+Matrix61c_lazy(Matrix61c *lhs, Matrix61c *rhs, expr_op op, float scalar, math_func func) {
+    if (Matrix61c_require_float32(lhs) < 0 || (rhs != NULL && Matrix61c_require_float32(rhs) < 0)) {
+        return NULL;
+    }
+    if (1 + lhs->expr_size + (rhs != NULL ? rhs->expr_size : 0) > EXPR_MAX_NODES) {
+        if (Matrix61c_force(lhs) < 0 || (rhs != NULL && Matrix61c_force(rhs) < 0)) {
+            return NULL;
+        }
+    }
+    Matrix61c* rv = (Matrix61c*) Matrix61cType.tp_alloc(&Matrix61cType, 0);
+    if (rv == NULL) {
+        return NULL;
+    }
+    rv->dim = Matrix61c_shape(lhs);
+    rv->op = op;
+    rv->scalar = scalar;
+    rv->func = func;
+    Py_INCREF(lhs);
+    rv->lhs = lhs;
+    lhs->lazy_dependents++;
+    rv->expr_size = 1 + lhs->expr_size;
+    if (rhs != NULL) {
+        Py_INCREF(rhs);
+        rv->rhs = rhs;
+        rhs->lazy_dependents++;
+        rv->expr_size += rhs->expr_size;
+    }
+    // Memory that can be written through something else (a buffer view, the
+    // owner of wrapped memory, another view) is read right away
+    if (Matrix61c_shared(lhs) || (rhs != NULL && Matrix61c_shared(rhs))) {
+        if (Matrix61c_force(rv) < 0) {
+            Py_DECREF(rv);
+            return NULL;
+        }
+        return (PyObject*)rv;
+    }
+    rv->pending_next = pending_head;
+    if (pending_head != NULL) {
+        pending_head->pending_prev = rv;
+    }
+    pending_head = rv;
+    return (PyObject*)rv;
+}
+
+static int
+same_shape(Matrix61c *a, Matrix61c *b) {
+    shape sa = Matrix61c_shape(a), sb = Matrix61c_shape(b);
+    return sa.rows == sb.rows && sa.cols == sb.cols;
 }
 
+// Shorthand for methods that need the data of self (and of other, if given)
+#define FORCE_OR_FAIL(obj) \
+    if (Matrix61c_force((Matrix61c*)(obj)) < 0) { \
+        return NULL; \
+    }
+
 
 /*
  * Destroy's the struct
  */
 static void
 Matrix61c_dealloc(Matrix61c* self) {
-    free_matrix(self->mat);
+    Matrix61c_unlink_pending(self);
+    Matrix61c_release_operands(self);
+    if (self->mat != NULL) {
+        free_matrix(self->mat);
+        self->mat = NULL;
+    }
+    if (self->mat64 != NULL) {
+        free_matrix64(self->mat64);
+        self->mat64 = NULL;
+    }
+    if (self->has_base) {
+        PyBuffer_Release(&self->base);
+        self->has_base = 0;
+    }
+    if (self->parent != NULL) {
+        self->parent->views--;
+        Py_CLEAR(self->parent);
+    }
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -38,23 +396,145 @@ Matrix61c_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
     Matrix61c *self;
 
     self = (Matrix61c *)type->tp_alloc(type, 0);
+    if (self != NULL) {
+        self->expr_size = 1;
+    }
 
     return (PyObject *)self;
 }
 
+// Returns the numc_dtype called name, or -1 with a TypeError set
+static int
+parse_dtype(const char *name) {
+    for (int i = 0; i < DTYPE_COUNT; i++) {
+        if (strcmp(name, dtype_names[i]) == 0) {
+            return i;
+        }
+    }
+    PyErr_SetString(PyExc_TypeError, "dtype must be 'float32' or 'float64'");
+    return -1;
+}
+
+/*
+ * Zeroed storage of self->dtype for the constructors, and the element setter
+ * that goes with it (values are only rounded to float for float32)
+ */
+static int
+Matrix61c_alloc_data(Matrix61c *self, int rows, int cols) {
+    if (self->dtype == DTYPE_FLOAT64) {
+        return allocate_matrix64(&self->mat64, rows, cols);
+    }
+    return allocate_matrix(&self->mat, rows, cols);
+}
+
+static void
+Matrix61c_free_data(Matrix61c *self) {
+    if (self->dtype == DTYPE_FLOAT64) {
+        free_matrix64(self->mat64);
+        self->mat64 = NULL;
+    } else {
+        free_matrix(self->mat);
+        self->mat = NULL;
+    }
+}
+
+static void
+Matrix61c_store(Matrix61c *self, int row, int col, double val) {
+    if (self->dtype == DTYPE_FLOAT64) {
+        set_loc64(self->mat64, row, col, val);
+    } else {
+        set_loc(self->mat, row, col, (float) val);
+    }
+}
+
+/*
+ * Copies a 1D or 2D float32/float64 buffer (e.g. a numpy array or a
+ * memoryview) into a new matrix. A 1D buffer becomes a column vector, like
+ * a flat list does.
+ */
+static int
+Matrix61c_init_from_buffer(Matrix61c *self, PyObject *obj) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_RECORDS_RO) < 0) {
+        return -1;
+    }
+    const char *fmt = view.format;
+    if (fmt[0] == '<' || fmt[0] == '=' || fmt[0] == '@') {
+        fmt++;
+    }
+    int is_float = strcmp(fmt, "f") == 0;
+    if ((! is_float && strcmp(fmt, "d") != 0) || view.ndim < 1 || view.ndim > 2) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "Buffer must be a 1D or 2D array of float32 or float64");
+        return -1;
+    }
+    Py_ssize_t rows = view.shape[0];
+    Py_ssize_t cols = view.ndim == 2 ? view.shape[1] : 1;
+    Py_ssize_t col_stride = view.ndim == 2 ? view.strides[1] : 0;
+    if (rows > INT_MAX || cols > INT_MAX || Matrix61c_alloc_data(self, rows, cols) == -1) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "Failed to allocate");
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < rows; i++) {
+        const char *src = (const char *) view.buf + i * view.strides[0];
+        if (self->dtype == DTYPE_FLOAT64) {
+            double *dst = MAT_ROW(self->mat64, i);
+            for (Py_ssize_t j = 0; j < cols; j++) {
+                if (is_float) {
+                    float f;
+                    memcpy(&f, src + j * col_stride, sizeof(float));
+                    dst[j] = f;
+                } else {
+                    memcpy(&dst[j], src + j * col_stride, sizeof(double));
+                }
+            }
+            continue;
+        }
+        float *dst = MAT_ROW(self->mat, i);
+        if (is_float && (cols == 1 || col_stride == sizeof(float))) {
+            memcpy(dst, src, cols * sizeof(float));
+        } else if (is_float) {
+            for (Py_ssize_t j = 0; j < cols; j++) {
+                memcpy(&dst[j], src + j * col_stride, sizeof(float));
+            }
+        } else {
+            for (Py_ssize_t j = 0; j < cols; j++) {
+                double d;
+                memcpy(&d, src + j * col_stride, sizeof(double));
+                dst[j] = (float) d;
+            }
+        }
+    }
+    PyBuffer_Release(&view);
+    return 0;
+}
+
 /*
- * Initializes the data in the struct
+ * Initializes the data in the struct, as float32 unless dtype='float64'
  */
 static int
 Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
     PyObject *lst=NULL;
+    const char *dtype = NULL;
 
-    static char *kwlist[] = {"", NULL};
+    static char *kwlist[] = {"", "dtype", NULL};
     
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &lst)) {
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$s", kwlist, &lst, &dtype)) {
         PyErr_SetString(PyExc_TypeError, "Not given an object to initialize");
         return -1;
     }
+    if (dtype != NULL) {
+        int d = parse_dtype(dtype);
+        if (d < 0) {
+            return -1;
+        }
+        self->dtype = d;
+    }
+
+    if (! PyList_Check(lst) && PyObject_CheckBuffer(lst)) {
+        return Matrix61c_init_from_buffer(self, lst);
+    }
 
     if (! PyList_Check(lst)) {
         PyErr_SetString(PyExc_TypeError, "Not given a list to initialize");
@@ -66,7 +546,7 @@ Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
     
     if (rows <= 0) { // If there is an empty list given, return an empty matrix
         if (self != NULL) {
-            if (allocate_matrix(&(self->mat), 0, 0) == -1) {
+            if (Matrix61c_alloc_data(self, 0, 0) == -1) {
                 PyErr_SetString(PyExc_TypeError, "Failed to allocate");
                 return -1;
             }
@@ -77,22 +557,22 @@ Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
     PyObject* item = PyList_GetItem(lst, 0);
 
     if (PyNumber_Check(item)) { // If we have an float, we should treat this as a row vector
-        if (allocate_matrix(&(self->mat), rows, 1) == -1) {
+        if (Matrix61c_alloc_data(self, rows, 1) == -1) {
             PyErr_SetString(PyExc_TypeError, "Failed to allocate");
             return -1;
         }
         for (i = 0; i < rows; i++) {
             item = PyList_GetItem(lst, i);
             if (! PyNumber_Check(item)) {
-                free(self->mat);
+                Matrix61c_free_data(self);
                 PyErr_SetString(PyExc_TypeError, "Items are not numbers");
                 return -1;
             }
-            set_loc(self->mat, i, 0, (float)PyFloat_AsDouble(PyNumber_Float(item)));
+            Matrix61c_store(self, i, 0, PyFloat_AsDouble(PyNumber_Float(item)));
         }
     } else if (PyList_Check(item)) { // If we have list, treat this as a matrix or column vector
         int cols = PyList_Size(item); // Get the number of columsn
-        if (allocate_matrix(&(self->mat), rows, cols) == -1) { // If we can't allocate space, fail
+        if (Matrix61c_alloc_data(self, rows, cols) == -1) { // If we can't allocate space, fail
             PyErr_SetString(PyExc_TypeError, "Failed to allocate");
             return -1;
         }
@@ -101,12 +581,12 @@ Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
         for (i = 0; i < rows; i++) { // For each row
             item = PyList_GetItem(lst, i); // Get the item
             if (! PyList_Check(item)) { // Check its a list
-                free(self->mat);
+                Matrix61c_free_data(self);
                 PyErr_SetString(PyExc_TypeError, "Items are not lists");
                 return -1;
             }
             if (cols != PyList_Size(item)) { // Check that it has the same number of items
-                free(self->mat);
+                Matrix61c_free_data(self);
                 PyErr_SetString(PyExc_TypeError, "Size is not correct");
                 return -1;
             }
@@ -114,10 +594,10 @@ Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
                 sub_item = PyList_GetItem(item, j); // Get the item from the list
                 if (! PyNumber_Check(sub_item)) { // Check its a valid item
                     PyErr_SetString(PyExc_TypeError, "Sub items are not numbers");
-                    free(self->mat);
+                    Matrix61c_free_data(self);
                     return -1;
                 }
-                set_loc(self->mat, i, j, (float)PyFloat_AsDouble(PyNumber_Float(sub_item))); // Place it in the matrix
+                Matrix61c_store(self, i, j, PyFloat_AsDouble(PyNumber_Float(sub_item))); // Place it in the matrix
             }
         }
     } else { // Otherwise error out
@@ -128,11 +608,42 @@ Matrix61c_init(Matrix61c *self, PyObject *args, PyObject *kwds) {
     return 0;
 }
 
+// The list of lists of a float64 matrix
+static PyObject *
+list_of_matrix64(matrix64 *mat) {
+    PyObject* rv = PyList_New(mat->dim.rows);
+    if (rv == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < mat->dim.rows; i++) {
+        PyObject* new_list = PyList_New(mat->dim.cols);
+        if (new_list == NULL) {
+            Py_DECREF(rv);
+            return NULL;
+        }
+        for (int j = 0; j < mat->dim.cols; j++) {
+            PyList_SET_ITEM(new_list, j, PyFloat_FromDouble(get_loc64(mat, i, j)));
+        }
+        PyList_SET_ITEM(rv, i, new_list);
+    }
+    return rv;
+}
+
 /*
  * Returns a string that represents the matrix
  */
 static PyObject *
 Matrix61c_repr(Matrix61c *self) {
+    if (self->dtype == DTYPE_FLOAT64) {
+        PyObject* list = list_of_matrix64(self->mat64);
+        if (list == NULL) {
+            return NULL;
+        }
+        PyObject* real_rv = PyObject_Repr(list);
+        Py_DECREF(list);
+        return real_rv;
+    }
+    FORCE_OR_FAIL(self);
     int r, c; // Get the numer of rows and columns
     r = get_rows(self->mat);
     c = get_cols(self->mat);
@@ -160,6 +671,10 @@ Matrix61c_repr(Matrix61c *self) {
  */
 static PyObject *
 Matrix61c_to_list(Matrix61c *self) {
+    if (self->dtype == DTYPE_FLOAT64) {
+        return list_of_matrix64(self->mat64);
+    }
+    FORCE_OR_FAIL(self);
     int r, c; // Get the numer of rows and columns
     r = get_rows(self->mat);
     c = get_cols(self->mat);
@@ -188,252 +703,1116 @@ static PyMemberDef Matrix61c_members[] = {
     {NULL}  /* Sentinel */
 };
 
-/* Methods of the Matrix class
- * Follows format:
- * Matrix61c_{name of method}
- */
-static PyObject *
-Matrix61c_scale(Matrix61c* self, PyObject* args) {
-    float scale_amt;
-    if (! PyFloat_Check(args)) {
-        if (! PyArg_ParseTuple(args, "f", &scale_amt)) {
-            PyErr_SetString(PyExc_TypeError, "You can only scale by a float");
-            return NULL;
-        }
-    } else {
-        scale_amt = PyLong_AsLong(args);
+static int
+check_dims(int row, int col) {
+    if (row < 1 || col < 1 ) {
+        PyErr_SetString(PyExc_TypeError, "Integer lengths must be positive and non-zero");
+        return -1;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    matrix_scale(self->mat, scale_amt, rv->mat);
-    return (PyObject*)rv;
+    return 0;
 }
 
-static PyObject *
-Matrix61c_power(Matrix61c* self, PyObject* args) {
-    int pwr_amt;
-    if (! PyLong_Check(args)) {
-        if (! PyArg_ParseTuple(args, "i", &pwr_amt)) {
-            PyErr_SetString(PyExc_TypeError, "You can only take the power by an Integer");
-            return NULL;
-        }
-    } else {
-        pwr_amt = PyLong_AsLong(args);
-    }
+/*
+ * A new row x col matrix; zeroed, or left uninitialized for callers that
+ * overwrite every element
+ */
+static Matrix61c *
+Matrix61c_allocated(int row, int col, int zero) {
     Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    matrix_power(self->mat, pwr_amt, rv->mat);
-    return (PyObject*)rv;
-}
-
-static PyObject*
-Matrix61c_uscore_power(Matrix61c* self, PyObject* pow, PyObject* mod) {
-    return Matrix61c_power(self, pow);
+    if (rv == NULL) {
+        return NULL;
+    }
+    if ((zero ? allocate_matrix(&rv->mat, row, col) : allocate_matrix_uninit(&rv->mat, row, col)) == -1) {
+        rv->mat = NULL;
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_TypeError, "Failed to allocate");
+        return NULL;
+    }
+    return rv;
 }
 
-static PyObject *
-Matrix61c_add(Matrix61c* self, PyObject* args) {
-    Matrix61c* other_mat;
-    if (! PyObject_TypeCheck(args, &Matrix61cType)) {
-        if (! PyArg_ParseTuple(args, "O", &other_mat)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '+' with other types");
-            return NULL;
-        }
-        if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '+' with other types");
-            return NULL;
-        }
-    } else {
-        other_mat = (Matrix61c*)args;
+/*
+ * Destinations: every operation can write into an existing matrix passed as
+ * out= (or into self, for the in-place operators) instead of allocating.
+ */
+static int
+overlaps(matrix *a, matrix *b) {
+    if (a->dim.rows == 0 || a->dim.cols == 0 || b->dim.rows == 0 || b->dim.cols == 0) {
+        return 0;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    matrix_add(self->mat, other_mat->mat, rv->mat);
-    return (PyObject*)rv;
+    float *a_end = MAT_ROW(a, a->dim.rows - 1) + a->dim.cols;
+    float *b_end = MAT_ROW(b, b->dim.rows - 1) + b->dim.cols;
+    return a->data < b_end && b->data < a_end;
 }
 
-static PyObject *
-Matrix61c_sub(Matrix61c* self, PyObject* args) {
-    Matrix61c* other_mat;
-    if (! PyObject_TypeCheck(args, &Matrix61cType)) {
-        if (! PyArg_ParseTuple(args, "O", &other_mat)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '-' with other types");
-            return NULL;
-        }
-        if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '-' with other types");
-            return NULL;
-        }
-    } else {
-        other_mat = (Matrix61c*)args;
+/*
+ * Elementwise kernels can write over an operand that is exactly the
+ * destination; anything else sharing memory with it is computed aside.
+ */
+static int
+needs_scratch(matrix *dst, matrix *src, int exact_ok) {
+    if (src == NULL || ! overlaps(dst, src)) {
+        return 0;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    matrix* tmp;
-    allocate_matrix(&tmp, get_rows(self->mat), get_cols(self->mat));
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    matrix_scale(other_mat->mat, -1, tmp);
-    matrix_add(self->mat, tmp, rv->mat);
-    free_matrix(tmp);
-    return (PyObject*)rv;
+    return ! (exact_ok && src->data == dst->data && src->stride == dst->stride);
 }
 
-static PyObject *
-Matrix61c_multiply(Matrix61c* self, PyObject* args) {
-    Matrix61c* other_mat;
-    if (! PyObject_TypeCheck(args, &Matrix61cType)) {
-        if (! PyArg_ParseTuple(args, "O", &other_mat)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '*' with other types");
-            return NULL;
-        }
-        if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
-            PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '*' with other types");
-            return NULL;
-        }
-    } else {
-        other_mat = (Matrix61c*)args;
+// The matrix to compute into: dst itself or a scratch copy of its shape
+static matrix *
+begin_write(matrix *dst, matrix *a, matrix *b, int exact_ok) {
+    matrix *tmp;
+    if (! needs_scratch(dst, a, exact_ok) && ! needs_scratch(dst, b, exact_ok)) {
+        return dst;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(other_mat->mat));
-    matrix_multiply(self->mat, other_mat->mat, rv->mat);
-    return (PyObject*)rv;
+    if (allocate_matrix_uninit(&tmp, dst->dim.rows, dst->dim.cols) == -1) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return tmp;
 }
 
-static PyObject *
-Matrix61c_uscore_multiply(Matrix61c* self, PyObject* args) {
-    if (PyObject_TypeCheck(args, &Matrix61cType)) {
-        return Matrix61c_multiply(self, args);
-    } else if (PyFloat_Check(args)) {
-        return Matrix61c_scale(self, args);
+static void
+end_write(matrix *dst, matrix *used) {
+    if (used != dst) {
+        copy(used, dst);
+        free_matrix(used);
     }
-    PyErr_SetString(PyExc_TypeError, "Numc.matrix only supports '*' with floats and other matricies");
-    return NULL;
 }
 
-
-static PyObject *
-Matrix61c_dot(Matrix61c* self, PyObject* args) {
-    Matrix61c* other_mat;
-    if (! PyArg_ParseTuple(args, "O", &other_mat)) {
-        PyErr_SetString(PyExc_TypeError, "");
+/*
+ * Returns a new reference to out, after checking it can take a rows x cols
+ * result, or to a newly allocated matrix if out is NULL.
+ */
+static Matrix61c *
+Matrix61c_result(Matrix61c *out, int rows, int cols) {
+    if (out == NULL) {
+        return Matrix61c_allocated(rows, cols, 0);
+    }
+    if (! PyObject_TypeCheck(out, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "out must be a numc.Matrix");
         return NULL;
     }
-    if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
-        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support dot with other types");
+    shape s = Matrix61c_shape(out);
+    if (s.rows != rows || s.cols != cols) {
+        PyErr_Format(PyExc_TypeError, "out must be a %d x %d matrix", rows, cols);
         return NULL;
     }
-    if (get_rows(self->mat) != get_rows(other_mat->mat) || get_cols(self->mat) != 1 || get_cols(other_mat->mat) != 1) {
-        PyErr_SetString(PyExc_TypeError, "Dot product can only be of row vectors");
+    if (Matrix61c_prepare_write(out) < 0) {
         return NULL;
     }
-    float rv;
-    dot_product(self->mat, other_mat->mat, &rv);
-    return PyFloat_FromDouble((double)rv);
+    Py_INCREF(out);
+    return out;
 }
 
-static PyObject *
-Matrix61c_transpose(Matrix61c *self) {
+/*
+ * float64 matrices are neither lazy nor views, so their cores are separate
+ * and simpler: a destination can only overlap an operand by being it, which
+ * only the products cannot handle in place.
+ */
+static Matrix61c *
+Matrix61c_allocated64(int row, int col, int zero) {
     Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_cols(self->mat), get_rows(self->mat));
-    matrix_transpose(self->mat, rv->mat);
+    if (rv == NULL) {
+        return NULL;
+    }
+    rv->dtype = DTYPE_FLOAT64;
+    if ((zero ? allocate_matrix64(&rv->mat64, row, col) : allocate_matrix_uninit64(&rv->mat64, row, col)) == -1) {
+        rv->mat64 = NULL;
+        Py_DECREF(rv);
+        PyErr_SetString(PyExc_TypeError, "Failed to allocate");
+        return NULL;
+    }
+    return rv;
+}
+
+// Matrix61c_result for float64 results
+static Matrix61c *
+Matrix61c_result64(Matrix61c *out, int rows, int cols) {
+    if (out == NULL) {
+        return Matrix61c_allocated64(rows, cols, 0);
+    }
+    if (! PyObject_TypeCheck(out, &Matrix61cType) || out->dtype != DTYPE_FLOAT64) {
+        PyErr_SetString(PyExc_TypeError, "out must be a float64 numc.Matrix");
+        return NULL;
+    }
+    if (out->mat64->dim.rows != rows || out->mat64->dim.cols != cols) {
+        PyErr_Format(PyExc_TypeError, "out must be a %d x %d matrix", rows, cols);
+        return NULL;
+    }
+    Py_INCREF(out);
+    return out;
+}
+
+/*
+ * Returns whether the operands of a binary op are float64, or -1 with a
+ * TypeError set if their dtypes differ (there is no implicit promotion)
+ */
+static int
+binary_float64(Matrix61c *a, Matrix61c *b) {
+    if (a->dtype != b->dtype) {
+        PyErr_SetString(PyExc_TypeError, "Matrices must have the same dtype (see astype)");
+        return -1;
+    }
+    return a->dtype == DTYPE_FLOAT64;
+}
+
+// The product's destination, or a scratch matrix when it is an operand
+static matrix64 *
+begin_write64(matrix64 *dst, matrix64 *a, matrix64 *b) {
+    matrix64 *tmp;
+    if (dst != a && dst != b) {
+        return dst;
+    }
+    if (allocate_matrix_uninit64(&tmp, dst->dim.rows, dst->dim.cols) == -1) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return tmp;
+}
+
+static void
+end_write64(matrix64 *dst, matrix64 *used) {
+    if (used != dst) {
+        copy64(used, dst);
+        free_matrix64(used);
+    }
+}
+
+static PyObject *
+Matrix61c_scale64(Matrix61c* self, double scale_amt, Matrix61c* out) {
+    shape s = self->mat64->dim;
+    Matrix61c* rv = Matrix61c_result64(out, s.rows, s.cols);
+    if (rv == NULL) {
+        return NULL;
+    }
+    double elements = (double) s.rows * s.cols;
+    TIMED_WITHOUT_GIL(STAT_SCALE, elements, 16 * elements, elements, matrix_scale64(self->mat64, scale_amt, rv->mat64));
     return (PyObject*)rv;
 }
 
 static PyObject *
-Matrix61c_set_value(Matrix61c *self, PyObject* args) {
+Matrix61c_power64(Matrix61c* self, int pwr_amt, Matrix61c* out) {
+    shape s = self->mat64->dim;
+    if (s.rows != s.cols || pwr_amt < 0) {
+        PyErr_SetString(PyExc_TypeError, "Only square matricies can be raised to a non-negative power");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result64(out, s.rows, s.cols);
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix64 *dst = begin_write64(rv->mat64, self->mat64, NULL);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) s.rows * s.cols;
+    TIMED_WITHOUT_GIL(STAT_POWER, elements, 16 * elements, elements * s.cols, {
+        matrix_power64(self->mat64, pwr_amt, dst);
+        end_write64(rv->mat64, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_elementwise64(Matrix61c* self, Matrix61c* other, Matrix61c* out, expr_op op, numc_stat stat) {
+    shape s = self->mat64->dim;
+    Matrix61c* rv = Matrix61c_result64(out, s.rows, s.cols);
+    if (rv == NULL) {
+        return NULL;
+    }
+    double elements = (double) s.rows * s.cols;
+    TIMED_WITHOUT_GIL(stat, elements, 24 * elements, elements, {
+        if (op == EXPR_ADD) {
+            matrix_add64(self->mat64, other->mat64, rv->mat64);
+        } else if (op == EXPR_SUB) {
+            matrix_sub64(self->mat64, other->mat64, rv->mat64);
+        } else {
+            matrix_multiply_elementwise64(self->mat64, other->mat64, rv->mat64);
+        }
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_multiply64(Matrix61c* self, Matrix61c* other, Matrix61c* out) {
+    shape a = self->mat64->dim, b = other->mat64->dim;
+    if (a.cols != b.rows) {
+        PyErr_SetString(PyExc_TypeError, "Matrix dimensions do not match for multiplication");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result64(out, a.rows, b.cols);
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix64 *dst = begin_write64(rv->mat64, self->mat64, other->mat64);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double m = a.rows, k = a.cols, n = b.cols;
+    TIMED_WITHOUT_GIL(STAT_MULTIPLY, m * n, 8 * (m * k + k * n + m * n), m * k * n, {
+        matrix_multiply64(self->mat64, other->mat64, dst);
+        end_write64(rv->mat64, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_dot64(Matrix61c* self, Matrix61c* other) {
+    shape a = self->mat64->dim, b = other->mat64->dim;
+    if (a.rows != b.rows || a.cols != 1 || b.cols != 1) {
+        PyErr_SetString(PyExc_TypeError, "Dot product can only be of row vectors");
+        return NULL;
+    }
+    double rv;
+    TIMED_WITHOUT_GIL(STAT_DOT, a.rows, 16.0 * a.rows, a.rows, dot_product64(self->mat64, other->mat64, &rv));
+    return PyFloat_FromDouble(rv);
+}
+
+static PyObject *
+Matrix61c_outer64(Matrix61c* self, Matrix61c* other, Matrix61c* out) {
+    shape a = self->mat64->dim, b = other->mat64->dim;
+    if (a.cols != 1 || b.cols != 1) {
+        PyErr_SetString(PyExc_TypeError, "Outer product can only be of row vectors");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result64(out, a.rows, b.rows);
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix64 *dst = begin_write64(rv->mat64, self->mat64, other->mat64);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double m = a.rows, n = b.rows;
+    TIMED_WITHOUT_GIL(STAT_OUTER, m * n, 8 * (m + n + m * n), m * n, {
+        outer_product64(self->mat64, other->mat64, dst);
+        end_write64(rv->mat64, dst);
+    });
+    return (PyObject*)rv;
+}
+
+// A float64 out can only be self when the matrix is square, which transposes in place
+static PyObject *
+Matrix61c_transpose64(Matrix61c* self, Matrix61c* out) {
+    shape s = self->mat64->dim;
+    Matrix61c* rv = Matrix61c_result64(out, s.cols, s.rows);
+    if (rv == NULL) {
+        return NULL;
+    }
+    double elements = (double) s.rows * s.cols;
+    TIMED_WITHOUT_GIL(STAT_TRANSPOSE, elements, 16 * elements, elements, matrix_transpose64(self->mat64, rv->mat64));
+    return (PyObject*)rv;
+}
+
+/* Methods of the Matrix class
+ * Follows format:
+ * Matrix61c_{name of method}
+ *
+ * The ones that produce a matrix have a Matrix61c_{name}_into core taking an
+ * optional destination; the methods, number slots and in-place operators
+ * all go through it.
+ */
+static PyObject *
+Matrix61c_scale_into(Matrix61c* self, double scale_amt, Matrix61c* out) {
+    TRACE_METHOD(STAT_SCALE, self);
+    if (self->dtype == DTYPE_FLOAT64) {
+        return Matrix61c_scale64(self, scale_amt, out);
+    }
+    if (out == NULL && lazy_mode) {
+        return Matrix61c_lazy(self, NULL, EXPR_SCALE, scale_amt, 0);
+    }
+    FORCE_OR_FAIL(self);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, NULL, 1);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(STAT_SCALE, elements, 8 * elements, elements, {
+        matrix_scale(self->mat, scale_amt, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_scale(Matrix61c* self, PyObject* args, PyObject* kwds) {
+    double scale_amt;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "d|$O", kwlist, &scale_amt, &out)) {
+        PyErr_SetString(PyExc_TypeError, "You can only scale by a float");
+        return NULL;
+    }
+    return Matrix61c_scale_into(self, scale_amt, out);
+}
+
+static PyObject *
+Matrix61c_power_into(Matrix61c* self, int pwr_amt, Matrix61c* out) {
+    TRACE_METHOD(STAT_POWER, self);
+    if (self->dtype == DTYPE_FLOAT64) {
+        return Matrix61c_power64(self, pwr_amt, out);
+    }
+    FORCE_OR_FAIL(self);
+    if (get_rows(self->mat) != get_cols(self->mat) || pwr_amt < 0) {
+        PyErr_SetString(PyExc_TypeError, "Only square matricies can be raised to a non-negative power");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, NULL, 0);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(STAT_POWER, elements, 8 * elements, elements * get_cols(self->mat), {
+        matrix_power(self->mat, pwr_amt, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_power(Matrix61c* self, PyObject* args, PyObject* kwds) {
+    int pwr_amt;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "i|$O", kwlist, &pwr_amt, &out)) {
+        PyErr_SetString(PyExc_TypeError, "You can only take the power by an Integer");
+        return NULL;
+    }
+    return Matrix61c_power_into(self, pwr_amt, out);
+}
+
+static PyObject*
+Matrix61c_uscore_power(Matrix61c* self, PyObject* pow, PyObject* mod) {
+    if (! PyLong_Check(pow)) {
+        PyErr_SetString(PyExc_TypeError, "You can only take the power by an Integer");
+        return NULL;
+    }
+    return Matrix61c_power_into(self, PyLong_AsLong(pow), NULL);
+}
+
+/*
+ * add, sub and element_mult: same shapes in, same shape out, and the
+ * destination may be one of the operands
+ */
+static PyObject *
+Matrix61c_elementwise_into(Matrix61c* self, PyObject* other, Matrix61c* out, expr_op op) {
+    numc_stat stat = op == EXPR_ADD ? STAT_ADD : op == EXPR_SUB ? STAT_SUB : STAT_ELEMENT_MULT;
+    TRACE_METHOD(stat, self);
+    if (! PyObject_TypeCheck(other, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, op == EXPR_ADD ? "Numc.matrix does not support '+' with other types"
+                        : op == EXPR_SUB ? "Numc.matrix does not support '-' with other types"
+                        : "Numc.matrix does not support element_mult with other types");
+        return NULL;
+    }
+    Matrix61c* other_mat = (Matrix61c*)other;
+    if (! same_shape(self, other_mat)) {
+        PyErr_SetString(PyExc_TypeError, op == EXPR_ADD ? "Can only add matricies of the same size"
+                        : op == EXPR_SUB ? "Can only subtract matricies of the same size"
+                        : "Element multiply must be of two same sized matricies");
+        return NULL;
+    }
+    int is64 = binary_float64(self, other_mat);
+    if (is64 < 0) {
+        return NULL;
+    } else if (is64) {
+        return Matrix61c_elementwise64(self, other_mat, out, op, stat);
+    }
+    if (out == NULL && lazy_mode) {
+        return Matrix61c_lazy(self, other_mat, op, 0, 0);
+    }
+    FORCE_OR_FAIL(self);
+    FORCE_OR_FAIL(other_mat);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, other_mat->mat, 1);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(stat, elements, 12 * elements, elements, {
+        if (op == EXPR_ADD) {
+            matrix_add(self->mat, other_mat->mat, dst);
+        } else if (op == EXPR_SUB) {
+            matrix_sub(self->mat, other_mat->mat, dst);
+        } else {
+            matrix_multiply_elementwise(self->mat, other_mat->mat, dst);
+        }
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_add(Matrix61c* self, PyObject* args, PyObject* kwds) {
+    PyObject* other;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$O", kwlist, &other, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '+' with other types");
+        return NULL;
+    }
+    return Matrix61c_elementwise_into(self, other, out, EXPR_ADD);
+}
+
+static PyObject *
+Matrix61c_sub(Matrix61c* self, PyObject* args, PyObject* kwds) {
+    PyObject* other;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$O", kwlist, &other, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '-' with other types");
+        return NULL;
+    }
+    return Matrix61c_elementwise_into(self, other, out, EXPR_SUB);
+}
+
+static PyObject *
+Matrix61c_multiply_into(Matrix61c* self, PyObject* other, Matrix61c* out) {
+    TRACE_METHOD(STAT_MULTIPLY, self);
+    if (! PyObject_TypeCheck(other, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '*' with other types");
+        return NULL;
+    }
+    Matrix61c* other_mat = (Matrix61c*)other;
+    int is64 = binary_float64(self, other_mat);
+    if (is64 < 0) {
+        return NULL;
+    } else if (is64) {
+        return Matrix61c_multiply64(self, other_mat, out);
+    }
+    FORCE_OR_FAIL(self);
+    FORCE_OR_FAIL(other_mat);
+    if (get_cols(self->mat) != get_rows(other_mat->mat)) {
+        PyErr_SetString(PyExc_TypeError, "Matrix dimensions do not match for multiplication");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(other_mat->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, other_mat->mat, 0);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double m = get_rows(self->mat), k = get_cols(self->mat), n = get_cols(other_mat->mat);
+    TIMED_WITHOUT_GIL(STAT_MULTIPLY, m * n, 4 * (m * k + k * n + m * n), m * k * n, {
+        matrix_multiply(self->mat, other_mat->mat, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_multiply(Matrix61c* self, PyObject* args, PyObject* kwds) {
+    PyObject* other;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$O", kwlist, &other, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support '*' with other types");
+        return NULL;
+    }
+    return Matrix61c_multiply_into(self, other, out);
+}
+
+/*
+ * '*' is the matrix product with another matrix and scaling with a number,
+ * on either side (2.0 * m works too).
+ */
+static PyObject *
+Matrix61c_times_into(PyObject* a, PyObject* b, Matrix61c* out) {
+    if (! PyObject_TypeCheck(a, &Matrix61cType)) {
+        PyObject* t = a;
+        a = b;
+        b = t;
+    }
+    if (PyObject_TypeCheck(b, &Matrix61cType)) {
+        return Matrix61c_multiply_into((Matrix61c*)a, b, out);
+    } else if (PyFloat_Check(b) || PyLong_Check(b)) {
+        double amt = PyFloat_AsDouble(b);
+        if (amt == -1.0 && PyErr_Occurred()) {
+            return NULL;
+        }
+        return Matrix61c_scale_into((Matrix61c*)a, amt, out);
+    }
+    PyErr_SetString(PyExc_TypeError, "Numc.matrix only supports '*' with floats and other matricies");
+    return NULL;
+}
+
+static PyObject *
+Matrix61c_uscore_multiply(PyObject* self, PyObject* args) {
+    return Matrix61c_times_into(self, args, NULL);
+}
+
+// '@' is always the matrix product
+static PyObject *
+Matrix61c_uscore_matmul(PyObject* self, PyObject* args) {
+    if (! PyObject_TypeCheck(self, &Matrix61cType) || ! PyObject_TypeCheck(args, &Matrix61cType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return Matrix61c_multiply_into((Matrix61c*)self, args, NULL);
+}
+
+static PyObject *
+Matrix61c_uscore_add(PyObject* self, PyObject* args) {
+    if (! PyObject_TypeCheck(self, &Matrix61cType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return Matrix61c_elementwise_into((Matrix61c*)self, args, NULL, EXPR_ADD);
+}
+
+static PyObject *
+Matrix61c_uscore_sub(PyObject* self, PyObject* args) {
+    if (! PyObject_TypeCheck(self, &Matrix61cType)) {
+        Py_RETURN_NOTIMPLEMENTED;
+    }
+    return Matrix61c_elementwise_into((Matrix61c*)self, args, NULL, EXPR_SUB);
+}
+
+/*
+ * In-place operators write the result into self's existing storage, so
+ * `w -= g` in a loop allocates nothing (the matrix products, which cannot
+ * overwrite an operand, still go through a scratch matrix).
+ */
+static PyObject *
+Matrix61c_iadd(Matrix61c* self, PyObject* args) {
+    return Matrix61c_elementwise_into(self, args, self, EXPR_ADD);
+}
+
+static PyObject *
+Matrix61c_isub(Matrix61c* self, PyObject* args) {
+    return Matrix61c_elementwise_into(self, args, self, EXPR_SUB);
+}
+
+static PyObject *
+Matrix61c_imul(Matrix61c* self, PyObject* args) {
+    return Matrix61c_times_into((PyObject*)self, args, self);
+}
+
+static PyObject *
+Matrix61c_imatmul(Matrix61c* self, PyObject* args) {
+    return Matrix61c_multiply_into(self, args, self);
+}
+
+static PyObject *
+Matrix61c_ipow(Matrix61c* self, PyObject* pow, PyObject* mod) {
+    if (! PyLong_Check(pow)) {
+        PyErr_SetString(PyExc_TypeError, "You can only take the power by an Integer");
+        return NULL;
+    }
+    return Matrix61c_power_into(self, PyLong_AsLong(pow), self);
+}
+
+
+static PyObject *
+Matrix61c_dot(Matrix61c* self, PyObject* args) {
+    TRACE_METHOD(STAT_DOT, self);
+    Matrix61c* other_mat;
+    if (! PyArg_ParseTuple(args, "O", &other_mat)) {
+        PyErr_SetString(PyExc_TypeError, "");
+        return NULL;
+    }
+    if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
+        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support dot with other types");
+        return NULL;
+    }
+    int is64 = binary_float64(self, other_mat);
+    if (is64 < 0) {
+        return NULL;
+    } else if (is64) {
+        return Matrix61c_dot64(self, other_mat);
+    }
+    FORCE_OR_FAIL(self);
+    FORCE_OR_FAIL(other_mat);
+    if (get_rows(self->mat) != get_rows(other_mat->mat) || get_cols(self->mat) != 1 || get_cols(other_mat->mat) != 1) {
+        PyErr_SetString(PyExc_TypeError, "Dot product can only be of row vectors");
+        return NULL;
+    }
+    float rv;
+    TIMED_WITHOUT_GIL(STAT_DOT, get_rows(self->mat), 8.0 * get_rows(self->mat), get_rows(self->mat),
+                      dot_product(self->mat, other_mat->mat, &rv));
+    return PyFloat_FromDouble((double)rv);
+}
+
+static PyObject *
+Matrix61c_transpose(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    TRACE_METHOD(STAT_TRANSPOSE, self);
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|$O", kwlist, &out)) {
+        return NULL;
+    }
+    if (self->dtype == DTYPE_FLOAT64) {
+        return Matrix61c_transpose64(self, out);
+    }
+    FORCE_OR_FAIL(self);
+    Matrix61c* rv = Matrix61c_result(out, get_cols(self->mat), get_rows(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    // A square matrix is transposed over itself without a scratch copy
+    matrix *dst = begin_write(rv->mat, self->mat, NULL, get_rows(self->mat) == get_cols(self->mat));
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(STAT_TRANSPOSE, elements, 8 * elements, elements, {
+        matrix_transpose(self->mat, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+static int
+in_bounds(Matrix61c *self, int row, int col) {
+    shape s = Matrix61c_shape(self);
+    return row >= 0 && row < s.rows && col >= 0 && col < s.cols;
+}
+
+static PyObject *
+Matrix61c_set_value(Matrix61c *self, PyObject* args) {
+    int row, col;
+    double val;
+    if (! PyArg_ParseTuple(args, "iid", &row, &col, &val)) {
+        //PyErr_SetString(PyExc_TypeError, "You can only index by integers and must provide a float as the value");
+        return NULL;
+    }
+    if (self->dtype != DTYPE_FLOAT64 && Matrix61c_prepare_write(self) < 0) {
+        return NULL;
+    }
+    if (! in_bounds(self, row, col)) {
+        PyErr_SetString(PyExc_TypeError, "Index out of bounds");
+        return NULL;
+    }
+    Matrix61c_store(self, row, col, val);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Matrix61c_get_value(Matrix61c *self, PyObject* args) {
+    int row, col;
+    if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
+        PyErr_SetString(PyExc_TypeError, "You can only index by integers and must provide a float as the value");
+        return NULL;
+    }
+    if (self->dtype != DTYPE_FLOAT64) {
+        FORCE_OR_FAIL(self);
+    }
+    if (! in_bounds(self, row, col)) {
+        PyErr_SetString(PyExc_TypeError, "Index out of bounds");
+        return NULL;
+    }
+    if (self->dtype == DTYPE_FLOAT64) {
+        return PyFloat_FromDouble(get_loc64(self->mat64, row, col));
+    }
+    return PyFloat_FromDouble(get_loc(self->mat, row, col));
+}
+
+/*
+ * Views: a matrix whose mat points into another matrix's storage (see
+ * view_matrix). The view holds a reference to the owner of the storage, never
+ * to another view, so chains of views stay one level deep.
+ */
+static PyObject *
+Matrix61c_view(Matrix61c *self, int row, int col, int rows, int cols, int row_step) {
+    FORCE_OR_FAIL(self);
+    Matrix61c *owner = self->parent != NULL ? self->parent : self;
+    // Writes through the view bypass owner, so settle pending readers of it now
+    if (Matrix61c_prepare_write(owner) < 0) {
+        return NULL;
+    }
+    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
+    if (rv == NULL) {
+        return NULL;
+    }
+    if (view_matrix(&rv->mat, self->mat, row, col, rows, cols, row_step) == -1) {
+        rv->mat = NULL;
+        Py_DECREF(rv);
+        return PyErr_NoMemory();
+    }
+    Py_INCREF(owner);
+    rv->parent = owner;
+    owner->views++;
+    return (PyObject*)rv;
+}
+
+/*
+ * Shrinking is a view of the top left corner; growing copies into a new,
+ * zero padded matrix.
+ */
+static PyObject *
+Matrix61c_resize(Matrix61c *self, PyObject* args) {
+    int row, col;
+    if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
+        PyErr_SetString(PyExc_TypeError, "You must resize to interger lengths for rows and columns");
+        return NULL;
+    }
+    if (row < 0 || col < 0 ) {
+        PyErr_SetString(PyExc_TypeError, "Integers must be positive");
+        return NULL;
+    }
+    FORCE_OR_FAIL(self);
+    int self_rows = get_rows(self->mat);
+    int self_cols = get_cols(self->mat);
+    if (row <= self_rows && col <= self_cols) {
+        return Matrix61c_view(self, 0, 0, row, col, 1);
+    }
+
+    Matrix61c* rv = Matrix61c_allocated(row, col, 1);
+    if (rv == NULL) {
+        return NULL;
+    }
+    int min_row = (self_rows > row) ? row : self_rows;
+    int min_col = (self_cols > col) ? col : self_cols;
+    for (int i = 0; i < min_row; i++) {
+        memcpy(MAT_ROW(rv->mat, i), MAT_ROW(self->mat, i), min_col * sizeof(float));
+    }
+    return (PyObject*)rv;
+}
+
+/*
+ * Same elements in row-major order, new shape. A view when the data is
+ * contiguous, a copy otherwise.
+ */
+static PyObject *
+Matrix61c_reshape(Matrix61c *self, PyObject* args) {
+    int row, col;
+    if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
+        PyErr_SetString(PyExc_TypeError, "You must reshape to interger lengths for rows and columns");
+        return NULL;
+    }
+    FORCE_OR_FAIL(self);
+    matrix *m = self->mat;
+    if (row < 0 || col < 0 || (size_t) row * col != (size_t) m->dim.rows * m->dim.cols) {
+        PyErr_SetString(PyExc_TypeError, "Reshaping must keep the number of elements");
+        return NULL;
+    }
+    if (m->stride == m->dim.cols || m->dim.rows <= 1) {
+        Matrix61c* rv = (Matrix61c*) Matrix61c_view(self, 0, 0, 0, 0, 1);
+        if (rv == NULL) {
+            return NULL;
+        }
+        rv->mat->dim.rows = row;
+        rv->mat->dim.cols = col;
+        rv->mat->stride = col;
+        return (PyObject*)rv;
+    }
+    Matrix61c* rv = Matrix61c_allocated(row, col, 0);
+    float *arr = malloc((size_t) row * col * sizeof(float));
+    if (rv == NULL || arr == NULL) {
+        Py_XDECREF(rv);
+        free(arr);
+        return rv == NULL ? NULL : PyErr_NoMemory();
+    }
+    get_matrix_as_array(arr, m);
+    for (int i = 0; i < row; i++) {
+        memcpy(MAT_ROW(rv->mat, i), arr + (size_t) i * col, col * sizeof(float));
+    }
+    free(arr);
+    return (PyObject*)rv;
+}
+
+static PyObject *
+Matrix61c_get_rows(Matrix61c *self) {
+    return PyLong_FromLong((long)Matrix61c_shape(self).rows);
+}
+
+static PyObject *
+Matrix61c_get_cols(Matrix61c *self) {
+    return PyLong_FromLong((long)Matrix61c_shape(self).cols);
+}
+
+/*
+ * Bulk constructors. None of them create a Python object per element:
+ * the data is filled, memcpy'd or read straight into the rows.
+ */
+static PyObject *
+Matrix61c_full(Matrix61c *cls, PyObject* args) {
     int row, col;
     float val;
     if (! PyArg_ParseTuple(args, "iif", &row, &col, &val)) {
-        //PyErr_SetString(PyExc_TypeError, "You can only index by integers and must provide a float as the value");
+        PyErr_SetString(PyExc_TypeError, "You must provide interger lengths for rows and columns and a float value");
         return NULL;
     }
-    if (row < 0 || row >= get_rows(self->mat) || col < 0 || col >= get_cols(self->mat)) {
-        PyErr_SetString(PyExc_TypeError, "Index out of bounds");
+    if (check_dims(row, col) < 0) {
         return NULL;
     }
-    set_loc(self->mat, row, col, val);
-    Py_RETURN_NONE;
+    Matrix61c* rv = Matrix61c_allocated(row, col, 0);
+    if (rv != NULL) {
+        WITHOUT_GIL((double) row * col, fill_matrix(rv->mat, val));
+    }
+    return (PyObject*)rv;
 }
 
 static PyObject *
-Matrix61c_get_value(Matrix61c *self, PyObject* args) {
+Matrix61c_new_filled(PyObject* args, int zero) {
     int row, col;
     if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
-        PyErr_SetString(PyExc_TypeError, "You can only index by integers and must provide a float as the value");
+        PyErr_SetString(PyExc_TypeError, "You must provide interger lengths for rows and columns");
         return NULL;
     }
-    if (row < 0 || row >= get_rows(self->mat) || col < 0 || col >= get_cols(self->mat)) {
-        PyErr_SetString(PyExc_TypeError, "Index out of bounds");
+    if (check_dims(row, col) < 0) {
         return NULL;
     }
-    return PyFloat_FromDouble(get_loc(self->mat, row, col));
+    return (PyObject*)Matrix61c_allocated(row, col, zero);
 }
 
 static PyObject *
-Matrix61c_resize(Matrix61c *self, PyObject* args) {
+Matrix61c_zeros(Matrix61c *cls, PyObject* args) {
+    return Matrix61c_new_filled(args, 1);
+}
+
+static PyObject *
+Matrix61c_empty(Matrix61c *cls, PyObject* args) {
+    return Matrix61c_new_filled(args, 0);
+}
+
+static PyObject *
+Matrix61c_ones(Matrix61c *cls, PyObject* args) {
     int row, col;
     if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
-        PyErr_SetString(PyExc_TypeError, "You must resize to interger lengths for rows and columns");
+        PyErr_SetString(PyExc_TypeError, "You must provide interger lengths for rows and columns");
         return NULL;
     }
-    if (row < 0 || col < 0 ) {
-        PyErr_SetString(PyExc_TypeError, "Integers must be positive");
+    if (check_dims(row, col) < 0) {
         return NULL;
     }
-    int self_rows = get_rows(self->mat);
-    int self_cols = get_cols(self->mat);
+    Matrix61c* rv = Matrix61c_allocated(row, col, 0);
+    if (rv != NULL) {
+        WITHOUT_GIL((double) row * col, fill_matrix(rv->mat, 1.0));
+    }
+    return (PyObject*)rv;
+}
 
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    float* src = malloc(sizeof(float) * self_rows * self_cols);
-    float* dst = malloc(sizeof(float) * row * col);
-    get_matrix_as_array(src, self->mat);
-    int i;
-    int min_col = (self_cols > col) ? col : self_cols;
-    for (i = 0; i < row; i++) {
-        if (i >= self_rows) {
-            memset(dst + i * col, 0, col);
-        } else {
-            memcpy(dst + i * col, src + i * self_cols, min_col);
-            if (min_col < col) {
-                memset(dst + i * col + min_col, 0, col - min_col);
-            }
-        }
+/*
+ * Matrix.frombuffer(obj, rows, cols, copy=False)
+ * Reads the bytes of obj as rows * cols float32 values in row-major order.
+ * A writable, contiguous, 4-byte aligned buffer is wrapped without a copy
+ * (obj stays alive as long as the matrix does and sees its writes); anything
+ * else, or copy=True, is copied into a new matrix.
+ */
+static PyObject *
+Matrix61c_frombuffer(Matrix61c *cls, PyObject* args, PyObject* kwds) {
+    PyObject *obj;
+    int row, col, force_copy = 0;
+    static char *kwlist[] = {"", "", "", "copy", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "Oii|p", kwlist, &obj, &row, &col, &force_copy)) {
+        return NULL;
     }
+    if (check_dims(row, col) < 0) {
+        return NULL;
+    }
+    size_t bytes = (size_t) row * col * sizeof(float);
 
-    rv->mat = arr_to_matrix(dst, row, col);
-    free(src);
-    free(dst);
+    Py_buffer view;
+    int writable = ! force_copy && PyObject_GetBuffer(obj, &view, PyBUF_WRITABLE) == 0;
+    if (! writable) {
+        PyErr_Clear();
+        if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0) {
+            return NULL;
+        }
+    }
+    if ((size_t) view.len != bytes) {
+        PyBuffer_Release(&view);
+        PyErr_Format(PyExc_TypeError, "Buffer holds %zd bytes, %zu needed for a %d x %d matrix",
+                     view.len, bytes, row, col);
+        return NULL;
+    }
 
+    Matrix61c* rv;
+    if (writable && (uintptr_t) view.buf % sizeof(float) == 0) {
+        rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
+        if (rv == NULL || wrap_matrix(&rv->mat, view.buf, row, col, col) == -1) {
+            PyBuffer_Release(&view);
+            Py_XDECREF(rv);
+            return rv == NULL ? NULL : PyErr_NoMemory();
+        }
+        rv->base = view;
+        rv->has_base = 1;
+        return (PyObject*)rv;
+    }
+    rv = Matrix61c_allocated(row, col, 0);
+    if (rv != NULL) {
+        matrix *m = rv->mat;
+        WITHOUT_GIL((double) row * col, {
+            if (m->stride == col) {
+                memcpy(m->data, view.buf, bytes);
+            } else {
+                for (int i = 0; i < row; i++) {
+                    memcpy(MAT_ROW(m, i), (const char *) view.buf + (size_t) i * col * sizeof(float), col * sizeof(float));
+                }
+            }
+        });
+    }
+    PyBuffer_Release(&view);
     return (PyObject*)rv;
 }
 
+/*
+ * Matrix.fromfile(path, rows, cols)
+ * Reads a file of exactly rows * cols raw float32 values (row-major, native
+ * byte order) straight into the matrix rows.
+ */
 static PyObject *
-Matrix61c_get_rows(Matrix61c *self) {
-    return PyLong_FromLong((long)get_rows(self->mat));
+Matrix61c_fromfile(Matrix61c *cls, PyObject* args) {
+    PyObject *name, *path;
+    int row, col;
+    if (! PyArg_ParseTuple(args, "Oii", &name, &row, &col)) {
+        return NULL;
+    }
+    if (check_dims(row, col) < 0 || ! PyUnicode_FSConverter(name, &path)) {
+        return NULL;
+    }
+    FILE *f = fopen(PyBytes_AS_STRING(path), "rb");
+    Py_DECREF(path);
+    if (f == NULL) {
+        PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_allocated(row, col, 0);
+    if (rv == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    matrix *m = rv->mat;
+    int ok = 1;
+    // File reads may block, so never hold the GIL for them
+    Py_BEGIN_ALLOW_THREADS
+    if (m->stride == col) {
+        ok = fread(m->data, sizeof(float), (size_t) row * col, f) == (size_t) row * col;
+    } else {
+        for (int i = 0; i < row && ok; i++) {
+            ok = fread(MAT_ROW(m, i), sizeof(float), col, f) == (size_t) col;
+        }
+    }
+    ok = ok && fgetc(f) == EOF;
+    fclose(f);
+    Py_END_ALLOW_THREADS
+    if (! ok) {
+        Py_DECREF(rv);
+        PyErr_Format(PyExc_TypeError, "File does not hold exactly %d x %d float32 values", row, col);
+        return NULL;
+    }
+    return (PyObject*)rv;
+}
+
+/* "fp16" or "bf16"; -1 with TypeError set for anything else */
+static int
+parse_half_format(const char *name) {
+    for (int f = 0; f < HALF_FORMAT_COUNT; f++) {
+        if (strcmp(name, half_format_name(f)) == 0) {
+            return f;
+        }
+    }
+    PyErr_Format(PyExc_TypeError, "Unknown 16-bit format '%s' (expected 'fp16' or 'bf16')", name);
+    return -1;
 }
 
+/*
+ * m.to_half(format="fp16")
+ * Returns the elements as bytes of rows * cols 16-bit floats (row-major,
+ * native byte order), rounded to nearest even: half the size of float32, for
+ * storing weights or handing them to code that works on the compact form.
+ */
 static PyObject *
-Matrix61c_get_cols(Matrix61c *self) {
-    return PyLong_FromLong((long)get_cols(self->mat));
+Matrix61c_to_half(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    const char *name = "fp16";
+    static char *kwlist[] = {"format", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|s", kwlist, &name)) {
+        return NULL;
+    }
+    int format = parse_half_format(name);
+    if (format < 0) {
+        return NULL;
+    }
+    FORCE_OR_FAIL(self);
+    int row = get_rows(self->mat), col = get_cols(self->mat);
+    PyObject *rv = PyBytes_FromStringAndSize(NULL, (Py_ssize_t) row * col * sizeof(uint16_t));
+    matrix16 *dst;
+    if (rv == NULL) {
+        return NULL;
+    }
+    if (wrap_matrix16(&dst, (uint16_t *) PyBytes_AS_STRING(rv), row, col, col, format) == -1) {
+        Py_DECREF(rv);
+        return PyErr_NoMemory();
+    }
+    matrix *src = self->mat;
+    WITHOUT_GIL((double) row * col, matrix16_from_float(src, dst));
+    free_matrix16(dst);
+    return rv;
 }
 
+/*
+ * Matrix.from_half(obj, rows, cols, format="fp16")
+ * Reads the bytes of obj as rows * cols 16-bit floats in row-major order and
+ * widens them into a new float32 matrix. The inverse of to_half, exact.
+ */
 static PyObject *
-Matrix61c_ones(Matrix61c *cls, PyObject* args) {
+Matrix61c_from_half(Matrix61c *cls, PyObject* args, PyObject* kwds) {
+    PyObject *obj;
     int row, col;
-    if (! PyArg_ParseTuple(args, "ii", &row, &col)) {
-        PyErr_SetString(PyExc_TypeError, "You must provide interger lengths for rows and columns");
+    const char *name = "fp16";
+    static char *kwlist[] = {"", "", "", "format", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "Oii|s", kwlist, &obj, &row, &col, &name)) {
         return NULL;
     }
-    if (row < 1 || col < 1 ) {
-        PyErr_SetString(PyExc_TypeError, "Integer lengths must be positive and non-zero");
+    int format = parse_half_format(name);
+    if (format < 0 || check_dims(row, col) < 0) {
         return NULL;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, row, col);
-    for (int i = 0; i < row; i++) {
-        for (int j = 0; j < col; j++) {
-            set_loc(rv->mat, i, j, 1.0);
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0) {
+        return NULL;
+    }
+    size_t bytes = (size_t) row * col * sizeof(uint16_t);
+    if ((size_t) view.len != bytes) {
+        PyBuffer_Release(&view);
+        PyErr_Format(PyExc_TypeError, "Buffer holds %zd bytes, %zu needed for a %d x %d matrix of 16-bit values",
+                     view.len, bytes, row, col);
+        return NULL;
+    }
+    // The kernels load 16-bit lanes, so an odd address gets a copy first
+    void *copy_buf = NULL;
+    uint16_t *data = view.buf;
+    if ((uintptr_t) view.buf % sizeof(uint16_t) != 0) {
+        data = copy_buf = malloc(bytes > 0 ? bytes : 1);
+        if (copy_buf == NULL) {
+            PyBuffer_Release(&view);
+            return PyErr_NoMemory();
         }
+        memcpy(copy_buf, view.buf, bytes);
     }
+    matrix16 *src;
+    Matrix61c* rv = NULL;
+    if (wrap_matrix16(&src, data, row, col, col, format) == -1) {
+        PyErr_NoMemory();
+    } else {
+        rv = Matrix61c_allocated(row, col, 0);
+        if (rv != NULL) {
+            matrix *dst = rv->mat;
+            WITHOUT_GIL((double) row * col, matrix16_to_float(src, dst));
+        }
+        free_matrix16(src);
+    }
+    free(copy_buf);
+    PyBuffer_Release(&view);
     return (PyObject*)rv;
 }
 
@@ -444,62 +1823,321 @@ Matrix61c_row(Matrix61c *self, PyObject* args) {
         PyErr_SetString(PyExc_TypeError, "You can only index by integers and must provide a float as the value");
         return NULL;
     }
+    FORCE_OR_FAIL(self);
     if (row < 0 || row >= get_rows(self->mat)) {
         PyErr_SetString(PyExc_TypeError, "Index out of bounds");
         return NULL;
     }
-    int col = get_cols(self->mat);
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, 1, col);
-    float val;
-    for (int j = 0; j < col; j++) {
-        val = get_loc(self->mat, row, j);
-        set_loc(rv->mat, 0, j, val);
+    return Matrix61c_view(self, row, 0, 1, get_cols(self->mat), 1);
+}
+
+/*
+ * Indexing: m[i] is row i, m[i, j] the float at (i, j), and slices give views,
+ * e.g. m[10:20, 5:] or m[::2, :]. An integer next to a slice keeps its
+ * dimension, so m[3, 1:4] is a 1 x 3 view. Column slices need a step of 1.
+ */
+typedef struct index_range {
+    int start;
+    int count;
+    int step;
+    int is_int;
+} index_range;
+
+static int
+parse_index(PyObject *key, int len, index_range *r) {
+    if (PyIndex_Check(key)) {
+        Py_ssize_t i = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (i == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (i < 0) {
+            i += len;
+        }
+        if (i < 0 || i >= len) {
+            PyErr_SetString(PyExc_TypeError, "Index out of bounds");
+            return -1;
+        }
+        r->start = i;
+        r->count = 1;
+        r->step = 1;
+        r->is_int = 1;
+        return 0;
     }
-    return (PyObject*)rv;
+    if (PySlice_Check(key)) {
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(key, &start, &stop, &step) < 0) {
+            return -1;
+        }
+        if (step < 1) {
+            PyErr_SetString(PyExc_TypeError, "Matrix slices must have a positive step");
+            return -1;
+        }
+        r->count = PySlice_AdjustIndices(len, &start, &stop, step);
+        r->start = r->count > 0 ? start : 0;
+        r->step = step;
+        r->is_int = 0;
+        return 0;
+    }
+    PyErr_SetString(PyExc_TypeError, "Matrix indices must be integers or slices");
+    return -1;
+}
+
+// Splits key into row and column ranges of self
+static int
+parse_key(Matrix61c *self, PyObject *key, index_range *rows, index_range *cols) {
+    shape s = Matrix61c_shape(self);
+    if (PyTuple_Check(key)) {
+        if (PyTuple_GET_SIZE(key) != 2) {
+            PyErr_SetString(PyExc_TypeError, "Matrices take one or two indices");
+            return -1;
+        }
+        if (parse_index(PyTuple_GET_ITEM(key, 0), s.rows, rows) < 0
+                || parse_index(PyTuple_GET_ITEM(key, 1), s.cols, cols) < 0) {
+            return -1;
+        }
+        if (cols->step != 1 && cols->count > 1) {
+            PyErr_SetString(PyExc_TypeError, "Column slices must have a step of 1");
+            return -1;
+        }
+        return 0;
+    }
+    if (parse_index(key, s.rows, rows) < 0) {
+        return -1;
+    }
+    cols->start = 0;
+    cols->count = s.cols;
+    cols->step = 1;
+    cols->is_int = 0;
+    return 0;
+}
+
+static Py_ssize_t
+Matrix61c_length(Matrix61c *self) {
+    return Matrix61c_shape(self).rows;
 }
 
 static PyObject *
-Matrix61c_tanh(Matrix61c *self) {
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    apply_func(self->mat, rv->mat, tanhf);
-    return (PyObject*)rv;
+Matrix61c_subscript(Matrix61c *self, PyObject *key) {
+    index_range rows, cols;
+    if (self->dtype != DTYPE_FLOAT64) {
+        FORCE_OR_FAIL(self);
+    }
+    if (parse_key(self, key, &rows, &cols) < 0) {
+        return NULL;
+    }
+    if (rows.is_int && cols.is_int && PyTuple_Check(key)) {
+        if (self->dtype == DTYPE_FLOAT64) {
+            return PyFloat_FromDouble(get_loc64(self->mat64, rows.start, cols.start));
+        }
+        return PyFloat_FromDouble(get_loc(self->mat, rows.start, cols.start));
+    }
+    return Matrix61c_view(self, rows.start, cols.start, rows.count, cols.count, rows.step);
+}
+
+/*
+ * m[key] = x fills the selected elements with a number, or copies a matrix of
+ * the same shape into them (float32 only: float64 selections can only be
+ * filled, and read back one element at a time).
+ */
+static int
+Matrix61c_ass_subscript(Matrix61c *self, PyObject *key, PyObject *value) {
+    index_range rows, cols;
+    if (value == NULL) {
+        PyErr_SetString(PyExc_TypeError, "Matrix elements cannot be deleted");
+        return -1;
+    }
+    if (self->dtype == DTYPE_FLOAT64 && ! PyObject_TypeCheck(value, &Matrix61cType)) {
+        if (parse_key(self, key, &rows, &cols) < 0) {
+            return -1;
+        }
+        double val = PyFloat_AsDouble(value);
+        if (val == -1.0 && PyErr_Occurred()) {
+            PyErr_SetString(PyExc_TypeError, "Can only assign numbers or matrices");
+            return -1;
+        }
+        matrix64 *region;
+        if (view_matrix64(&region, self->mat64, rows.start, cols.start, rows.count, cols.count, rows.step) == -1) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        WITHOUT_GIL((double) rows.count * cols.count, fill_matrix64(region, val));
+        free_matrix64(region);
+        return 0;
+    }
+    if (Matrix61c_force(self) < 0 || parse_key(self, key, &rows, &cols) < 0) {
+        return -1;
+    }
+    Matrix61c *src = NULL;
+    double val = 0;
+    if (PyObject_TypeCheck(value, &Matrix61cType)) {
+        src = (Matrix61c*)value;
+        if (Matrix61c_force(src) < 0) {
+            return -1;
+        }
+        if (get_rows(src->mat) != rows.count || get_cols(src->mat) != cols.count) {
+            PyErr_SetString(PyExc_TypeError, "Assigned matrix must have the shape of the selection");
+            return -1;
+        }
+    } else {
+        val = PyFloat_AsDouble(value);
+        if (val == -1.0 && PyErr_Occurred()) {
+            PyErr_SetString(PyExc_TypeError, "Can only assign numbers or matrices");
+            return -1;
+        }
+    }
+    if (Matrix61c_prepare_write(self->parent != NULL ? self->parent : self) < 0) {
+        return -1;
+    }
+    matrix *region;
+    if (view_matrix(&region, self->mat, rows.start, cols.start, rows.count, cols.count, rows.step) == -1) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (src == NULL) {
+        WITHOUT_GIL((double) rows.count * cols.count, fill_matrix(region, (float) val));
+    } else {
+        matrix *dst = begin_write(region, src->mat, NULL, 1);
+        if (dst == NULL) {
+            free_matrix(region);
+            return -1;
+        }
+        WITHOUT_GIL((double) rows.count * cols.count, {
+            copy(src->mat, dst);
+            end_write(region, dst);
+        });
+    }
+    free_matrix(region);
+    return 0;
 }
 
+/*
+ * Elementwise functions run through the vectorized math library (apply_math)
+ */
 static PyObject *
-Matrix61c_sigmoid(Matrix61c *self) {
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(self->mat));
-    apply_func(self->mat, rv->mat, sigmoid);
+Matrix61c_apply_math_into(Matrix61c *self, math_func f, Matrix61c *out) {
+    TRACE_METHOD(STAT_MATH + f, self);
+    if (Matrix61c_require_float32(self) < 0) {
+        return NULL;
+    }
+    if (out == NULL && lazy_mode) {
+        return Matrix61c_lazy(self, NULL, EXPR_MATH, 0, f);
+    }
+    FORCE_OR_FAIL(self);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, NULL, 1);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(STAT_MATH + f, elements, 8 * elements, elements, {
+        apply_math(self->mat, dst, f);
+        end_write(rv->mat, dst);
+    });
     return (PyObject*)rv;
 }
 
 static PyObject *
-Matrix61c_ele_mul(Matrix61c *self, PyObject* args) {
-    Matrix61c* other_mat;
-    if (! PyArg_ParseTuple(args, "O", &other_mat)) {
-        PyErr_SetString(PyExc_TypeError, "");
+Matrix61c_apply_math(Matrix61c *self, PyObject* args, PyObject* kwds, math_func f) {
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|$O", kwlist, &out)) {
         return NULL;
     }
-    if (! PyObject_TypeCheck(other_mat, &Matrix61cType)) {
-        PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support element_mult with other types");
+    return Matrix61c_apply_math_into(self, f, out);
+}
+
+static PyObject *
+Matrix61c_tanh(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_TANH);
+}
+
+static PyObject *
+Matrix61c_sigmoid(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_SIGMOID);
+}
+
+static PyObject *
+Matrix61c_exp(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_EXP);
+}
+
+static PyObject *
+Matrix61c_log(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_LOG);
+}
+
+static PyObject *
+Matrix61c_relu(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_RELU);
+}
+
+static PyObject *
+Matrix61c_abs(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    return Matrix61c_apply_math(self, args, kwds, MATH_ABS);
+}
+
+static PyObject *
+Matrix61c_uscore_abs(Matrix61c *self) {
+    return Matrix61c_apply_math_into(self, MATH_ABS, NULL);
+}
+
+static PyObject *
+Matrix61c_ele_pow(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    TRACE_METHOD(STAT_ELEMENT_POW, self);
+    float exponent;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "f|$O", kwlist, &exponent, &out)) {
+        PyErr_SetString(PyExc_TypeError, "You can only raise elements to a float power");
         return NULL;
     }
-    if (get_rows(self->mat) != get_rows(other_mat->mat) || get_cols(self->mat) != get_cols(other_mat->mat)) {
-        PyErr_SetString(PyExc_TypeError, "Element multiply must be of two same sized matricies");
+    if (Matrix61c_require_float32(self) < 0) {
         return NULL;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_cols(other_mat->mat));
-    matrix_multiply_elementwise(self->mat, other_mat->mat, rv->mat);
+    if (out == NULL && lazy_mode) {
+        return Matrix61c_lazy(self, NULL, EXPR_POW, exponent, 0);
+    }
+    FORCE_OR_FAIL(self);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_cols(self->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, NULL, 1);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double elements = (double) get_rows(self->mat) * get_cols(self->mat);
+    TIMED_WITHOUT_GIL(STAT_ELEMENT_POW, elements, 8 * elements, elements, {
+        matrix_pow_elementwise(self->mat, exponent, dst);
+        end_write(rv->mat, dst);
+    });
     return (PyObject*)rv;
 }
 
 static PyObject *
-Matrix61c_outer(Matrix61c *self, PyObject* args) {
+Matrix61c_ele_mul(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    PyObject* other;
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$O", kwlist, &other, &out)) {
+        PyErr_SetString(PyExc_TypeError, "");
+        return NULL;
+    }
+    return Matrix61c_elementwise_into(self, other, out, EXPR_MUL);
+}
+
+static PyObject *
+Matrix61c_outer(Matrix61c *self, PyObject* args, PyObject* kwds) {
+    TRACE_METHOD(STAT_OUTER, self);
     Matrix61c* other_mat;
-    if (! PyArg_ParseTuple(args, "O", &other_mat)) {
+    Matrix61c* out = NULL;
+    static char *kwlist[] = {"", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$O", kwlist, &other_mat, &out)) {
         PyErr_SetString(PyExc_TypeError, "Unsupported type passed as argument");
         return NULL;
     }
@@ -507,73 +2145,239 @@ Matrix61c_outer(Matrix61c *self, PyObject* args) {
         PyErr_SetString(PyExc_TypeError, "Numc.matrix does not support outer with other types");
         return NULL;
     }
+    int is64 = binary_float64(self, other_mat);
+    if (is64 < 0) {
+        return NULL;
+    } else if (is64) {
+        return Matrix61c_outer64(self, other_mat, out);
+    }
+    FORCE_OR_FAIL(self);
+    FORCE_OR_FAIL(other_mat);
     if (get_cols(self->mat) != 1 || get_cols(other_mat->mat) != 1) {
         PyErr_SetString(PyExc_TypeError, "Outer product can only be of row vectors");
         return NULL;
     }
-    Matrix61c* rv = (Matrix61c*) Matrix61c_new(&Matrix61cType, NULL, NULL);
-    allocate_matrix(&rv->mat, get_rows(self->mat), get_rows(other_mat->mat));
-    outer_product(self->mat, other_mat->mat, rv->mat);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(self->mat), get_rows(other_mat->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, self->mat, other_mat->mat, 0);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    double m = get_rows(self->mat), n = get_rows(other_mat->mat);
+    TIMED_WITHOUT_GIL(STAT_OUTER, m * n, 4 * (m + n + m * n), m * n, {
+        outer_product(self->mat, other_mat->mat, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+/*
+ * A copy converted to dtype. Widening to float64 is exact; narrowing rounds
+ * each element to the nearest float.
+ */
+static PyObject *
+Matrix61c_astype(Matrix61c *self, PyObject* args) {
+    const char *name;
+    if (! PyArg_ParseTuple(args, "s", &name)) {
+        return NULL;
+    }
+    int dtype = parse_dtype(name);
+    if (dtype < 0) {
+        return NULL;
+    }
+    if (self->dtype != DTYPE_FLOAT64) {
+        FORCE_OR_FAIL(self);
+    }
+    shape s = Matrix61c_shape(self);
+    Matrix61c* rv = dtype == DTYPE_FLOAT64 ? Matrix61c_allocated64(s.rows, s.cols, 0)
+                                           : Matrix61c_allocated(s.rows, s.cols, 0);
+    if (rv == NULL) {
+        return NULL;
+    }
+    WITHOUT_GIL((double) s.rows * s.cols, {
+        if (self->dtype == DTYPE_FLOAT64 && dtype == DTYPE_FLOAT64) {
+            copy64(self->mat64, rv->mat64);
+        } else if (self->dtype == DTYPE_FLOAT64) {
+            matrix64_to_float(self->mat64, rv->mat);
+        } else if (dtype == DTYPE_FLOAT64) {
+            matrix_to_double(self->mat, rv->mat64);
+        } else {
+            copy(self->mat, rv->mat);
+        }
+    });
     return (PyObject*)rv;
 }
 
+static PyObject *
+Matrix61c_get_dtype(Matrix61c *self, void *closure) {
+    return PyUnicode_FromString(dtype_names[self->dtype]);
+}
+
+static PyGetSetDef Matrix61c_getset[] = {
+    {"dtype", (getter)Matrix61c_get_dtype, NULL, "Element type: 'float32' or 'float64'", NULL},
+    {NULL}  /* Sentinel */
+};
+
 /* Defines all of the methods of the matrix*/
 static PyMethodDef Matrix61c_methods[] = {
-    {"scale", (PyCFunction)Matrix61c_scale, METH_VARARGS,
+    {"scale", (PyCFunction)(void(*)(void))Matrix61c_scale, METH_VARARGS | METH_KEYWORDS,
      "Scales the matrix by `amt`"},
-    {"power", (PyCFunction)Matrix61c_power, METH_VARARGS,
+    {"power", (PyCFunction)(void(*)(void))Matrix61c_power, METH_VARARGS | METH_KEYWORDS,
     "Raises the matrix to the `amt` power"},
-    {"add", (PyCFunction)Matrix61c_add, METH_VARARGS,
+    {"add", (PyCFunction)(void(*)(void))Matrix61c_add, METH_VARARGS | METH_KEYWORDS,
     "Adds two matricies together"},
-    {"sub", (PyCFunction)Matrix61c_sub, METH_VARARGS,
+    {"sub", (PyCFunction)(void(*)(void))Matrix61c_sub, METH_VARARGS | METH_KEYWORDS,
     "Subtracts one matrix from another"},
-    {"multiply", (PyCFunction)Matrix61c_multiply, METH_VARARGS,
+    {"multiply", (PyCFunction)(void(*)(void))Matrix61c_multiply, METH_VARARGS | METH_KEYWORDS,
     "Multiplies two matricies together"},
     {"to_list", (PyCFunction)Matrix61c_to_list, METH_NOARGS,
     "Returns a list that represents the matrix"},
+    {"astype", (PyCFunction)Matrix61c_astype, METH_VARARGS,
+    "Returns a copy of the matrix with elements of dtype 'float32' or 'float64'"},
     {"dot", (PyCFunction)Matrix61c_dot, METH_VARARGS,
     "Returns a float of the dot product of two row vectors"},
-    {"element_mult", (PyCFunction)Matrix61c_ele_mul, METH_VARARGS,
+    {"element_mult", (PyCFunction)(void(*)(void))Matrix61c_ele_mul, METH_VARARGS | METH_KEYWORDS,
     "Multiplies element by element in the matricies provided"},
-    {"outer", (PyCFunction)Matrix61c_outer, METH_VARARGS,
+    {"outer", (PyCFunction)(void(*)(void))Matrix61c_outer, METH_VARARGS | METH_KEYWORDS,
     "Performs the outer product of two vectors"},
-    {"transpose", (PyCFunction)Matrix61c_transpose, METH_NOARGS,
+    {"transpose", (PyCFunction)(void(*)(void))Matrix61c_transpose, METH_VARARGS | METH_KEYWORDS,
     "Returns transpose of the matrix"},
     {"set", (PyCFunction)Matrix61c_set_value, METH_VARARGS,
     "Sets the value at location (row, col) to val"},
     {"get", (PyCFunction)Matrix61c_get_value, METH_VARARGS,
     "Gets the value at location (row, col) to val"},
     {"resize", (PyCFunction)Matrix61c_resize, METH_VARARGS,
-    "Returns a new matrix with the new size, filled with zeros if made larger"},
+    "Returns the matrix cut to the new size (a view), or a copy filled with zeros if made larger"},
     {"getRow", (PyCFunction)Matrix61c_row, METH_VARARGS,
-    "Returns a row of the matrix as a new matrix"},
-    {"tanh", (PyCFunction)Matrix61c_tanh, METH_NOARGS,
+    "Returns a row of the matrix as a 1 x cols view sharing its storage"},
+    {"reshape", (PyCFunction)Matrix61c_reshape, METH_VARARGS,
+    "Returns the elements in a new (row, col) shape, as a view when the data is contiguous"},
+    {"tanh", (PyCFunction)(void(*)(void))Matrix61c_tanh, METH_VARARGS | METH_KEYWORDS,
+    "Returns a matrix with the function applied to each element"},
+    {"sigmoid", (PyCFunction)(void(*)(void))Matrix61c_sigmoid, METH_VARARGS | METH_KEYWORDS,
+    "Returns a matrix with the function applied to each element"},
+    {"exp", (PyCFunction)(void(*)(void))Matrix61c_exp, METH_VARARGS | METH_KEYWORDS,
+    "Returns a matrix with the function applied to each element"},
+    {"log", (PyCFunction)(void(*)(void))Matrix61c_log, METH_VARARGS | METH_KEYWORDS,
+    "Returns a matrix with the function applied to each element"},
+    {"relu", (PyCFunction)(void(*)(void))Matrix61c_relu, METH_VARARGS | METH_KEYWORDS,
     "Returns a matrix with the function applied to each element"},
-    {"sigmoid", (PyCFunction)Matrix61c_sigmoid, METH_NOARGS,
+    {"abs", (PyCFunction)(void(*)(void))Matrix61c_abs, METH_VARARGS | METH_KEYWORDS,
     "Returns a matrix with the function applied to each element"},
+    {"element_pow", (PyCFunction)(void(*)(void))Matrix61c_ele_pow, METH_VARARGS | METH_KEYWORDS,
+    "Raises each element of the matrix to the power `amt`"},
     {"get_rows", (PyCFunction)Matrix61c_get_rows, METH_NOARGS,
     "Returns the number of rows in the matrix"},
     {"get_cols", (PyCFunction)Matrix61c_get_cols, METH_NOARGS,
     "Returns the number of columns in the matrix"},
     {"ones", (PyCFunction)Matrix61c_ones, METH_VARARGS | METH_CLASS,
     "Returns a new matrix with dimensions of (row, col), filled with ones"},
+    {"zeros", (PyCFunction)Matrix61c_zeros, METH_VARARGS | METH_CLASS,
+    "Returns a new matrix with dimensions of (row, col), filled with zeros"},
+    {"empty", (PyCFunction)Matrix61c_empty, METH_VARARGS | METH_CLASS,
+    "Returns a new matrix with dimensions of (row, col) and unspecified contents"},
+    {"full", (PyCFunction)Matrix61c_full, METH_VARARGS | METH_CLASS,
+    "Returns a new matrix with dimensions of (row, col), filled with val"},
+    {"frombuffer", (PyCFunction)(void(*)(void))Matrix61c_frombuffer, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+    "Returns a (row, col) matrix over the float32 data of a buffer, wrapping it when writable"},
+    {"fromfile", (PyCFunction)Matrix61c_fromfile, METH_VARARGS | METH_CLASS,
+    "Returns a (row, col) matrix read from a file of raw float32 values"},
+    {"to_half", (PyCFunction)(void(*)(void))Matrix61c_to_half, METH_VARARGS | METH_KEYWORDS,
+    "Returns the elements as bytes of 16-bit floats (format 'fp16' or 'bf16'), rounded to nearest even"},
+    {"from_half", (PyCFunction)(void(*)(void))Matrix61c_from_half, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+    "Returns a (row, col) matrix widened from a buffer of 16-bit floats (format 'fp16' or 'bf16')"},
     {NULL}  /* Sentinel */
 };
 
+/*
+ * Buffer protocol: exposes the matrix data itself as a 2D float32 array, so
+ * memoryview(m) and numpy.asarray(m) share memory with the matrix. Rows are
+ * padded (see row_stride in matrix.c), so consumers that can only take a
+ * C-contiguous buffer get one only when stride == cols.
+ */
+static int
+Matrix61c_getbuffer(Matrix61c *self, Py_buffer *view, int flags) {
+    if (Matrix61c_force(self) < 0) {
+        view->obj = NULL;
+        return -1;
+    }
+    /*
+     * The export is always writable (consumers asking for a read-only buffer
+     * may still write through it), and writers bypass set(), so settle
+     * pending readers of this storage now
+     */
+    if (Matrix61c_prepare_write(self) < 0
+            || (self->parent != NULL && Matrix61c_prepare_write(self->parent) < 0)) {
+        view->obj = NULL;
+        return -1;
+    }
+    matrix *mat = self->mat;
+    int contiguous = mat->stride == mat->dim.cols || mat->dim.rows <= 1;
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && ! contiguous) {
+        PyErr_SetString(PyExc_BufferError, "Matrix rows are padded; request a strided buffer");
+        view->obj = NULL;
+        return -1;
+    }
+    if ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS && mat->dim.rows > 1 && mat->dim.cols > 1) {
+        PyErr_SetString(PyExc_BufferError, "Matrix data is row-major");
+        view->obj = NULL;
+        return -1;
+    }
+    if (((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS || (flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS)
+            && ! contiguous) {
+        PyErr_SetString(PyExc_BufferError, "Matrix rows are padded and not contiguous");
+        view->obj = NULL;
+        return -1;
+    }
+
+    self->buf_shape[0] = mat->dim.rows;
+    self->buf_shape[1] = mat->dim.cols;
+    self->buf_strides[0] = (Py_ssize_t) mat->stride * sizeof(float);
+    self->buf_strides[1] = sizeof(float);
+
+    view->buf = mat->data;
+    view->obj = (PyObject*) self;
+    Py_INCREF(self);
+    view->len = (Py_ssize_t) mat->dim.rows * mat->dim.cols * sizeof(float);
+    view->readonly = 0;
+    view->itemsize = sizeof(float);
+    view->format = (flags & PyBUF_FORMAT) ? "f" : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->buf_shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->buf_strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    self->exports++;
+    return 0;
+}
+
+static void
+Matrix61c_releasebuffer(Matrix61c *self, Py_buffer *view) {
+    self->exports--;
+}
+
+static PyBufferProcs Matrix61c_as_buffer = {
+    (getbufferproc)Matrix61c_getbuffer,
+    (releasebufferproc)Matrix61c_releasebuffer,
+};
+
 // Declare the comparision before the struct to use it, then implement after
 static PyObject *
 Matrix61c_richcompare(Matrix61c *a, Matrix61c *b, int op);
 
 static PyNumberMethods Matrix61c_as_number = {
-   (binaryfunc)Matrix61c_add, // binaryfunc nb_add;
-   (binaryfunc)Matrix61c_sub, // binaryfunc nb_subtract;
+   (binaryfunc)Matrix61c_uscore_add, // binaryfunc nb_add;
+   (binaryfunc)Matrix61c_uscore_sub, // binaryfunc nb_subtract;
    (binaryfunc)Matrix61c_uscore_multiply, // binaryfunc nb_multiply;
    0, // binaryfunc nb_remainder;
    0, // binaryfunc nb_divmod;
    (ternaryfunc)Matrix61c_uscore_power, // ternaryfunc nb_power;
    0, // unaryfunc nb_negative;
    0, // unaryfunc nb_positive;
-   0, // unaryfunc nb_absolute;
+   (unaryfunc)Matrix61c_uscore_abs, // unaryfunc nb_absolute;
    0, // inquiry nb_bool;
    0, // unaryfunc nb_invert;
    0, // binaryfunc nb_lshift;
@@ -585,11 +2389,11 @@ static PyNumberMethods Matrix61c_as_number = {
    0, // void *nb_reserved;
    0, // unaryfunc nb_float;
 
-   0, // binaryfunc nb_inplace_add;
-   0, // binaryfunc nb_inplace_subtract;
-   0, // binaryfunc nb_inplace_multiply;
+   (binaryfunc)Matrix61c_iadd, // binaryfunc nb_inplace_add;
+   (binaryfunc)Matrix61c_isub, // binaryfunc nb_inplace_subtract;
+   (binaryfunc)Matrix61c_imul, // binaryfunc nb_inplace_multiply;
    0, // binaryfunc nb_inplace_remainder;
-   0, // ternaryfunc nb_inplace_power;
+   (ternaryfunc)Matrix61c_ipow, // ternaryfunc nb_inplace_power;
    0, // binaryfunc nb_inplace_lshift;
    0, // binaryfunc nb_inplace_rshift;
    0, // binaryfunc nb_inplace_and;
@@ -603,8 +2407,14 @@ static PyNumberMethods Matrix61c_as_number = {
 
    0, // unaryfunc nb_index;
 
-   0, // binaryfunc nb_matrix_multiply;
-   0, // binaryfunc nb_inplace_matrix_multiply;
+   (binaryfunc)Matrix61c_uscore_matmul, // binaryfunc nb_matrix_multiply;
+   (binaryfunc)Matrix61c_imatmul, // binaryfunc nb_inplace_matrix_multiply;
+};
+
+static PyMappingMethods Matrix61c_as_mapping = {
+    (lenfunc)Matrix61c_length, // lenfunc mp_length;
+    (binaryfunc)Matrix61c_subscript, // binaryfunc mp_subscript;
+    (objobjargproc)Matrix61c_ass_subscript, // objobjargproc mp_ass_subscript;
 };
 
 static PyTypeObject Matrix61cType = {
@@ -620,13 +2430,13 @@ static PyTypeObject Matrix61cType = {
     (reprfunc)Matrix61c_repr,            /* tp_repr */
     &Matrix61c_as_number,                /* tp_as_number */
     0,                         /* tp_as_sequence */
-    0,                         /* tp_as_mapping */
+    &Matrix61c_as_mapping,     /* tp_as_mapping */
     0,                         /* tp_hash  */
     0,                         /* tp_call */
     0,                         /* tp_str */
     0,                         /* tp_getattro */
     0,                         /* tp_setattro */
-    0,                         /* tp_as_buffer */
+    &Matrix61c_as_buffer,      /* tp_as_buffer */
     Py_TPFLAGS_DEFAULT |
         Py_TPFLAGS_BASETYPE,   /* tp_flags */
     "numc.Matrix objects",           /* tp_doc */
@@ -638,7 +2448,7 @@ static PyTypeObject Matrix61cType = {
     0,                         /* tp_iternext */
     Matrix61c_methods,             /* tp_methods */
     Matrix61c_members,             /* tp_members */
-    0,                         /* tp_getset */
+    Matrix61c_getset,              /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
@@ -653,6 +2463,20 @@ static PyObject *
 Matrix61c_richcompare(Matrix61c *a, Matrix61c *b, int op) {
     if (op == Py_NE || op == Py_EQ) {
         if (PyObject_TypeCheck(b, &Matrix61cType)) {
+            int is64 = binary_float64(a, b);
+            if (is64 < 0) {
+                return NULL;
+            } else if (is64) {
+                int equal = same_size64(a->mat64, b->mat64);
+                for (int i = 0; equal && i < a->mat64->dim.rows; i++) {
+                    for (int j = 0; equal && j < a->mat64->dim.cols; j++) {
+                        equal = get_loc64(a->mat64, i, j) == get_loc64(b->mat64, i, j);
+                    }
+                }
+                return PyBool_FromLong(op == Py_EQ ? equal : ! equal);
+            }
+            FORCE_OR_FAIL(a);
+            FORCE_OR_FAIL(b);
             if (get_rows(a->mat) != get_rows(b->mat) || get_cols(a->mat) != get_cols(b->mat)) {
                 return op == Py_EQ ? Py_False : Py_True;
             }
@@ -681,12 +2505,635 @@ Matrix61c_richcompare(Matrix61c *a, Matrix61c *b, int op) {
     }
 }
 
+/*
+ * Batched operations on count matrices stacked along the rows of one
+ * numc.Matrix, which is how a batch of small matrices fits in 2D storage:
+ * block i is rows [i * rows / count, (i + 1) * rows / count). One call does
+ * the whole batch, split across threads by block, without the GIL.
+ */
+static int
+check_batch(Matrix61c *a, int count) {
+    if (count <= 0 || get_rows(a->mat) % count != 0) {
+        PyErr_SetString(PyExc_TypeError, "count must be positive and divide the number of rows");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * numc.batch_multiply(a, b, count, out=None): block i of a times block i of b,
+ * or times all of b when b is a single matrix shared by the batch.
+ */
+static PyObject *
+numc_batch_multiply(PyObject *module, PyObject *args, PyObject *kwds) {
+    Matrix61c *a, *b, *out = NULL;
+    int count;
+    static char *kwlist[] = {"", "", "", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!i|$O", kwlist, &Matrix61cType, &a, &Matrix61cType, &b, &count, &out)) {
+        return NULL;
+    }
+    FORCE_OR_FAIL(a);
+    FORCE_OR_FAIL(b);
+    if (check_batch(a, count) < 0) {
+        return NULL;
+    }
+    int k = get_cols(a->mat);
+    if (get_rows(b->mat) != k && get_rows(b->mat) != k * count) {
+        PyErr_SetString(PyExc_TypeError, "Matrix dimensions do not match for multiplication");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result(out, get_rows(a->mat), get_cols(b->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, a->mat, b->mat, 0);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    WITHOUT_GIL((double) get_rows(a->mat) * k * get_cols(b->mat), {
+        matrix_batch_multiply(a->mat, b->mat, count, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+/*
+ * numc.batch_add(a, b, count, out=None): b is added to every block of a when
+ * it is a single block, and elementwise when it is a whole batch.
+ */
+static PyObject *
+numc_batch_add(PyObject *module, PyObject *args, PyObject *kwds) {
+    Matrix61c *a, *b, *out = NULL;
+    int count;
+    static char *kwlist[] = {"", "", "", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O!i|$O", kwlist, &Matrix61cType, &a, &Matrix61cType, &b, &count, &out)) {
+        return NULL;
+    }
+    FORCE_OR_FAIL(a);
+    FORCE_OR_FAIL(b);
+    if (check_batch(a, count) < 0) {
+        return NULL;
+    }
+    if (get_cols(b->mat) != get_cols(a->mat)
+        || (get_rows(b->mat) != get_rows(a->mat) && get_rows(b->mat) != get_rows(a->mat) / count)) {
+        PyErr_SetString(PyExc_TypeError, "Can only add matricies of the same size");
+        return NULL;
+    }
+    Matrix61c* rv = Matrix61c_result(out, get_rows(a->mat), get_cols(a->mat));
+    if (rv == NULL) {
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, a->mat, b->mat, 1);
+    if (dst == NULL) {
+        Py_DECREF(rv);
+        return NULL;
+    }
+    WITHOUT_GIL((double) get_rows(a->mat) * get_cols(a->mat), {
+        matrix_batch_add(a->mat, b->mat, count, dst);
+        end_write(rv->mat, dst);
+    });
+    return (PyObject*)rv;
+}
+
+/*
+ * numc.batch_scale(a, scalars, out=None): block i of a times scalars[i]; the
+ * length of scalars is the batch count.
+ */
+static PyObject *
+numc_batch_scale(PyObject *module, PyObject *args, PyObject *kwds) {
+    Matrix61c *a, *out = NULL;
+    PyObject *seq;
+    static char *kwlist[] = {"", "", "out", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O!O|$O", kwlist, &Matrix61cType, &a, &seq, &out)) {
+        return NULL;
+    }
+    FORCE_OR_FAIL(a);
+    PyObject *fast = PySequence_Fast(seq, "scalars must be a sequence of numbers");
+    if (fast == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(fast);
+    if (check_batch(a, count > INT_MAX ? 0 : (int) count) < 0) {
+        Py_DECREF(fast);
+        return NULL;
+    }
+    float *scalars = PyMem_Malloc(count * sizeof(float));
+    if (scalars == NULL) {
+        Py_DECREF(fast);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < count; i++) {
+        double v = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(fast, i));
+        if (v == -1.0 && PyErr_Occurred()) {
+            PyErr_SetString(PyExc_TypeError, "scalars must be a sequence of numbers");
+            PyMem_Free(scalars);
+            Py_DECREF(fast);
+            return NULL;
+        }
+        scalars[i] = (float) v;
+    }
+    Py_DECREF(fast);
+    Matrix61c* rv = Matrix61c_result(out, get_rows(a->mat), get_cols(a->mat));
+    if (rv == NULL) {
+        PyMem_Free(scalars);
+        return NULL;
+    }
+    matrix *dst = begin_write(rv->mat, a->mat, NULL, 1);
+    if (dst == NULL) {
+        PyMem_Free(scalars);
+        Py_DECREF(rv);
+        return NULL;
+    }
+    WITHOUT_GIL((double) get_rows(a->mat) * get_cols(a->mat), {
+        matrix_batch_scale(a->mat, scalars, (int) count, dst);
+        end_write(rv->mat, dst);
+    });
+    PyMem_Free(scalars);
+    return (PyObject*)rv;
+}
+
+/*
+ * numc.set_lazy(flag): while on, elementwise operations (+, -, scale,
+ * element_mult, element_pow and the math functions) build an expression
+ * that is evaluated in one fused pass when its data is first needed.
+ * Returns the previous setting.
+ */
+static PyObject *
+numc_set_lazy(PyObject *module, PyObject *args) {
+    int flag;
+    if (! PyArg_ParseTuple(args, "p", &flag)) {
+        return NULL;
+    }
+    int previous = lazy_mode;
+    lazy_mode = flag;
+    return PyBool_FromLong(previous);
+}
+
+/*
+ * numc.set_strassen(n): square products of size n and up use Strassen-Winograd,
+ * which is faster but less accurate than the classic product. 0 turns it off.
+ * Returns the previous crossover.
+ */
+static PyObject *
+numc_set_strassen(PyObject *module, PyObject *args) {
+    int crossover;
+    if (! PyArg_ParseTuple(args, "i", &crossover)) {
+        return NULL;
+    }
+    if (crossover < 0) {
+        PyErr_SetString(PyExc_TypeError, "Crossover must be non-negative!");
+        return NULL;
+    }
+    return PyLong_FromLong(set_strassen_crossover(crossover));
+}
+
+/*
+ * numc.set_pool_limit(bytes): freed matrix buffers are kept for reuse up to
+ * this many bytes. Returns the previous limit.
+ */
+static PyObject *
+numc_set_pool_limit(PyObject *module, PyObject *args) {
+    Py_ssize_t bytes;
+    if (! PyArg_ParseTuple(args, "n", &bytes)) {
+        return NULL;
+    }
+    if (bytes < 0) {
+        PyErr_SetString(PyExc_TypeError, "Pool limit must be non-negative!");
+        return NULL;
+    }
+    return PyLong_FromSize_t(set_pool_limit((size_t) bytes));
+}
+
+// numc.trim_pool(): frees every cached buffer, returns how many bytes that was
+static PyObject *
+numc_trim_pool(PyObject *module, PyObject *Py_UNUSED(ignored)) {
+    return PyLong_FromSize_t(trim_pool());
+}
+
+/*
+ * numc.set_counters(flag): turns per-op hardware counters on or off. Raises
+ * OSError when no counter can be opened (no PMU, or perf_event_paranoid).
+ * Returns the previous setting.
+ */
+static PyObject *
+numc_set_counters(PyObject *module, PyObject *args) {
+    int flag;
+    if (! PyArg_ParseTuple(args, "p", &flag)) {
+        return NULL;
+    }
+    int previous = counters_enabled();
+    if (counters_enable(flag) == 0 && flag) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return PyBool_FromLong(previous);
+}
+
+/*
+ * numc.counters(reset=False): {op: {"calls": n, "cycles": ..., ...}} for every
+ * op counted so far. Events this machine lacks are None; "ipc" is derived
+ * when cycles and instructions are both there.
+ */
+static PyObject *
+numc_counters(PyObject *module, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"reset", NULL};
+    int reset = 0;
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|p", kwlist, &reset)) {
+        return NULL;
+    }
+    op_counters totals[OP_COUNT];
+    int available = counters_read(totals);
+    if (reset) {
+        counters_reset();
+    }
+    PyObject *result = PyDict_New();
+    if (result == NULL) {
+        return NULL;
+    }
+    for (int op = 0; op < OP_COUNT; op++) {
+        op_counters *t = &totals[op];
+        if (t->calls == 0) {
+            continue;
+        }
+        PyObject *entry = PyDict_New();
+        if (entry == NULL || PyDict_SetItemString(result, counter_op_name(op), entry) != 0) {
+            Py_XDECREF(entry);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(entry);
+        PyObject *calls = PyLong_FromUnsignedLongLong(t->calls);
+        int err = calls == NULL || PyDict_SetItemString(entry, "calls", calls) != 0;
+        Py_XDECREF(calls);
+        for (int e = 0; e < CTR_EVENT_COUNT && ! err; e++) {
+            PyObject *v = (available & 1 << e) ? PyLong_FromUnsignedLongLong(t->values[e]) : Py_None;
+            err = v == NULL || PyDict_SetItemString(entry, counter_event_name(e), v) != 0;
+            if (v != Py_None) {
+                Py_XDECREF(v);
+            }
+        }
+        int has_ipc = (available & 1 << CTR_CYCLES) && (available & 1 << CTR_INSTRUCTIONS) && t->values[CTR_CYCLES] > 0;
+        if (! err && has_ipc) {
+            PyObject *ipc = PyFloat_FromDouble((double) t->values[CTR_INSTRUCTIONS] / t->values[CTR_CYCLES]);
+            err = ipc == NULL || PyDict_SetItemString(entry, "ipc", ipc) != 0;
+            Py_XDECREF(ipc);
+        }
+        if (err) {
+            Py_DECREF(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+static double
+stats_seconds_per_tick(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = __rdtsc() - stats_tsc_origin;
+    double seconds = (now.tv_sec - stats_clock_origin.tv_sec) + (now.tv_nsec - stats_clock_origin.tv_nsec) * 1e-9;
+    return ticks > 0 ? seconds / ticks : 0;
+}
+
+// Reads a field, zeroing it if reset
+static uint64_t
+take_stat(uint64_t *field, int reset) {
+    uint64_t v = __atomic_load_n(field, __ATOMIC_RELAXED);
+    if (reset) {
+        __atomic_store_n(field, 0, __ATOMIC_RELAXED);
+    }
+    return v;
+}
+
+/*
+ * numc.stats(reset=False): {op: {"calls", "elements", "bytes", "seconds",
+ * "histogram"}} for every op called since the last reset. The histogram lists
+ * (upper bound in seconds, calls) for each bucket that has any.
+ */
+static PyObject *
+numc_stats(PyObject *module, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"reset", NULL};
+    int reset = 0;
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|p", kwlist, &reset)) {
+        return NULL;
+    }
+    double tick = stats_seconds_per_tick();
+    PyObject *result = PyDict_New();
+    if (result == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < STAT_COUNT; i++) {
+        op_stats *s = &op_stats_table[i];
+        uint64_t calls = take_stat(&s->calls, reset);
+        uint64_t elements = take_stat(&s->elements, reset);
+        uint64_t bytes = take_stat(&s->bytes, reset);
+        uint64_t ticks = take_stat(&s->ticks, reset);
+        PyObject *histogram = PyList_New(0);
+        for (int b = 0; b < STAT_BUCKETS; b++) {
+            uint64_t n = take_stat(&s->histogram[b], reset);
+            if (n == 0 || histogram == NULL) {
+                continue;
+            }
+            PyObject *bucket = Py_BuildValue("(dK)", tick * ((uint64_t) 2 << b), (unsigned long long) n);
+            if (bucket == NULL || PyList_Append(histogram, bucket) != 0) {
+                Py_CLEAR(histogram);
+            }
+            Py_XDECREF(bucket);
+        }
+        if (histogram == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        if (calls == 0) {
+            Py_DECREF(histogram);
+            continue;
+        }
+        PyObject *entry = Py_BuildValue("{sKsKsKsdsN}", "calls", (unsigned long long) calls,
+                                        "elements", (unsigned long long) elements, "bytes", (unsigned long long) bytes,
+                                        "seconds", ticks * tick, "histogram", histogram);
+        if (entry == NULL || PyDict_SetItemString(result, stat_names[i], entry) != 0) {
+            Py_XDECREF(entry);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(entry);
+    }
+    return result;
+}
+
+/*
+ * numc.trace_start(capacity=0): records a timeline of numc methods, the
+ * matrix ops under them and each OpenMP thread's share of the parallel
+ * kernels, into a ring of capacity events (0 for the default).
+ * numc.trace_stop() pauses it; numc.trace_dump(path) writes what the ring
+ * holds as Chrome trace JSON, for chrome://tracing or ui.perfetto.dev.
+ */
+static PyObject *
+numc_trace_start(PyObject *module, PyObject *args, PyObject *kwds) {
+    static char *kwlist[] = {"capacity", NULL};
+    Py_ssize_t capacity = 0;
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|n", kwlist, &capacity)) {
+        return NULL;
+    }
+    if (capacity < 0) {
+        PyErr_SetString(PyExc_TypeError, "Trace capacity must be non-negative!");
+        return NULL;
+    }
+    if (trace_start((size_t) capacity) != 0) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+numc_trace_stop(PyObject *module, PyObject *Py_UNUSED(ignored)) {
+    trace_stop();
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+numc_trace_dump(PyObject *module, PyObject *args) {
+    PyObject *path;
+    if (! PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path)) {
+        return NULL;
+    }
+    int err;
+    Py_BEGIN_ALLOW_THREADS
+    err = trace_dump(PyBytes_AS_STRING(path));
+    Py_END_ALLOW_THREADS
+    if (err != 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(path));
+        Py_DECREF(path);
+        return NULL;
+    }
+    Py_DECREF(path);
+    Py_RETURN_NONE;
+}
+
+// Raises the exception matching a matfile error: OSError for I/O, TypeError for bad contents
+static PyObject *
+matfile_error(int err, PyObject *name) {
+    if (err == MATFILE_EIO) {
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+    }
+    if (err == MATFILE_ENOMEM) {
+        return PyErr_NoMemory();
+    }
+    PyErr_Format(PyExc_TypeError, "%R: %s", name, matfile_strerror(err));
+    return NULL;
+}
+
+/*
+ * numc.save(path, matrices): writes a matrix, or a sequence of them, to a
+ * binary matrix file (see performance/matfile.h).
+ */
+static PyObject *
+numc_save(PyObject *module, PyObject *args) {
+    PyObject *name, *obj, *path;
+    if (! PyArg_ParseTuple(args, "OO", &name, &obj)) {
+        return NULL;
+    }
+    PyObject *seq = PyObject_TypeCheck(obj, &Matrix61cType) ? PyTuple_Pack(1, obj)
+                    : PySequence_Fast(obj, "save takes a numc.Matrix or a sequence of them");
+    if (seq == NULL) {
+        return NULL;
+    }
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    matrix **mats = PyMem_Malloc((count + 1) * sizeof(matrix *));
+    if (mats == NULL) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    for (Py_ssize_t i = 0; i < count; i++) {
+        Matrix61c *m = (Matrix61c *) PySequence_Fast_GET_ITEM(seq, i);
+        if (! PyObject_TypeCheck(m, &Matrix61cType)) {
+            PyErr_SetString(PyExc_TypeError, "save takes a numc.Matrix or a sequence of them");
+            goto fail;
+        }
+        if (Matrix61c_force(m) < 0) {
+            goto fail;
+        }
+        mats[i] = m->mat;
+    }
+    if (count > INT_MAX || ! PyUnicode_FSConverter(name, &path)) {
+        goto fail;
+    }
+    int err;
+    // seq keeps every matrix alive while the GIL is released
+    Py_BEGIN_ALLOW_THREADS
+    err = matfile_write(PyBytes_AS_STRING(path), mats, (int) count);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(path);
+    PyMem_Free(mats);
+    Py_DECREF(seq);
+    if (err != MATFILE_OK) {
+        return matfile_error(err, name);
+    }
+    Py_RETURN_NONE;
+fail:
+    PyMem_Free(mats);
+    Py_DECREF(seq);
+    return NULL;
+}
+
+// numc.Matrix objects around the matrices of a loaded file, as a list
+static PyObject *
+matrices_to_list(matrix **mats, int count) {
+    PyObject *list = PyList_New(count);
+    for (int i = 0; i < count; i++) {
+        Matrix61c *m = list != NULL ? (Matrix61c *) Matrix61c_new(&Matrix61cType, NULL, NULL) : NULL;
+        if (m == NULL) {
+            for (int j = i; j < count; j++) {
+                free_matrix(mats[j]);
+            }
+            Py_XDECREF(list);
+            return NULL;
+        }
+        m->mat = mats[i];
+        PyList_SET_ITEM(list, i, (PyObject *) m);
+    }
+    return list;
+}
+
+/*
+ * Wraps every matrix of the file around one copy-on-write mmap of it. Each
+ * matrix holds a buffer export of the mmap object, which keeps the mapping
+ * alive until the last of them is gone.
+ */
+static PyObject *
+numc_load_mapped(PyObject *name, const char *path, int verify) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, name);
+    }
+    PyObject *mmap_module = PyImport_ImportModule("mmap");
+    PyObject *mm = NULL;
+    if (mmap_module != NULL) {
+        // mmap.mmap(fd, 0, access=mmap.ACCESS_COPY)
+        PyObject *mmap_type = PyObject_GetAttrString(mmap_module, "mmap");
+        PyObject *access = PyObject_GetAttrString(mmap_module, "ACCESS_COPY");
+        PyObject *call_args = Py_BuildValue("(ii)", fd, 0);
+        PyObject *call_kwds = access == NULL ? NULL : Py_BuildValue("{sO}", "access", access);
+        if (mmap_type != NULL && call_args != NULL && call_kwds != NULL) {
+            mm = PyObject_Call(mmap_type, call_args, call_kwds);
+        }
+        Py_XDECREF(call_kwds);
+        Py_XDECREF(call_args);
+        Py_XDECREF(access);
+        Py_XDECREF(mmap_type);
+        Py_DECREF(mmap_module);
+    }
+    close(fd);
+    if (mm == NULL) {
+        return NULL;
+    }
+    Py_buffer whole;
+    if (PyObject_GetBuffer(mm, &whole, PyBUF_WRITABLE) < 0) {
+        Py_DECREF(mm);
+        return NULL;
+    }
+    const matfile_entry *entries;
+    int count;
+    int err = matfile_index(whole.buf, whole.len, verify, &entries, &count);
+    PyObject *list = err == MATFILE_OK ? PyList_New(count) : matfile_error(err, name);
+    for (int i = 0; list != NULL && i < count; i++) {
+        const matfile_entry *e = &entries[i];
+        Matrix61c *m = (Matrix61c *) Matrix61c_new(&Matrix61cType, NULL, NULL);
+        if (m == NULL || PyObject_GetBuffer(mm, &m->base, PyBUF_WRITABLE) < 0) {
+            Py_XDECREF(m);
+            Py_CLEAR(list);
+            break;
+        }
+        m->has_base = 1;
+        PyList_SET_ITEM(list, i, (PyObject *) m);
+        if (wrap_matrix(&m->mat, (float *) ((char *) m->base.buf + e->offset), e->rows, e->cols, e->stride) != 0) {
+            PyErr_NoMemory();
+            Py_CLEAR(list);
+        }
+    }
+    PyBuffer_Release(&whole);
+    Py_DECREF(mm);
+    return list;
+}
+
+/*
+ * numc.load(path, mmap=False, verify=False): the matrices in a binary matrix
+ * file, as a list. With mmap=True they are views of a private mapping of the
+ * file, read in as they are touched; writes to them never reach the file.
+ * Only the header and entry table are checksummed then, unless verify=True
+ * checks the data too, which reads the whole file up front. A copying load
+ * reads everything anyway and always verifies it.
+ */
+static PyObject *
+numc_load(PyObject *module, PyObject *args, PyObject *kwds) {
+    PyObject *name, *path;
+    int mapped = 0, verify = 0;
+    static char *kwlist[] = {"", "mmap", "verify", NULL};
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|$pp", kwlist, &name, &mapped, &verify)) {
+        return NULL;
+    }
+    if (! PyUnicode_FSConverter(name, &path)) {
+        return NULL;
+    }
+    if (mapped) {
+        PyObject *list = numc_load_mapped(name, PyBytes_AS_STRING(path), verify);
+        Py_DECREF(path);
+        return list;
+    }
+    matrix **mats;
+    int count, err;
+    Py_BEGIN_ALLOW_THREADS
+    err = matfile_read(PyBytes_AS_STRING(path), &mats, &count);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(path);
+    if (err != MATFILE_OK) {
+        return matfile_error(err, name);
+    }
+    PyObject *list = matrices_to_list(mats, count);
+    free(mats);
+    return list;
+}
+
+static PyMethodDef numc_methods[] = {
+    {"set_lazy", numc_set_lazy, METH_VARARGS,
+    "Turns lazy, fused evaluation of elementwise operations on or off"},
+    {"set_strassen", numc_set_strassen, METH_VARARGS,
+    "Sets the size from which square products use Strassen-Winograd (0 disables it)"},
+    {"set_pool_limit", numc_set_pool_limit, METH_VARARGS,
+    "Sets how many bytes of freed matrix buffers are kept for reuse"},
+    {"trim_pool", numc_trim_pool, METH_NOARGS,
+    "Frees every cached matrix buffer; returns the bytes released"},
+    {"stats", (PyCFunction)(void(*)(void))numc_stats, METH_VARARGS | METH_KEYWORDS,
+    "Returns the calls, elements, bytes, time and latency histogram of each op, optionally resetting them"},
+    {"trace_start", (PyCFunction)(void(*)(void))numc_trace_start, METH_VARARGS | METH_KEYWORDS,
+    "Starts recording a timeline of operations into a ring buffer"},
+    {"trace_stop", numc_trace_stop, METH_NOARGS,
+    "Stops recording the timeline"},
+    {"trace_dump", numc_trace_dump, METH_VARARGS,
+    "Writes the recorded timeline to a Chrome trace JSON file"},
+    {"set_counters", numc_set_counters, METH_VARARGS,
+    "Turns per-op hardware performance counters on or off"},
+    {"counters", (PyCFunction)(void(*)(void))numc_counters, METH_VARARGS | METH_KEYWORDS,
+    "Returns the hardware counter totals of each op, optionally resetting them"},
+    {"save", numc_save, METH_VARARGS,
+    "Writes a matrix or a sequence of matrices to a binary matrix file"},
+    {"load", (PyCFunction)(void(*)(void))numc_load, METH_VARARGS | METH_KEYWORDS,
+    "Reads the matrices of a binary matrix file into a list, optionally memory-mapped"},
+    {"batch_multiply", (PyCFunction)(void(*)(void))numc_batch_multiply, METH_VARARGS | METH_KEYWORDS,
+    "Multiplies each of count matrices stacked along the rows of a by its block of b (or by all of b)"},
+    {"batch_add", (PyCFunction)(void(*)(void))numc_batch_add, METH_VARARGS | METH_KEYWORDS,
+    "Adds b to each of count matrices stacked along the rows of a (or blockwise when b is a whole batch)"},
+    {"batch_scale", (PyCFunction)(void(*)(void))numc_batch_scale, METH_VARARGS | METH_KEYWORDS,
+    "Scales the matrices stacked along the rows of a, one scalar each"},
+    {NULL}  /* Sentinel */
+};
+
 static PyModuleDef numcmodule = {
     PyModuleDef_HEAD_INIT,
     "matrix",
     "A numpy like matrix",
     -1,
-    NULL, NULL, NULL, NULL, NULL
+    numc_methods, NULL, NULL, NULL, NULL
 };
 
 PyMODINIT_FUNC
@@ -700,6 +3147,9 @@ PyInit_numc(void) {
     if (m == NULL)
         return NULL;
 
+    stats_tsc_origin = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &stats_clock_origin);
+
     Py_INCREF(&Matrix61cType);
     PyModule_AddObject(m, "Matrix", (PyObject *)&Matrix61cType);
     return m;
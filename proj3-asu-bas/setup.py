@@ -8,8 +8,8 @@ naive = Extension('dumbpy',
 
 performance = Extension('numc',
                           include_dirs=['.'],
-                          sources = ['python/numc.c', 'performance/matrix.c'],
-                          extra_compile_args = ["-g", "-Wall", "-std=gnu99", "-fopenmp", "-mavx"],
+                          sources = ['python/numc.c', 'performance/matrix.c', 'performance/kernels.c', 'performance/expr.c', 'performance/matfile.c', 'performance/counters.c', 'performance/trace.c'],
+                          extra_compile_args = ["-g", "-Wall", "-std=gnu99", "-O3", "-fopenmp"],
                           extra_link_args=['-lgomp'],
                         )
 
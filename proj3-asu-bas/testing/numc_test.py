@@ -0,0 +1,446 @@
+"""
+Behavior checks of numc beyond what speedup.py times, each against plain
+Python lists or eager results. Run after installing numc (make build):
+
+  python3 testing/numc_test.py
+
+Exits 1 if any check fails.
+"""
+import array
+import os
+import random
+import sys
+import tempfile
+import traceback
+
+import numc as nc
+
+W  = '\033[0m'  # white (normal)
+R  = '\033[31m' # red
+G  = '\033[32m' # green
+
+TESTS = []
+
+
+def test(f):
+  TESTS.append(f)
+  return f
+
+
+def expect(cond, what):
+  if not cond:
+    raise AssertionError(what)
+
+
+def raises(exc, f, *args, **kwargs):
+  try:
+    f(*args, **kwargs)
+  except exc:
+    return True
+  return False
+
+
+def rand_lists(rows, cols):
+  return [[random.uniform(-1, 1) for _ in range(cols)] for _ in range(rows)]
+
+
+def f32(x):
+  return array.array('f', [x])[0]
+
+
+def close(got, want, tol=1e-5):
+  """got and want are lists of lists (or Matrices); tol is relative to |want| + 1"""
+  if isinstance(got, nc.Matrix):
+    got = got.to_list()
+  if isinstance(want, nc.Matrix):
+    want = want.to_list()
+  if len(got) != len(want):
+    return False
+  for g, w in zip(got, want):
+    if len(g) != len(w) or any(abs(x - y) > tol * (abs(y) + 1) for x, y in zip(g, w)):
+      return False
+  return True
+
+
+def matmul(a, b):
+  return [[sum(a[i][p] * b[p][j] for p in range(len(b))) for j in range(len(b[0]))] for i in range(len(a))]
+
+
+def elementwise(f, a, b):
+  return [[f(x, y) for x, y in zip(ra, rb)] for ra, rb in zip(a, b)]
+
+
+def lazy_expression(a, b):
+  return ((a + b) * 2.0 - a.element_mult(b)).sigmoid().tanh() + b.abs().scale(0.5)
+
+
+@test
+def lazy_matches_eager():
+  a, b = nc.Matrix(rand_lists(40, 30)), nc.Matrix(rand_lists(40, 30))
+  eager = lazy_expression(a, b).to_list()
+  nc.set_lazy(True)
+  try:
+    expect(close(lazy_expression(a, b), eager, 1e-6), "fused result differs from the eager one")
+    # A chain longer than one fused pass takes
+    s = a
+    for _ in range(100):
+      s = s + a
+    expect(close(s, a.scale(101.0), 1e-5), "long chain")
+  finally:
+    nc.set_lazy(False)
+
+
+@test
+def lazy_operand_writes():
+  nc.set_lazy(True)
+  try:
+    a, b = nc.Matrix([[1, 2], [3, 4]]), nc.Matrix([[10, 20], [30, 40]])
+    pending = [a + b, a + b, a.scale(2), a + b]
+    a.set(0, 0, 100)
+    a[1, 1] = 100
+    a[0, :] = 7
+    a += b
+    expect(pending[0].to_list() == [[11, 22], [33, 44]], "set() reached a pending result")
+    expect(pending[2].to_list() == [[2, 4], [6, 8]], "a write reached a pending scale")
+    # Results pending on a pending result
+    c = a + b
+    d = c * 3.0
+    c_list = c.to_list()
+    a.set(1, 0, -1)
+    expect(d.to_list() == [[x * 3 for x in row] for row in c_list], "nested pending result")
+  finally:
+    nc.set_lazy(False)
+
+
+@test
+def buffer_export():
+  lists = rand_lists(3, 5)
+  m = nc.Matrix(lists)
+  mv = memoryview(m)
+  expect(mv.format == 'f' and mv.shape == (3, 5) and mv.strides[1] == 4, "buffer layout")
+  expect(mv.tolist() == m.to_list(), "buffer contents")
+  # The buffer is the matrix storage, both ways
+  mv[2, 4] = 7.0
+  m.set(0, 1, -3.0)
+  expect(m.get(2, 4) == 7.0 and mv[0, 1] == -3.0, "buffer does not share the matrix storage")
+  mv.release()
+  # Copies in, from float32 and float64 buffers; a 1D one is a column
+  copied = nc.Matrix(memoryview(m))
+  m.set(1, 1, 42.0)
+  expect(copied.to_list()[1][1] != 42.0, "Matrix(buffer) aliases the buffer")
+  col = nc.Matrix(array.array('d', [0.5, 1.5, 2.5]))
+  expect(col.to_list() == [[0.5], [1.5], [2.5]], "1D float64 buffer")
+  expect(raises(TypeError, nc.Matrix, array.array('i', [1, 2])), "int buffers are rejected")
+
+
+@test
+def buffer_export_settles_pending():
+  nc.set_lazy(True)
+  try:
+    x = nc.Matrix([[0, 1], [2, 3]])
+    z = x.scale(2)
+    memoryview(x)[0, 0] = 9
+    expect(z.get(0, 0) == 0.0, "a write through a read-only export reached a pending result")
+  finally:
+    nc.set_lazy(False)
+
+
+@test
+def bulk_constructors():
+  expect(nc.Matrix.zeros(2, 3).to_list() == [[0] * 3] * 2, "zeros")
+  expect(nc.Matrix.ones(3, 2).to_list() == [[1] * 2] * 3, "ones")
+  expect(nc.Matrix.full(2, 2, 1.5).to_list() == [[1.5] * 2] * 2, "full")
+  e = nc.Matrix.empty(4, 7)
+  expect((e.get_rows(), e.get_cols()) == (4, 7), "empty")
+  expect(raises(TypeError, nc.Matrix.zeros, 0, 3), "zero sized matrix")
+
+
+@test
+def frombuffer_aliasing():
+  buf = array.array('f', range(12))
+  m = nc.Matrix.frombuffer(buf, 3, 4)
+  expect(m.to_list() == [[0, 1, 2, 3], [4, 5, 6, 7], [8, 9, 10, 11]], "frombuffer contents")
+  # A writable float32 buffer is wrapped: writes show on both sides
+  buf[6] = 50
+  m.set(0, 0, 9)
+  expect(m.get(1, 2) == 50 and buf[0] == 9, "frombuffer does not wrap a writable buffer")
+  copied = nc.Matrix.frombuffer(buf, 3, 4, copy=True)
+  buf[1] = -1
+  expect(copied.get(0, 1) == 1, "copy=True still aliases")
+  readonly = nc.Matrix.frombuffer(bytes(buf), 3, 4)
+  expect(readonly.to_list() == nc.Matrix.frombuffer(buf, 3, 4).to_list(), "read-only buffers are copied")
+  expect(raises(TypeError, nc.Matrix.frombuffer, buf, 4, 4), "buffer too small")
+
+
+@test
+def fromfile_reads_raw_floats():
+  values = array.array('f', [random.uniform(-1, 1) for _ in range(6)])
+  with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, "m.f32")
+    with open(path, "wb") as f:
+      values.tofile(f)
+    m = nc.Matrix.fromfile(path, 2, 3)
+    expect(m.to_list() == [list(values[0:3]), list(values[3:6])], "fromfile contents")
+    expect(raises(TypeError, nc.Matrix.fromfile, path, 3, 3), "short file")
+    expect(raises(OSError, nc.Matrix.fromfile, os.path.join(tmp, "missing"), 1, 1), "missing file")
+
+
+@test
+def out_destinations():
+  la, lb = rand_lists(6, 6), rand_lists(6, 6)
+  a, b = nc.Matrix(la), nc.Matrix(lb)
+  o = nc.Matrix.zeros(6, 6)
+  for method, want in [("add", elementwise(lambda x, y: x + y, la, lb)),
+                       ("sub", elementwise(lambda x, y: x - y, la, lb)),
+                       ("element_mult", elementwise(lambda x, y: x * y, la, lb)),
+                       ("multiply", matmul(la, lb))]:
+    expect(getattr(a, method)(b, out=o) is o, method + " does not return out")
+    expect(close(o, want), method + " into out")
+  expect(a.scale(2.0, out=o) is o and close(o, [[2 * x for x in row] for row in la]), "scale into out")
+  expect(a.transpose(out=o) is o and close(o, [list(r) for r in zip(*la)]), "transpose into out")
+  expect(a.power(2, out=o) is o and close(o, matmul(la, la)), "power into out")
+  expect(raises(TypeError, a.add, b, out=nc.Matrix.zeros(6, 5)), "out of the wrong shape")
+  expect(raises(TypeError, a.add, b, out=[]), "out that is not a matrix")
+  # out may be an operand, products included
+  expect(close(a.multiply(a, out=a), matmul(la, la)), "product into its own operand")
+
+
+@test
+def in_place_operators():
+  la, lb = rand_lists(5, 5), rand_lists(5, 5)
+  a, b = nc.Matrix(la), nc.Matrix(lb)
+  same = a
+  a += b
+  a -= b
+  a *= 2.0
+  expect(a is same and close(a, [[2 * x for x in row] for row in la]), "+=, -= and *= by a number")
+  a @= b
+  want = matmul([[2 * x for x in row] for row in la], lb)
+  expect(a is same and close(a, want), "@=")
+  a **= 2
+  expect(a is same and close(a, matmul(want, want), 1e-4), "**=")
+  expect(close(2.0 * b, b * 2.0) and close(b * b, matmul(lb, lb)), "* with a number on either side, and with a matrix")
+
+
+@test
+def slicing_views():
+  lists = [[i * 10 + j for j in range(6)] for i in range(8)]
+  m = nc.Matrix(lists)
+  expect(m[2, 3] == 23 and m[-1, -1] == 75, "element indexing")
+  expect(m[1:3].to_list() == lists[1:3], "row slice")
+  expect(m[1:7:2, 2:4].to_list() == [row[2:4] for row in lists[1:7:2]], "stepped rows and a column range")
+  expect(m[3].to_list() == [lists[3]], "one row")
+  expect(len(m) == 8, "len")
+  expect(raises(TypeError, lambda: m[8, 0]), "out of range index")
+  # Views write through to their parent, and see its writes
+  v = m[1:7:2, 2:4]
+  v.set(0, 0, -1)
+  m.set(3, 3, -2)
+  expect(m.get(1, 2) == -1 and v.get(1, 1) == -2, "view does not share storage")
+  m[0:2, 4:6] = 5
+  expect(m[0:2, 4:6].to_list() == [[5, 5], [5, 5]], "filling a selection")
+  m[6:8, 0:2] = nc.Matrix([[1, 2], [3, 4]])
+  expect(m[6:8, 0:2].to_list() == [[1, 2], [3, 4]], "assigning a matrix to a selection")
+  expect(raises(TypeError, m.__setitem__, (slice(0, 2), slice(0, 2)), nc.Matrix([[1]])), "shape mismatch")
+
+
+@test
+def rows_resize_reshape():
+  lists = [[i * 10 + j for j in range(4)] for i in range(3)]
+  m = nc.Matrix(lists)
+  row = m.getRow(1)
+  row.set(0, 2, 99)
+  expect(row.to_list() == [[10, 11, 99, 13]] and m.get(1, 2) == 99, "getRow is a view")
+  small = m.resize(2, 3)
+  small.set(0, 0, -5)
+  expect(small.to_list() == [[-5, 1, 2], [10, 11, 99]] and m.get(0, 0) == -5, "shrinking resize is a view")
+  big = m.resize(4, 5)
+  big.set(0, 1, 7)
+  expect(big.to_list()[3] == [0] * 5 and big.to_list()[0][4] == 0 and m.get(0, 1) == 1, "growing resize is a zero padded copy")
+  flat = m.reshape(1, 12)
+  expect(flat.to_list() == [sum(m.to_list(), [])], "reshape keeps row-major order")
+  flat.set(0, 5, 55)
+  expect(m.get(1, 1) == 55, "reshaping contiguous data is a view")
+  cols = m[:, 1:3].reshape(3, 2)
+  expect(cols.to_list() == [row[1:3] for row in m.to_list()], "reshaping strided data")
+  expect(raises(TypeError, m.reshape, 5, 2), "reshape must keep the element count")
+
+
+@test
+def out_overlapping_views():
+  # The destination is a view shifted one row from the operand
+  for op in ["scale", "add", "sub", "element_mult", "sigmoid"]:
+    m = nc.Matrix([[i * 3 + j for j in range(3)] for i in range(4)])
+    src, dst = m[0:3, :], m[1:4, :]
+    want = {"scale": src.scale(2.0), "add": src + src, "sub": src - src,
+            "element_mult": src.element_mult(src), "sigmoid": src.sigmoid()}[op].to_list()
+    if op == "scale":
+      src.scale(2.0, out=dst)
+    elif op == "sigmoid":
+      src.sigmoid(out=dst)
+    else:
+      getattr(src, op)(src, out=dst)
+    expect(close(dst, want), op + " into a view overlapping its operand")
+  sq = nc.Matrix([[i * 4 + j for j in range(4)] for i in range(4)])
+  want = [list(r) for r in zip(*sq.to_list())]
+  sq.transpose(out=sq)
+  expect(sq.to_list() == want, "transpose in place")
+  # Large enough for the threaded kernels
+  big = nc.Matrix(rand_lists(400, 300))
+  want = big[0:399, :].scale(3.0).to_list()
+  big[0:399, :].scale(3.0, out=big[1:400, :])
+  expect(close(big[1:400, :], want), "overlapping threaded scale")
+
+
+@test
+def batch_ops():
+  count, m, k, n = 4, 3, 5, 2
+  la, lb, lshared = rand_lists(count * m, k), rand_lists(count * k, n), rand_lists(k, n)
+  a, b, shared = nc.Matrix(la), nc.Matrix(lb), nc.Matrix(lshared)
+  blocks = lambda rows, size: [rows[i * size:(i + 1) * size] for i in range(count)]
+  want = sum((matmul(x, y) for x, y in zip(blocks(la, m), blocks(lb, k))), [])
+  expect(close(nc.batch_multiply(a, b, count), want), "batch_multiply, a block of b each")
+  want = sum((matmul(x, lshared) for x in blocks(la, m)), [])
+  expect(close(nc.batch_multiply(a, shared, count), want), "batch_multiply, one shared b")
+
+  lwhole, lblock = rand_lists(count * m, k), rand_lists(m, k)
+  want = elementwise(lambda x, y: x + y, la, lwhole)
+  expect(close(nc.batch_add(a, nc.Matrix(lwhole), count), want), "batch_add, whole batch")
+  want = elementwise(lambda x, y: x + y, la, lblock * count)
+  expect(close(nc.batch_add(a, nc.Matrix(lblock), count), want), "batch_add, one shared block")
+
+  scalars = [2.0, -1.0, 0.0, 0.5]
+  want = [[x * scalars[i // m] for x in row] for i, row in enumerate(la)]
+  out = nc.Matrix.zeros(count * m, k)
+  expect(nc.batch_scale(a, scalars, out=out) is out and close(out, want), "batch_scale into out")
+  expect(raises(TypeError, nc.batch_multiply, a, b, 5), "count must divide the rows")
+
+
+@test
+def save_load_round_trip():
+  mats = [nc.Matrix(rand_lists(17, 31)), nc.Matrix([[1.5]]), nc.Matrix(rand_lists(40, 32))[0:40:2, 3:20]]
+  with tempfile.TemporaryDirectory() as tmp:
+    path = os.path.join(tmp, "m.m61")
+    nc.save(path, mats)
+    for kwargs in [{}, {"mmap": True}, {"mmap": True, "verify": True}]:
+      loaded = nc.load(path, **kwargs)
+      expect([m.to_list() for m in loaded] == [m.to_list() for m in mats], "load(%s)" % kwargs)
+    # Mapped matrices are private copies of the file
+    mapped = nc.load(path, mmap=True)
+    mapped[0].set(0, 0, 1234)
+    del mapped
+    expect(nc.load(path)[0].get(0, 0) == mats[0].get(0, 0), "writes to a mapped matrix reached the file")
+    nc.save(path, mats[1])
+    expect(len(nc.load(path)) == 1, "saving a single matrix")
+    expect(raises(OSError, nc.load, os.path.join(tmp, "missing")), "missing file")
+
+
+@test
+def load_rejects_damaged_files():
+  with tempfile.TemporaryDirectory() as tmp:
+    path, damaged = os.path.join(tmp, "m.m61"), os.path.join(tmp, "damaged.m61")
+    nc.save(path, [nc.Matrix(rand_lists(3, 17))])
+    with open(path, "rb") as f:
+      data = bytearray(f.read())
+    # The data of the first matrix starts at the offset in its entry, after the 32 byte header
+    offset = int.from_bytes(data[32 + 16:32 + 24], "little")
+    for where, lazy_ok in [(offset, True), (offset + 17 * 4, True), (32, False)]:
+      data[where] ^= 1
+      with open(damaged, "wb") as f:
+        f.write(data)
+      data[where] ^= 1
+      expect(raises(TypeError, nc.load, damaged), "copying load of a damaged file")
+      expect(raises(TypeError, nc.load, damaged, mmap=True, verify=True), "verified mapping of a damaged file")
+      # Without verify a mapping only checks the header and entries, not the data
+      expect(raises(TypeError, nc.load, damaged, mmap=True) != lazy_ok, "unverified mapping of a damaged file")
+    with open(damaged, "wb") as f:
+      f.write(data[:-4])
+    expect(raises(TypeError, nc.load, damaged) and raises(TypeError, nc.load, damaged, mmap=True), "truncated file")
+
+
+@test
+def half_precision_rounding():
+  values = [1, 1 + 2 ** -11, 1 + 3 * 2 ** -11, 1 + 2 ** -8, 1 + 3 * 2 ** -8, -2.5, 65504, 2 ** -24]
+  want = {"fp16": [0x3C00, 0x3C00, 0x3C02, 0x3C04, 0x3C0C, 0xC100, 0x7BFF, 0x0001],
+          "bf16": [0x3F80, 0x3F80, 0x3F80, 0x3F80, 0x3F82, 0xC020, 0x4780, 0x3380]}
+  m = nc.Matrix([values])
+  for fmt, bits in want.items():
+    data = m.to_half(fmt)
+    expect(list(array.array('H', data)) == bits, fmt + " rounding")
+    back = nc.Matrix.from_half(data, 1, len(values), fmt)
+    expect(back.to_half(fmt) == data, fmt + " widening is not exact")
+  expect(m.to_half() == m.to_half("fp16"), "fp16 is the default")
+  expect(raises(TypeError, m.to_half, "fp8"), "unknown format")
+  expect(raises(TypeError, nc.Matrix.from_half, b"\0" * 6, 2, 2), "buffer too small")
+
+
+@test
+def float64_ops():
+  la, lb = rand_lists(29, 37), rand_lists(37, 41)
+  a, b = nc.Matrix(la, dtype="float64"), nc.Matrix(lb, dtype="float64")
+  expect(a.dtype == "float64" and nc.Matrix(la).dtype == "float32", "dtype")
+  expect(a.to_list() == la and a[3, 4] == la[3][4], "float64 keeps every digit")
+  expect(close(a @ b, matmul(la, lb), 1e-12), "product")
+  expect(close(a.transpose(), [list(r) for r in zip(*la)], 0), "transpose")
+  expect(close(a + a, elementwise(lambda x, y: x + y, la, la), 0), "add")
+  expect(close(a - a, [[0] * 37] * 29, 0), "sub")
+  expect(close(a.element_mult(a), elementwise(lambda x, y: x * y, la, la), 0), "element_mult")
+  expect(close(a * 0.1, [[x * 0.1 for x in row] for row in la], 0), "scale")
+  col = [[random.uniform(-1, 1)] for _ in range(1000)]
+  v = nc.Matrix(col, dtype="float64")
+  expect(abs(v.dot(v) - sum(x[0] * x[0] for x in col)) < 1e-12, "dot")
+  u = nc.Matrix(col[:3], dtype="float64")
+  expect(close(u.outer(u), [[x[0] * y[0] for y in col[:3]] for x in col[:3]], 0), "outer")
+  sq = nc.Matrix([[1.1, 2], [3, 4]], dtype="float64")
+  same = sq
+  sq **= 2
+  sq @= sq
+  sq *= 0.5
+  sq[0, 1] = 7
+  expect(sq is same and sq.dtype == "float64", "in-place operators keep the matrix")
+  p = matmul([[1.1, 2], [3, 4]], [[1.1, 2], [3, 4]])
+  want = [[x * 0.5 for x in row] for row in matmul(p, p)]
+  want[0][1] = 7
+  expect(close(sq, want, 1e-15), "in-place results")
+  out = nc.Matrix.zeros(29, 41).astype("float64")
+  expect(a.multiply(b, out=out) is out, "out=")
+  expect(raises(TypeError, a.multiply, b, out=nc.Matrix.zeros(29, 41)), "float32 out for a float64 result")
+
+
+@test
+def float64_astype_and_limits():
+  lists = [[0.1, 1e-300], [2 ** 0.5, -3]]
+  d = nc.Matrix(lists, dtype="float64")
+  f = d.astype("float32")
+  expect(f.dtype == "float32" and f.to_list() == [[f32(x) for x in row] for row in lists], "narrowing rounds to float")
+  expect(f.astype("float64").to_list() == f.to_list(), "widening is exact")
+  expect(d.astype("float64").to_list() == lists, "float64 copy")
+  expect(raises(TypeError, d.__add__, f), "mixed dtypes")
+  expect(raises(TypeError, nc.Matrix, lists, dtype="int8"), "unknown dtype")
+  # Everything else is float32 only, with an error rather than a silent conversion
+  expect(raises(TypeError, d.exp) and raises(TypeError, lambda: d[0:1]) and raises(TypeError, memoryview, d),
+         "float32-only operations")
+  nc.set_lazy(True)
+  try:
+    expect(raises(TypeError, d.exp) and raises(TypeError, d.element_pow, 2), "float32-only operations in lazy mode")
+  finally:
+    nc.set_lazy(False)
+
+
+def main():
+  random.seed(61)
+  failed = 0
+  for t in TESTS:
+    try:
+      t()
+      print(G + "PASS " + W + t.__name__)
+    except Exception:
+      failed += 1
+      print(R + "FAIL " + W + t.__name__)
+      traceback.print_exc()
+  print("%d of %d numc checks failed" % (failed, len(TESTS)) if failed else "ALL %d NUMC CHECKS PASSED" % len(TESTS))
+  return 1 if failed else 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,148 @@
+"""
+Performance regression gate around matrix_bench (performance/bench.c).
+
+  perfcheck.py --record   runs the suite and stores every sample as the baseline
+  perfcheck.py            runs it again and compares each op, shape and thread
+                          count against the baseline; exits 1 on a regression
+
+Each run is --trials separate processes of matrix_bench, since samples
+within one process share its page placement and clock frequency and so vary
+less than runs do. A case regresses only when, by more than --tolerance,
+  - the confidence interval of its pooled median lies entirely above the
+    baseline's, and
+  - every trial's median is above the slowest baseline trial's.
+The intervals are distribution-free (order statistics), so skewed timings
+need no assumptions.
+Baselines are only meaningful on the machine that recorded them, so none is
+committed: without one perfcheck.py exits 2 and asks for make perfbaseline.
+"""
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+from statistics import NormalDist
+
+W  = '\033[0m'  # white (normal)
+R  = '\033[31m' # red
+G  = '\033[32m' # green
+
+
+def case_key(result):
+  return "%s %dx%dx%d t%d" % (result["op"], result["m"], result["k"], result["n"], result["threads"])
+
+
+def run_trials(bench, trials, bench_args):
+  """Runs the suite trials times; returns (kernels, {case: [samples in ms of each trial]})"""
+  pooled = {}
+  kernels = None
+  with tempfile.TemporaryDirectory() as tmp:
+    for trial in range(trials):
+      out = os.path.join(tmp, "trial%d.json" % trial)
+      print("trial %d/%d" % (trial + 1, trials), flush=True)
+      subprocess.run([bench, "-o", out] + bench_args, check=True, stdout=subprocess.DEVNULL)
+      with open(out) as f:
+        run = json.load(f)
+      kernels = run["kernels"]
+      for result in run["results"]:
+        pooled.setdefault(case_key(result), []).append(result["samples_ms"])
+  return kernels, pooled
+
+
+def median_interval(samples, confidence):
+  """
+  Order statistics [x_(j), x_(n-j+1)] that cover the median with at least the
+  given confidence: exact binomial bounds for small n, normal approximation
+  otherwise. Too few samples give the whole range.
+  """
+  xs = sorted(samples)
+  n = len(xs)
+  alpha = 1 - confidence
+  if n < 30:
+    j, tail = 0, 0.0
+    while True:
+      tail += math.comb(n, j) / 2 ** n
+      if 2 * tail > alpha:
+        break
+      j += 1
+  else:
+    z = NormalDist().inv_cdf(1 - alpha / 2)
+    j = int(math.floor(n / 2 - z * math.sqrt(n) / 2))
+  j = max(j, 1)
+  return xs[j - 1], xs[n - j]
+
+
+def median(samples):
+  xs = sorted(samples)
+  n = len(xs)
+  return (xs[(n - 1) // 2] + xs[n // 2]) / 2
+
+
+def compare(baseline, current, tolerance, confidence):
+  """Prints one line per case; returns the number of regressions"""
+  regressions = 0
+  print("%-40s %11s %11s %8s" % ("case", "base ms", "now ms", "change"))
+  for key, now_trials in current.items():
+    now = [x for trial in now_trials for x in trial]
+    if key not in baseline:
+      print("%-40s %11s %11.4f %8s" % (key, "-", median(now), "new"))
+      continue
+    base_trials = baseline[key]
+    base = [x for trial in base_trials for x in trial]
+    base_lo, base_hi = median_interval(base, confidence)
+    now_lo, now_hi = median_interval(now, confidence)
+    base_medians = [median(trial) for trial in base_trials]
+    now_medians = [median(trial) for trial in now_trials]
+    change = median(now) / median(base) - 1
+    verdict = ""
+    if now_lo > base_hi * (1 + tolerance) and min(now_medians) > max(base_medians) * (1 + tolerance):
+      verdict = R + "SLOWER" + W
+      regressions += 1
+    elif now_hi * (1 + tolerance) < base_lo and max(now_medians) * (1 + tolerance) < min(base_medians):
+      verdict = G + "faster" + W
+    print("%-40s %11.4f %11.4f %+7.1f%% %s" % (key, median(base), median(now), change * 100, verdict))
+  for key in baseline:
+    if key not in current:
+      print("%-40s %11.4f %11s %8s" % (key, median([x for trial in baseline[key] for x in trial]), "-", "missing"))
+  return regressions
+
+
+def main():
+  parser = argparse.ArgumentParser(description="Compare matrix_bench runs against a stored baseline")
+  parser.add_argument("--bench", default="./matrix_bench", help="matrix_bench binary")
+  parser.add_argument("--baseline", default="testing/perf_baseline.json")
+  parser.add_argument("--record", action="store_true", help="store this run as the baseline instead of comparing")
+  parser.add_argument("--trials", type=int, default=3, help="matrix_bench processes per run")
+  parser.add_argument("--tolerance", type=float, default=0.05, help="slowdown allowed beyond the intervals")
+  parser.add_argument("--confidence", type=float, default=0.95, help="of each median interval")
+  parser.add_argument("bench_args", nargs="*", help="passed to matrix_bench (after --)")
+  args = parser.parse_args()
+
+  if not args.record and not os.path.exists(args.baseline):
+    print("no baseline at %s: run make perfbaseline first (baselines are per machine and not committed)"
+          % args.baseline, file=sys.stderr)
+    return 2
+  kernels, current = run_trials(args.bench, args.trials, args.bench_args)
+
+  if args.record:
+    with open(args.baseline, "w") as f:
+      json.dump({"kernels": kernels, "trials": args.trials, "samples_ms": current}, f)
+    print("baseline of %d cases written to %s" % (len(current), args.baseline))
+    return 0
+
+  with open(args.baseline) as f:
+    baseline = json.load(f)
+  if baseline["kernels"] != kernels:
+    print("warning: baseline used %s kernels, this run %s" % (baseline["kernels"], kernels), file=sys.stderr)
+  regressions = compare(baseline["samples_ms"], current, args.tolerance, args.confidence)
+  if regressions > 0:
+    print(R + "%d case(s) significantly slower than the baseline" % regressions + W)
+    return 1
+  print(G + "no significant slowdowns" + W)
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -1,4 +1,5 @@
 #include "shared.h"
+#include <string.h>
 
 // Initial AlmostEqualULPs version - fast and simple, but
 // some limitations. 
@@ -8,7 +9,11 @@ int AlmostEqualUlps(float A, float B, int maxUlps) {
     // if (A == B) {
     //     return 1;
     // }
-    int intDiff = abs(*(int*)&A - *(int*)&B);
+    // memcpy instead of *(int*)&A, which breaks strict aliasing at -O3
+    int a, b;
+    memcpy(&a, &A, sizeof(a));
+    memcpy(&b, &B, sizeof(b));
+    int intDiff = abs(a - b);
     if (intDiff <= maxUlps) {
         return 1;
     }
@@ -185,8 +190,9 @@ void print_multiplication(matrix *mat1, matrix *mat2) {
     printf("\n");
 }
 
+// Wall clock: process CPU time adds up every OpenMP thread's time
 long timer() {
     struct timespec tp;
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
+    clock_gettime(CLOCK_MONOTONIC, &tp);
     return (long) (tp.tv_sec*1000 + (double)tp.tv_nsec/1000000); //milliseconds
 }
@@ -15,6 +15,9 @@ const int column_numbers[NUM_SIZES] =  {1000, 1000, 3   , 1   , 1};
 const char* all_matrices_filename = "./tmp/all_size_matrices_file";
 const char* all_matrices_ops_filename = "./tmp/all_size_matrices_ops_file";
 const char* naive_duration_file = "./tmp/naive_duration_file";
+// Binary copies of the two fixtures above (performance/matfile.h), made by matfile_convert
+const char* all_matrices_bin_filename = "./tmp/all_size_matrices_file.m61";
+const char* all_matrices_ops_bin_filename = "./tmp/all_size_matrices_ops_file.m61";
 
 matrix** read_matrices_from_file(const char* filename);
 int perform_all_ops(matrix** matrices, int coun, matrix ***matrix_ans_pointer);